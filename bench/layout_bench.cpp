@@ -0,0 +1,117 @@
+#include "aosoa.hpp"
+#include "soa.hpp"
+#include "vecxyz.hpp"
+#include <chrono>
+#include <cstddef>
+#include <fmt/core.h>
+#include <random>
+#include <vector>
+
+using vecxyz::AoSoA;
+using vecxyz::SoA;
+using vecxyz::VecXYZ;
+
+namespace {
+constexpr std::size_t point_count = 1U << 22U;
+constexpr int repeats = 20;
+
+template <class Fn> double best_ms(Fn &&fn) {
+    double best = 1e300;
+    for (int i = 0; i < repeats; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// Keeps results alive so the kernels are not optimized away.
+volatile float sink;
+
+void report(const char *layout, const char *kernel, double ms) {
+    fmt::print("{:<10} {:<16} {:8.3f} ms {:8.2f} Mpts/s\n", layout, kernel, ms,
+               point_count / ms / 1e3);
+}
+
+void bench_aos(const std::vector<VecXYZ> &input) {
+    std::vector<VecXYZ> points = input;
+    std::vector<float> norms(points.size());
+    report("AoS", "scale+translate", best_ms([&] {
+               for (auto &p : points) {
+                   p.x = p.x * 0.5F + 1.0F;
+                   p.y = p.y * 0.5F + 2.0F;
+                   p.z = p.z * 0.5F + 3.0F;
+               }
+           }));
+    report("AoS", "squared norms", best_ms([&] {
+               for (std::size_t i = 0; i < points.size(); ++i) {
+                   const auto &p = points[i];
+                   norms[i] = p.x * p.x + p.y * p.y + p.z * p.z;
+               }
+               sink = norms.back();
+           }));
+}
+
+void bench_soa(const std::vector<VecXYZ> &input) {
+    SoA<VecXYZ> points(input.begin(), input.end());
+    std::vector<float> norms(points.size());
+    float *x = points.column<0>().data();
+    float *y = points.column<1>().data();
+    float *z = points.column<2>().data();
+    report("SoA", "scale+translate", best_ms([&] {
+               for (std::size_t i = 0; i < points.size(); ++i) {
+                   x[i] = x[i] * 0.5F + 1.0F;
+                   y[i] = y[i] * 0.5F + 2.0F;
+                   z[i] = z[i] * 0.5F + 3.0F;
+               }
+           }));
+    report("SoA", "squared norms", best_ms([&] {
+               for (std::size_t i = 0; i < points.size(); ++i) {
+                   norms[i] = x[i] * x[i] + y[i] * y[i] + z[i] * z[i];
+               }
+               sink = norms.back();
+           }));
+}
+
+template <std::size_t W>
+void bench_aosoa(const char *layout, const std::vector<VecXYZ> &input) {
+    AoSoA<W> points;
+    report(layout, "from AoS", best_ms([&] {
+               points.assign(input.data(), input.size());
+           }));
+    std::vector<VecXYZ> back(input.size());
+    report(layout, "to AoS", best_ms([&] { points.store(back.data()); }));
+
+    std::vector<float> norms(points.size());
+    report(layout, "scale+translate", best_ms([&] {
+               for (auto &tile : points.tiles()) {
+                   for (std::size_t lane = 0; lane < W; ++lane) {
+                       tile.x[lane] = tile.x[lane] * 0.5F + 1.0F;
+                       tile.y[lane] = tile.y[lane] * 0.5F + 2.0F;
+                       tile.z[lane] = tile.z[lane] * 0.5F + 3.0F;
+                   }
+               }
+           }));
+    report(layout, "squared norms", best_ms([&] {
+               squared_norms(points, norms.data());
+               sink = norms.back();
+           }));
+}
+} // namespace
+
+int main() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-100.0F, 100.0F);
+    std::vector<VecXYZ> input(point_count);
+    for (auto &p : input) {
+        p = {dist(rng), dist(rng), dist(rng)};
+    }
+
+    bench_aos(input);
+    bench_soa(input);
+    bench_aosoa<8>("AoSoA<8>", input);
+    bench_aosoa<16>("AoSoA<16>", input);
+    return 0;
+}
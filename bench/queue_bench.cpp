@@ -0,0 +1,126 @@
+#include "mpmc_queue.hpp"
+#include "vecxyz.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <fmt/core.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using vecxyz::MpmcQueue;
+using vecxyz::VecXYZ;
+
+namespace {
+constexpr std::size_t samples_per_producer = 1U << 20U;
+constexpr std::size_t queue_capacity = 1U << 14U;
+constexpr std::size_t batch = 64;
+constexpr int repeats = 5;
+
+// The baseline the lock-free queue replaces.
+class LockedQueue {
+  public:
+    explicit LockedQueue(std::size_t capacity) : capacity_(capacity) {}
+
+    bool try_enqueue(const VecXYZ &p) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (items_.size() == capacity_) {
+            return false;
+        }
+        items_.push_back(p);
+        return true;
+    }
+    std::size_t try_dequeue_bulk(VecXYZ *out, std::size_t max_count) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const std::size_t n = std::min(max_count, items_.size());
+        std::copy_n(items_.begin(), n, out);
+        items_.erase(items_.begin(), items_.begin() + n);
+        return n;
+    }
+
+  private:
+    std::size_t capacity_;
+    std::mutex mutex_;
+    std::deque<VecXYZ> items_;
+};
+
+// Producers enqueue one sample at a time; consumers drain up to
+// `dequeue_batch` at once. Returns the best time in ms over `repeats`.
+template <class Queue>
+double run(std::size_t producers, std::size_t consumers,
+           std::size_t dequeue_batch) {
+    double best = 1e300;
+    for (int r = 0; r < repeats; ++r) {
+        Queue queue(queue_capacity);
+        std::atomic<std::size_t> remaining{producers * samples_per_producer};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> threads;
+        for (std::size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&, p] {
+                while (!go.load()) {
+                }
+                for (std::size_t i = 0; i < samples_per_producer; ++i) {
+                    const VecXYZ sample{static_cast<float>(p),
+                                        static_cast<float>(i), 0.0F};
+                    while (!queue.try_enqueue(sample)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        for (std::size_t c = 0; c < consumers; ++c) {
+            threads.emplace_back([&] {
+                std::vector<VecXYZ> out(dequeue_batch);
+                while (!go.load()) {
+                }
+                while (remaining.load(std::memory_order_relaxed) != 0) {
+                    const std::size_t n =
+                        queue.try_dequeue_bulk(out.data(), dequeue_batch);
+                    if (n == 0) {
+                        std::this_thread::yield();
+                        continue;
+                    }
+                    remaining.fetch_sub(n, std::memory_order_relaxed);
+                }
+            });
+        }
+        const auto start = std::chrono::steady_clock::now();
+        go.store(true);
+        for (auto &t : threads) {
+            t.join();
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void report(const char *queue, std::size_t producers, std::size_t consumers,
+            std::size_t dequeue_batch, double ms) {
+    fmt::print("{:<12} {:>2}P {:>2}C batch {:>3} {:9.3f} ms {:7.2f} M/s\n",
+               queue, producers, consumers, dequeue_batch, ms,
+               producers * samples_per_producer / ms / 1e3);
+}
+} // namespace
+
+int main() {
+    const std::size_t hardware =
+        std::max(2U, std::thread::hardware_concurrency());
+    std::vector<std::size_t> producer_counts;
+    for (std::size_t p = 1; p <= hardware; p *= 2) {
+        producer_counts.push_back(p);
+    }
+    for (const std::size_t consumers : {std::size_t{1}, std::size_t{2}}) {
+        for (const std::size_t producers : producer_counts) {
+            report("mutex+deque", producers, consumers, batch,
+                   run<LockedQueue>(producers, consumers, batch));
+            report("mpmc", producers, consumers, 1,
+                   run<MpmcQueue<VecXYZ>>(producers, consumers, 1));
+            report("mpmc bulk", producers, consumers, batch,
+                   run<MpmcQueue<VecXYZ>>(producers, consumers, batch));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+
+namespace vecxyz {
+
+// std::allocator that places every allocation on an `Alignment`-byte
+// boundary, so columns and tiles can be loaded with aligned SIMD loads and
+// never straddle a cache line at the start.
+template <class T, std::size_t Alignment = 64> class AlignedAllocator {
+    static_assert(Alignment >= alignof(T), "alignment too small for T");
+    static_assert((Alignment & (Alignment - 1)) == 0,
+                  "alignment must be a power of two");
+
+  public:
+    using value_type = T;
+
+    template <class U> struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept {}
+
+    T *allocate(std::size_t count) {
+        return static_cast<T *>(::operator new(
+            count * sizeof(T), std::align_val_t{Alignment}));
+    }
+
+    void deallocate(T *data, std::size_t) noexcept {
+        ::operator delete(data, std::align_val_t{Alignment});
+    }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const noexcept {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const noexcept {
+        return false;
+    }
+};
+
+} // namespace vecxyz
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include "simd_transpose.hpp"
+#include "vecxyz.hpp"
+#include <algorithm>
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/collection_size_type.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace vecxyz {
+
+// W points stored component by component: one SIMD register (or two) per
+// component, with all three components of a point in the same few lines.
+template <std::size_t W> struct alignas(W >= 16 ? 64 : 32) VecTile {
+    float x[W];
+    float y[W];
+    float z[W];
+};
+
+// Array of structs of arrays: points tiled into VecTile<W> blocks. Kernels
+// get full SIMD lanes per component like SoA, while a point's x, y and z
+// stay within one tile like AoS. Lanes past size() in the last tile hold
+// unspecified values.
+template <std::size_t W = 8> class AoSoA {
+    static_assert(W == 8 || W == 16, "tiles hold 8 or 16 points");
+    static_assert(sizeof(VecTile<W>) == 3 * W * sizeof(float),
+                  "tiles must not be padded");
+
+  public:
+    static constexpr std::size_t width = W;
+    using tile_type = VecTile<W>;
+    using tile_vector = std::vector<tile_type, AlignedAllocator<tile_type>>;
+
+    AoSoA() = default;
+    explicit AoSoA(const std::vector<VecXYZ> &points) {
+        assign(points.data(), points.size());
+    }
+
+    // AoS -> AoSoA.
+    void assign(const VecXYZ *points, std::size_t count) {
+        size_ = count;
+        tiles_.assign((count + W - 1) / W, tile_type{});
+        std::size_t i = 0;
+#ifdef VECXYZ_HAS_SSE
+        for (; i + 4 <= count; i += 4) {
+            __m128 x;
+            __m128 y;
+            __m128 z;
+            load_transpose4(points + i, x, y, z);
+            tile_type &tile = tiles_[i / W];
+            const std::size_t lane = i % W;
+            _mm_store_ps(tile.x + lane, x);
+            _mm_store_ps(tile.y + lane, y);
+            _mm_store_ps(tile.z + lane, z);
+        }
+#endif
+        for (; i < count; ++i) {
+            set(i, points[i]);
+        }
+    }
+
+    // AoSoA -> AoS; `out` must hold size() points.
+    void store(VecXYZ *out) const {
+        std::size_t i = 0;
+#ifdef VECXYZ_HAS_SSE
+        for (; i + 4 <= size_; i += 4) {
+            const tile_type &tile = tiles_[i / W];
+            const std::size_t lane = i % W;
+            transpose_store4(_mm_load_ps(tile.x + lane),
+                             _mm_load_ps(tile.y + lane),
+                             _mm_load_ps(tile.z + lane), out + i);
+        }
+#endif
+        for (; i < size_; ++i) {
+            out[i] = get(i);
+        }
+    }
+
+    std::vector<VecXYZ> to_aos() const {
+        std::vector<VecXYZ> points(size_);
+        store(points.data());
+        return points;
+    }
+
+    VecXYZ get(std::size_t index) const {
+        const tile_type &tile = tiles_[index / W];
+        const std::size_t lane = index % W;
+        return {tile.x[lane], tile.y[lane], tile.z[lane]};
+    }
+
+    void set(std::size_t index, const VecXYZ &point) {
+        tile_type &tile = tiles_[index / W];
+        const std::size_t lane = index % W;
+        tile.x[lane] = point.x;
+        tile.y[lane] = point.y;
+        tile.z[lane] = point.z;
+    }
+
+    void push_back(const VecXYZ &point) {
+        if (size_ % W == 0) {
+            tiles_.push_back(tile_type{});
+        }
+        set(size_++, point);
+    }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::size_t tile_count() const { return tiles_.size(); }
+    tile_vector &tiles() { return tiles_; }
+    const tile_vector &tiles() const { return tiles_; }
+
+  private:
+    friend class boost::serialization::access;
+
+    // Tiles go out whole, padding lanes included, as one float array.
+    template <class Archive> void save(Archive &ar, const unsigned int) const {
+        const boost::serialization::collection_size_type count(size_);
+        ar << count;
+        ar << boost::serialization::make_array(
+            reinterpret_cast<const float *>(tiles_.data()),
+            tiles_.size() * 3 * W);
+    }
+
+    template <class Archive> void load(Archive &ar, const unsigned int) {
+        boost::serialization::collection_size_type count;
+        ar >> count;
+        size_ = count;
+        tiles_.resize((size_ + W - 1) / W);
+        ar >> boost::serialization::make_array(
+                  reinterpret_cast<float *>(tiles_.data()),
+                  tiles_.size() * 3 * W);
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    tile_vector tiles_;
+    std::size_t size_{};
+};
+
+// Batch kernels. Each runs over whole tiles with fixed-width inner loops,
+// which the compiler turns into aligned full-width vector code.
+
+template <std::size_t W>
+void translate(AoSoA<W> &points, const VecXYZ &offset) {
+    for (auto &tile : points.tiles()) {
+        for (std::size_t lane = 0; lane < W; ++lane) {
+            tile.x[lane] += offset.x;
+            tile.y[lane] += offset.y;
+            tile.z[lane] += offset.z;
+        }
+    }
+}
+
+template <std::size_t W> void scale(AoSoA<W> &points, float factor) {
+    for (auto &tile : points.tiles()) {
+        for (std::size_t lane = 0; lane < W; ++lane) {
+            tile.x[lane] *= factor;
+            tile.y[lane] *= factor;
+            tile.z[lane] *= factor;
+        }
+    }
+}
+
+// a[i] += factor * b[i]; a and b must have the same size.
+template <std::size_t W>
+void axpy(AoSoA<W> &a, float factor, const AoSoA<W> &b) {
+    for (std::size_t t = 0; t < a.tile_count(); ++t) {
+        auto &ta = a.tiles()[t];
+        const auto &tb = b.tiles()[t];
+        for (std::size_t lane = 0; lane < W; ++lane) {
+            ta.x[lane] += factor * tb.x[lane];
+            ta.y[lane] += factor * tb.y[lane];
+            ta.z[lane] += factor * tb.z[lane];
+        }
+    }
+}
+
+// out[i] = dot(a[i], b[i]); `out` holds a.size() floats.
+template <std::size_t W>
+void dot(const AoSoA<W> &a, const AoSoA<W> &b, float *out) {
+    for (std::size_t t = 0; t < a.tile_count(); ++t) {
+        const auto &ta = a.tiles()[t];
+        const auto &tb = b.tiles()[t];
+        alignas(64) float lanes[W];
+        for (std::size_t lane = 0; lane < W; ++lane) {
+            lanes[lane] = ta.x[lane] * tb.x[lane] + ta.y[lane] * tb.y[lane] +
+                          ta.z[lane] * tb.z[lane];
+        }
+        std::copy_n(lanes, std::min(W, a.size() - t * W), out + t * W);
+    }
+}
+
+// out[i] = |points[i]|^2; `out` holds points.size() floats.
+template <std::size_t W>
+void squared_norms(const AoSoA<W> &points, float *out) {
+    dot(points, points, out);
+}
+
+} // namespace vecxyz
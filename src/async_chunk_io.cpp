@@ -0,0 +1,470 @@
+#include "async_chunk_io.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/system_error.hpp>
+#include <boost/version.hpp>
+#include <cstring>
+#include <fmt/core.h>
+
+#if defined(BOOST_ASIO_HAS_FILE)
+#include <boost/asio/random_access_file.hpp>
+#if BOOST_VERSION >= 108000
+#include <boost/asio/buffer_registration.hpp>
+#include <boost/asio/registered_buffer.hpp>
+#define VECXYZ_ASYNC_REGISTERED_BUFFERS 1
+#endif
+#else
+#include <boost/asio/error.hpp>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace vecxyz {
+namespace {
+#if defined(BOOST_ASIO_HAS_FILE)
+using AsyncFile = boost::asio::random_access_file;
+
+AsyncFile open_for_write(boost::asio::io_context &io,
+                         const std::string &path) {
+    return AsyncFile(io, path,
+                     AsyncFile::write_only | AsyncFile::create |
+                         AsyncFile::truncate);
+}
+
+AsyncFile open_for_read(boost::asio::io_context &io, const std::string &path) {
+    return AsyncFile(io, path, AsyncFile::read_only);
+}
+#else
+// Asio only has file objects on top of io_uring (or IOCP). Elsewhere the
+// positional calls run inline and the completion is posted, which keeps the
+// asynchronous contract at queue depth one.
+class AsyncFile {
+  public:
+    AsyncFile(boost::asio::io_context &io, const std::string &path, int flags)
+        : io_(io), fd_(::open(path.c_str(), flags | O_CLOEXEC, 0644)) {
+        if (fd_ < 0) {
+            throw boost::system::system_error(
+                errno, boost::system::system_category(), path);
+        }
+    }
+    AsyncFile(AsyncFile &&other) noexcept : io_(other.io_), fd_(other.fd_) {
+        other.fd_ = -1;
+    }
+    AsyncFile(const AsyncFile &) = delete;
+    AsyncFile &operator=(const AsyncFile &) = delete;
+    AsyncFile &operator=(AsyncFile &&) = delete;
+    ~AsyncFile() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    std::uint64_t size() const {
+        struct stat info {};
+        if (::fstat(fd_, &info) != 0) {
+            throw boost::system::system_error(
+                errno, boost::system::system_category());
+        }
+        return static_cast<std::uint64_t>(info.st_size);
+    }
+
+    template <class Handler>
+    void async_write_some_at(std::uint64_t offset,
+                             boost::asio::const_buffer buffer,
+                             Handler &&handler) {
+        complete(::pwrite(fd_, buffer.data(), buffer.size(),
+                          static_cast<off_t>(offset)),
+                 std::forward<Handler>(handler));
+    }
+
+    template <class Handler>
+    void async_read_some_at(std::uint64_t offset,
+                            boost::asio::mutable_buffer buffer,
+                            Handler &&handler) {
+        complete(::pread(fd_, buffer.data(), buffer.size(),
+                         static_cast<off_t>(offset)),
+                 std::forward<Handler>(handler));
+    }
+
+  private:
+    template <class Handler> void complete(ssize_t result, Handler &&handler) {
+        boost::system::error_code ec;
+        std::size_t transferred = 0;
+        if (result < 0) {
+            ec.assign(errno, boost::system::system_category());
+        } else if (result == 0) {
+            ec = boost::asio::error::eof;
+        } else {
+            transferred = static_cast<std::size_t>(result);
+        }
+        boost::asio::post(io_, [handler = std::forward<Handler>(handler), ec,
+                                transferred]() mutable {
+            handler(ec, transferred);
+        });
+    }
+
+    boost::asio::io_context &io_;
+    int fd_;
+};
+
+AsyncFile open_for_write(boost::asio::io_context &io,
+                         const std::string &path) {
+    return AsyncFile(io, path, O_WRONLY | O_CREAT | O_TRUNC);
+}
+
+AsyncFile open_for_read(boost::asio::io_context &io, const std::string &path) {
+    return AsyncFile(io, path, O_RDONLY);
+}
+#endif
+
+// Resubmits after short transfers until the whole buffer has moved.
+template <class Buffer, class Submit, class Handler>
+void transfer_all(Buffer buffer, std::uint64_t offset, Submit submit,
+                  Handler handler) {
+    submit(offset, buffer,
+           [buffer, offset, submit,
+            handler](boost::system::error_code ec,
+                     std::size_t transferred) mutable {
+               if (!ec && transferred == 0) {
+                   ec = boost::asio::error::eof;
+               }
+               if (ec || transferred == buffer.size()) {
+                   handler(ec);
+                   return;
+               }
+               buffer += transferred;
+               transfer_all(buffer, offset + transferred, submit, handler);
+           });
+}
+
+auto write_submitter(AsyncFile &file) {
+    return [&file](std::uint64_t offset, auto buffer, auto handler) {
+        file.async_write_some_at(offset, buffer, std::move(handler));
+    };
+}
+
+auto read_submitter(AsyncFile &file) {
+    return [&file](std::uint64_t offset, auto buffer, auto handler) {
+        file.async_read_some_at(offset, buffer, std::move(handler));
+    };
+}
+
+std::exception_ptr to_exception(const boost::system::error_code &ec) {
+    return std::make_exception_ptr(boost::system::system_error(ec));
+}
+
+void post_failure(boost::asio::io_context &io, const AsyncChunkCompletion &done,
+                  std::exception_ptr error) {
+    boost::asio::post(io, [done, error] { done(error); });
+}
+} // namespace
+
+// Fixed set of staging buffers. When Asio runs files on io_uring they are
+// registered with the ring once, so the kernel does not pin and map them
+// again for every request.
+class AsyncChunkSlots {
+  public:
+    AsyncChunkSlots(boost::asio::io_context &io, std::size_t count,
+                    std::size_t bytes)
+        : buffers_(std::max<std::size_t>(count, 1), std::vector<char>(bytes)) {
+#ifdef VECXYZ_ASYNC_REGISTERED_BUFFERS
+        std::vector<boost::asio::mutable_buffer> views;
+        views.reserve(buffers_.size());
+        for (auto &buffer : buffers_) {
+            views.push_back(boost::asio::buffer(buffer));
+        }
+        try {
+            registration_ = std::make_unique<Registration>(
+                boost::asio::register_buffers(io, views));
+        } catch (const boost::system::system_error &) {
+            // A ring holds one registration at a time; when another reader
+            // or writer owns it, plain buffers still work.
+        }
+#else
+        (void)io;
+#endif
+    }
+
+    std::size_t size() const { return buffers_.size(); }
+    char *data(std::size_t slot) { return buffers_[slot].data(); }
+
+    template <class Handler>
+    void write_at(AsyncFile &file, std::size_t slot, std::uint64_t offset,
+                  std::size_t bytes, Handler handler) {
+#ifdef VECXYZ_ASYNC_REGISTERED_BUFFERS
+        if (registration_) {
+            transfer_all(boost::asio::buffer((*registration_)[slot], bytes),
+                         offset, write_submitter(file), std::move(handler));
+            return;
+        }
+#endif
+        transfer_all(boost::asio::const_buffer(data(slot), bytes), offset,
+                     write_submitter(file), std::move(handler));
+    }
+
+    template <class Handler>
+    void read_at(AsyncFile &file, std::size_t slot, std::uint64_t offset,
+                 std::size_t bytes, Handler handler) {
+#ifdef VECXYZ_ASYNC_REGISTERED_BUFFERS
+        if (registration_) {
+            transfer_all(boost::asio::buffer((*registration_)[slot], bytes),
+                         offset, read_submitter(file), std::move(handler));
+            return;
+        }
+#endif
+        transfer_all(boost::asio::mutable_buffer(data(slot), bytes), offset,
+                     read_submitter(file), std::move(handler));
+    }
+
+  private:
+    std::vector<std::vector<char>> buffers_;
+#ifdef VECXYZ_ASYNC_REGISTERED_BUFFERS
+    using Registration = boost::asio::buffer_registration<
+        std::vector<boost::asio::mutable_buffer>>;
+    std::unique_ptr<Registration> registration_;
+#endif
+};
+
+struct AsyncChunkWriter::Operation {
+    Operation(boost::asio::io_context &io, const std::string &path)
+        : file(open_for_write(io, path)) {}
+
+    AsyncFile file;
+    const VecXYZ *points{};
+    std::size_t count{};
+    std::vector<ChunkEntry> table;
+    std::size_t next{};
+    std::size_t in_flight{};
+    std::exception_ptr error;
+    AsyncChunkCompletion done;
+    ChunkFileHeader header{};
+};
+
+AsyncChunkWriter::AsyncChunkWriter(boost::asio::io_context &io,
+                                   AsyncChunkOptions options)
+    : io_(io), options_(options),
+      slots_(std::make_unique<AsyncChunkSlots>(
+          io, options.max_in_flight,
+          std::size_t{options.chunk_points} * sizeof(VecXYZ))) {}
+
+AsyncChunkWriter::~AsyncChunkWriter() = default;
+
+void AsyncChunkWriter::async_save(const std::string &path,
+                                  const VecXYZ *points, std::size_t count,
+                                  AsyncChunkCompletion done) {
+    std::shared_ptr<Operation> op;
+    try {
+        op = std::make_shared<Operation>(io_, path);
+        op->table = plan_chunks(count, options_.chunk_points);
+    } catch (...) {
+        post_failure(io_, done, std::current_exception());
+        return;
+    }
+    op->points = points;
+    op->count = count;
+    op->done = std::move(done);
+
+    const std::size_t lanes = std::min(slots_->size(), op->table.size());
+    if (lanes == 0) {
+        finish(op);
+        return;
+    }
+    for (std::size_t slot = 0; slot < lanes; ++slot) {
+        issue(op, slot);
+    }
+}
+
+void AsyncChunkWriter::issue(const std::shared_ptr<Operation> &op,
+                             std::size_t slot) {
+    if (op->error || op->next == op->table.size()) {
+        if (op->in_flight == 0) {
+            finish(op);
+        }
+        return;
+    }
+
+    const std::size_t index = op->next++;
+    ChunkEntry &entry = op->table[index];
+    const std::size_t bytes = std::size_t{entry.point_count} * sizeof(VecXYZ);
+    char *staging = slots_->data(slot);
+    std::memcpy(staging,
+                op->points + index * std::size_t{options_.chunk_points},
+                bytes);
+    entry.crc = crc32c(0, staging, bytes);
+
+    ++op->in_flight;
+    slots_->write_at(op->file, slot, entry.offset, bytes,
+                     [this, op, slot](const boost::system::error_code &ec) {
+                         --op->in_flight;
+                         if (ec && !op->error) {
+                             op->error = to_exception(ec);
+                         }
+                         issue(op, slot);
+                     });
+}
+
+void AsyncChunkWriter::finish(const std::shared_ptr<Operation> &op) {
+    if (op->error) {
+        op->done(op->error);
+        return;
+    }
+
+    // The table goes after the last chunk and the header last of all, so a
+    // file that is cut short never carries a valid header.
+    const std::uint64_t table_offset =
+        sizeof(ChunkFileHeader) + std::uint64_t{op->count} * sizeof(VecXYZ);
+    op->header = make_chunk_header(options_.chunk_points, op->count, op->table,
+                                   table_offset);
+    transfer_all(
+        boost::asio::const_buffer(op->table.data(),
+                                  op->table.size() * sizeof(ChunkEntry)),
+        table_offset, write_submitter(op->file),
+        [op](const boost::system::error_code &ec) {
+            if (ec) {
+                op->done(to_exception(ec));
+                return;
+            }
+            transfer_all(boost::asio::const_buffer(&op->header,
+                                                   sizeof(op->header)),
+                         0, write_submitter(op->file),
+                         [op](const boost::system::error_code &ec) {
+                             op->done(ec ? to_exception(ec) : nullptr);
+                         });
+        });
+}
+
+struct AsyncChunkReader::Operation {
+    Operation(boost::asio::io_context &io, const std::string &path)
+        : file(open_for_read(io, path)), path(path) {}
+
+    AsyncFile file;
+    std::string path;
+    ChunkFileHeader header{};
+    std::vector<ChunkEntry> table;
+    std::size_t next{};
+    std::size_t in_flight{};
+    std::exception_ptr error;
+    ChunkHandler on_chunk;
+    AsyncChunkCompletion done;
+};
+
+AsyncChunkReader::AsyncChunkReader(boost::asio::io_context &io,
+                                   AsyncChunkOptions options)
+    : io_(io), options_(options),
+      slots_(std::make_unique<AsyncChunkSlots>(
+          io, options.max_in_flight,
+          std::size_t{options.chunk_points} * sizeof(VecXYZ))) {}
+
+AsyncChunkReader::~AsyncChunkReader() = default;
+
+void AsyncChunkReader::async_load(const std::string &path,
+                                  ChunkHandler on_chunk,
+                                  AsyncChunkCompletion done) {
+    std::shared_ptr<Operation> op;
+    try {
+        op = std::make_shared<Operation>(io_, path);
+    } catch (...) {
+        post_failure(io_, done, std::current_exception());
+        return;
+    }
+    op->on_chunk = std::move(on_chunk);
+    op->done = std::move(done);
+
+    auto on_table = [this, op](const boost::system::error_code &ec) {
+        try {
+            if (ec) {
+                throw boost::system::system_error(ec, op->path);
+            }
+            check_chunk_table(op->header, op->table, op->path);
+        } catch (...) {
+            op->done(std::current_exception());
+            return;
+        }
+        const std::size_t lanes = std::min(slots_->size(), op->table.size());
+        if (lanes == 0) {
+            op->done(nullptr);
+            return;
+        }
+        for (std::size_t slot = 0; slot < lanes; ++slot) {
+            issue(op, slot);
+        }
+    };
+
+    auto on_header = [this, op,
+                      on_table](const boost::system::error_code &ec) {
+        try {
+            if (ec) {
+                throw boost::system::system_error(ec, op->path);
+            }
+            check_chunk_header(op->header, op->path);
+            if (op->header.chunk_points > options_.chunk_points) {
+                throw ChunkFileError(fmt::format(
+                    "{}: chunks of {} points exceed the {} point buffers",
+                    op->path, op->header.chunk_points,
+                    options_.chunk_points));
+            }
+            check_chunk_extent(op->header, op->file.size(), op->path);
+            op->table.resize(op->header.chunk_count);
+        } catch (...) {
+            op->done(std::current_exception());
+            return;
+        }
+        if (op->table.empty()) {
+            on_table({});
+            return;
+        }
+        transfer_all(
+            boost::asio::mutable_buffer(op->table.data(),
+                                        op->table.size() * sizeof(ChunkEntry)),
+            op->header.table_offset, read_submitter(op->file), on_table);
+    };
+
+    transfer_all(boost::asio::mutable_buffer(&op->header, sizeof(op->header)),
+                 0, read_submitter(op->file), on_header);
+}
+
+void AsyncChunkReader::issue(const std::shared_ptr<Operation> &op,
+                             std::size_t slot) {
+    if (op->error || op->next == op->table.size()) {
+        if (op->in_flight == 0) {
+            op->done(op->error);
+        }
+        return;
+    }
+
+    const std::size_t index = op->next++;
+    const ChunkEntry &entry = op->table[index];
+    const std::size_t bytes = std::size_t{entry.point_count} * sizeof(VecXYZ);
+
+    ++op->in_flight;
+    slots_->read_at(
+        op->file, slot, entry.offset, bytes,
+        [this, op, slot, index, bytes](const boost::system::error_code &ec) {
+            --op->in_flight;
+            if (!op->error) {
+                try {
+                    if (ec) {
+                        throw boost::system::system_error(ec, op->path);
+                    }
+                    const char *staging = slots_->data(slot);
+                    if (crc32c(0, staging, bytes) != op->table[index].crc) {
+                        throw ChunkFileError(
+                            fmt::format("{}: chunk {} checksum mismatch",
+                                        op->path, index));
+                    }
+                    op->on_chunk(index,
+                                 reinterpret_cast<const VecXYZ *>(staging),
+                                 op->table[index].point_count);
+                } catch (...) {
+                    op->error = std::current_exception();
+                }
+            }
+            issue(op, slot);
+        });
+}
+
+} // namespace vecxyz
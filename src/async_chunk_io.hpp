@@ -0,0 +1,81 @@
+#pragma once
+
+#include "chunk_file.hpp"
+#include <boost/asio/io_context.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+struct AsyncChunkOptions {
+    // Chunk reads or writes kept in flight at once; each one owns a staging
+    // buffer of chunk_points points for the whole run.
+    std::size_t max_in_flight = 8;
+    std::uint32_t chunk_points = default_chunk_points;
+};
+
+// Reports the outcome of an async operation: null on success, otherwise a
+// ChunkFileError or boost::system::system_error.
+using AsyncChunkCompletion = std::function<void(std::exception_ptr)>;
+
+class AsyncChunkSlots;
+
+// Saves points in the chunk file format with up to max_in_flight chunk
+// writes outstanding. With Asio's io_uring backend every write goes through
+// a staging buffer registered with the ring, and one thread driving
+// io.run() keeps the device queue full. Completions of one operation must
+// not run concurrently, so run the io_context on a single thread or strand.
+class AsyncChunkWriter {
+  public:
+    explicit AsyncChunkWriter(boost::asio::io_context &io,
+                              AsyncChunkOptions options = {});
+    ~AsyncChunkWriter();
+
+    // `points` must stay valid until `done` runs. A writer runs one save at
+    // a time.
+    void async_save(const std::string &path, const VecXYZ *points,
+                    std::size_t count, AsyncChunkCompletion done);
+
+  private:
+    struct Operation;
+    void issue(const std::shared_ptr<Operation> &op, std::size_t slot);
+    void finish(const std::shared_ptr<Operation> &op);
+
+    boost::asio::io_context &io_;
+    AsyncChunkOptions options_;
+    std::unique_ptr<AsyncChunkSlots> slots_;
+};
+
+// Loads a chunk file with up to max_in_flight chunk reads outstanding. Each
+// chunk is verified against its CRC32C and handed to `on_chunk` straight
+// from the staging buffer, in completion order, so decoding overlaps with
+// the reads still in flight.
+class AsyncChunkReader {
+  public:
+    using ChunkHandler = std::function<void(
+        std::size_t index, const VecXYZ *points, std::size_t count)>;
+
+    explicit AsyncChunkReader(boost::asio::io_context &io,
+                              AsyncChunkOptions options = {});
+    ~AsyncChunkReader();
+
+    // Files written with a larger chunk size than options.chunk_points are
+    // rejected with ChunkFileError.
+    void async_load(const std::string &path, ChunkHandler on_chunk,
+                    AsyncChunkCompletion done);
+
+  private:
+    struct Operation;
+    void issue(const std::shared_ptr<Operation> &op, std::size_t slot);
+
+    boost::asio::io_context &io_;
+    AsyncChunkOptions options_;
+    std::unique_ptr<AsyncChunkSlots> slots_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,777 @@
+#include "bvh.hpp"
+#include "parallel.hpp"
+#include "simd_transpose.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
+#ifdef VECXYZ_HAS_SSE
+#include <emmintrin.h>
+#endif
+
+namespace vecxyz {
+namespace {
+constexpr unsigned bin_count = 16;
+// Nodes with this many primitives bin in parallel blocks of this size.
+constexpr std::size_t parallel_bin_points = std::size_t{1} << 15U;
+// Subtrees with this many primitives build their children in parallel.
+constexpr std::size_t parallel_subtree_points = std::size_t{1} << 12U;
+// Below this depth SAH picks the splits; deeper nodes split at the median,
+// which bounds the depth and so the traversal stacks.
+constexpr unsigned sah_depth = 48;
+constexpr std::size_t stack_size = 128;
+constexpr std::size_t packet_grain = 64;
+
+constexpr float inf = std::numeric_limits<float>::infinity();
+
+float coordinate(const VecXYZ &p, unsigned axis) {
+    return axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+}
+
+float half_area(const Aabb &box) {
+    if (box.empty()) {
+        return 0.0F;
+    }
+    const float dx = box.max.x - box.min.x;
+    const float dy = box.max.y - box.min.y;
+    const float dz = box.max.z - box.min.z;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Aabb::merge without the call and the emptiness check.
+void grow(Aabb &box, const VecXYZ &min, const VecXYZ &max) {
+    box.min = {std::min(box.min.x, min.x), std::min(box.min.y, min.y),
+               std::min(box.min.z, min.z)};
+    box.max = {std::max(box.max.x, max.x), std::max(box.max.y, max.y),
+               std::max(box.max.z, max.z)};
+}
+
+bool overlaps(const Aabb &a, const Aabb &b) {
+    return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y &&
+           b.min.y <= a.max.y && a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+bool contains(const Aabb &outer, const VecXYZ &min, const VecXYZ &max) {
+    return outer.min.x <= min.x && outer.min.y <= min.y &&
+           outer.min.z <= min.z && max.x <= outer.max.x &&
+           max.y <= outer.max.y && max.z <= outer.max.z;
+}
+
+// Ray parameters per axis for the slab test: 1 / direction, where a zero
+// component becomes +inf.
+VecXYZ inverse_direction(const VecXYZ &d) {
+    return {1 / d.x, 1 / d.y, 1 / d.z};
+}
+
+#ifdef VECXYZ_HAS_SSE
+// Slab test of one ray against one box, with x, y and z in SSE lanes. The
+// fourth lane is set up to neither shrink nor grow the interval.
+struct RaySlabs {
+    __m128 origin;
+    __m128 inverse;
+
+    explicit RaySlabs(const Ray &ray) {
+        const VecXYZ inv = inverse_direction(ray.direction);
+        origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0);
+        inverse = _mm_setr_ps(inv.x, inv.y, inv.z, 1);
+    }
+
+    // Entry t, or +inf when the ray misses [t_min, t_max].
+    float enter(const VecXYZ &min, const VecXYZ &max, float t_min,
+                float t_max) const {
+        const __m128 lo = _mm_setr_ps(min.x, min.y, min.z, -inf);
+        const __m128 hi = _mm_setr_ps(max.x, max.y, max.z, inf);
+        const __m128 t1 = _mm_mul_ps(_mm_sub_ps(lo, origin), inverse);
+        const __m128 t2 = _mm_mul_ps(_mm_sub_ps(hi, origin), inverse);
+        __m128 near = _mm_min_ps(t1, t2);
+        __m128 far = _mm_max_ps(t1, t2);
+        near = _mm_max_ps(near, _mm_movehl_ps(near, near));
+        near = _mm_max_ss(near, _mm_shuffle_ps(near, near, 1));
+        far = _mm_min_ps(far, _mm_movehl_ps(far, far));
+        far = _mm_min_ss(far, _mm_shuffle_ps(far, far, 1));
+        const float t_near = std::max(_mm_cvtss_f32(near), t_min);
+        const float t_far = std::min(_mm_cvtss_f32(far), t_max);
+        return t_near <= t_far ? t_near : inf;
+    }
+};
+#else
+struct RaySlabs {
+    VecXYZ origin;
+    VecXYZ inverse;
+
+    explicit RaySlabs(const Ray &ray)
+        : origin(ray.origin), inverse(inverse_direction(ray.direction)) {}
+
+    float enter(const VecXYZ &min, const VecXYZ &max, float t_min,
+                float t_max) const {
+        float t_near = t_min;
+        float t_far = t_max;
+        for (unsigned axis = 0; axis < 3; ++axis) {
+            const float o = coordinate(origin, axis);
+            const float inv = coordinate(inverse, axis);
+            const float t1 = (coordinate(min, axis) - o) * inv;
+            const float t2 = (coordinate(max, axis) - o) * inv;
+            t_near = std::max(t_near, std::min(t1, t2));
+            t_far = std::min(t_far, std::max(t1, t2));
+        }
+        return t_near <= t_far ? t_near : inf;
+    }
+};
+#endif
+
+// Frustum planes as columns, padded to two groups of four with planes
+// that contain everything.
+struct PlaneColumns {
+    alignas(16) float x[8];
+    alignas(16) float y[8];
+    alignas(16) float z[8];
+    alignas(16) float offset[8];
+
+    explicit PlaneColumns(const Frustum &frustum) {
+        for (std::size_t i = 0; i < 8; ++i) {
+            const Plane p = i < frustum.planes.size()
+                                ? frustum.planes[i]
+                                : Plane{{0.0F, 0.0F, 0.0F}, 1.0F};
+            x[i] = p.normal.x;
+            y[i] = p.normal.y;
+            z[i] = p.normal.z;
+            offset[i] = p.offset;
+        }
+    }
+};
+
+enum class Coverage { outside, partial, inside };
+
+// Classifies a box against all planes: the corner furthest along each
+// normal decides "outside", the nearest one decides "inside".
+Coverage classify(const PlaneColumns &planes, const VecXYZ &min,
+                  const VecXYZ &max) {
+#ifdef VECXYZ_HAS_SSE
+    const __m128 lx = _mm_set1_ps(min.x);
+    const __m128 ly = _mm_set1_ps(min.y);
+    const __m128 lz = _mm_set1_ps(min.z);
+    const __m128 hx = _mm_set1_ps(max.x);
+    const __m128 hy = _mm_set1_ps(max.y);
+    const __m128 hz = _mm_set1_ps(max.z);
+    const __m128 zero = _mm_setzero_ps();
+    bool inside = true;
+    for (std::size_t g = 0; g < 8; g += 4) {
+        const __m128 nx = _mm_load_ps(planes.x + g);
+        const __m128 ny = _mm_load_ps(planes.y + g);
+        const __m128 nz = _mm_load_ps(planes.z + g);
+        const __m128 d = _mm_load_ps(planes.offset + g);
+        const __m128 ax = _mm_mul_ps(nx, lx);
+        const __m128 bx = _mm_mul_ps(nx, hx);
+        const __m128 ay = _mm_mul_ps(ny, ly);
+        const __m128 by = _mm_mul_ps(ny, hy);
+        const __m128 az = _mm_mul_ps(nz, lz);
+        const __m128 bz = _mm_mul_ps(nz, hz);
+        const __m128 far = _mm_add_ps(
+            _mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)),
+            _mm_add_ps(_mm_max_ps(az, bz), d));
+        if (_mm_movemask_ps(_mm_cmplt_ps(far, zero)) != 0) {
+            return Coverage::outside;
+        }
+        const __m128 near = _mm_add_ps(
+            _mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)),
+            _mm_add_ps(_mm_min_ps(az, bz), d));
+        inside = inside && _mm_movemask_ps(_mm_cmplt_ps(near, zero)) == 0;
+    }
+    return inside ? Coverage::inside : Coverage::partial;
+#else
+    bool inside = true;
+    for (std::size_t i = 0; i < 8; ++i) {
+        const float ax = planes.x[i] * min.x;
+        const float bx = planes.x[i] * max.x;
+        const float ay = planes.y[i] * min.y;
+        const float by = planes.y[i] * max.y;
+        const float az = planes.z[i] * min.z;
+        const float bz = planes.z[i] * max.z;
+        const float far = std::max(ax, bx) + std::max(ay, by) +
+                          (std::max(az, bz) + planes.offset[i]);
+        if (far < 0) {
+            return Coverage::outside;
+        }
+        const float near = std::min(ax, bx) + std::min(ay, by) +
+                           (std::min(az, bz) + planes.offset[i]);
+        inside = inside && near >= 0;
+    }
+    return inside ? Coverage::inside : Coverage::partial;
+#endif
+}
+} // namespace
+
+Frustum Frustum::from_view_projection(const Mat4 &m) {
+    // Gribb and Hartmann: each plane is the last row plus or minus another.
+    const auto plane = [&](int row, float sign) {
+        return Plane{{m.m[3][0] + sign * m.m[row][0],
+                      m.m[3][1] + sign * m.m[row][1],
+                      m.m[3][2] + sign * m.m[row][2]},
+                     m.m[3][3] + sign * m.m[row][3]};
+    };
+    return {{plane(0, 1), plane(0, -1), plane(1, 1), plane(1, -1),
+             plane(2, 1), plane(2, -1)}};
+}
+
+class Bvh::Builder {
+  public:
+    Builder(Bvh &bvh, const Aabb *boxes, std::size_t count)
+        : bvh_(bvh), boxes_(boxes), centroids_(count) {
+        if (count > (std::size_t{1} << 31U)) {
+            throw std::length_error("Bvh supports at most 2^31 primitives");
+        }
+        bvh.indices_.resize(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            bvh.indices_[i] = static_cast<std::uint32_t>(i);
+            const Aabb &b = boxes[i];
+            centroids_[i] = {0.5F * (b.min.x + b.max.x),
+                             0.5F * (b.min.y + b.max.y),
+                             0.5F * (b.min.z + b.max.z)};
+        }
+    }
+
+    void run() {
+        const auto count = static_cast<std::uint32_t>(centroids_.size());
+        if (count == 0) {
+            return;
+        }
+        // A binary tree with count leaves at most has 2 count - 1 nodes.
+        bvh_.nodes_.resize(2 * std::size_t{count} - 1);
+        next_node_ = 1;
+        const Range all = measure(0, count);
+        build(0, all, 0);
+        bvh_.nodes_.resize(next_node_);
+
+        // Leaves test boxes in tree order, so store them that way.
+        bvh_.boxes_.resize(count);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            bvh_.boxes_[i] = boxes_[bvh_.indices_[i]];
+        }
+    }
+
+  private:
+    struct Range {
+        std::uint32_t begin;
+        std::uint32_t end;
+        Aabb bounds;
+        Aabb centroids;
+    };
+
+    struct Bin {
+        Aabb bounds;
+        Aabb centroids;
+        std::uint32_t count{};
+
+        void merge(const Bin &other) {
+            bounds.merge(other.bounds);
+            centroids.merge(other.centroids);
+            count += other.count;
+        }
+    };
+
+    using Bins = std::array<std::array<Bin, bin_count>, 3>;
+
+    Range measure(std::uint32_t begin, std::uint32_t end) const {
+        Range r{begin, end, {}, {}};
+        for (std::uint32_t i = begin; i < end; ++i) {
+            const std::uint32_t p = bvh_.indices_[i];
+            grow(r.bounds, boxes_[p].min, boxes_[p].max);
+            grow(r.centroids, centroids_[p], centroids_[p]);
+        }
+        return r;
+    }
+
+    // Maps centroids to bins along each axis the centroids spread over.
+    struct Binning {
+        float lo[3];
+        float scale[3];
+        bool active[3];
+
+        explicit Binning(const Aabb &cb) {
+            for (unsigned axis = 0; axis < 3; ++axis) {
+                lo[axis] = coordinate(cb.min, axis);
+                const float extent = coordinate(cb.max, axis) - lo[axis];
+                active[axis] = extent > 0;
+                scale[axis] = active[axis] ? bin_count / extent : 0.0F;
+            }
+        }
+
+        unsigned operator()(const VecXYZ &c, unsigned axis) const {
+            const auto k = static_cast<long>((coordinate(c, axis) - lo[axis]) *
+                                             scale[axis]);
+            return static_cast<unsigned>(
+                std::clamp(k, 0L, static_cast<long>(bin_count) - 1));
+        }
+    };
+
+    void fill_bins(const Binning &binning, std::uint32_t begin,
+                   std::uint32_t end, Bins &bins) const {
+        for (std::uint32_t i = begin; i < end; ++i) {
+            const std::uint32_t p = bvh_.indices_[i];
+            const VecXYZ &c = centroids_[p];
+            for (unsigned axis = 0; axis < 3; ++axis) {
+                if (binning.active[axis]) {
+                    Bin &bin = bins[axis][binning(c, axis)];
+                    grow(bin.bounds, boxes_[p].min, boxes_[p].max);
+                    grow(bin.centroids, c, c);
+                    ++bin.count;
+                }
+            }
+        }
+    }
+
+    Bins bin(const Range &r, const Binning &binning) const {
+        const std::size_t n = r.end - r.begin;
+        Bins bins{};
+        if (n < parallel_bin_points) {
+            fill_bins(binning, r.begin, r.end, bins);
+            return bins;
+        }
+        // Fixed blocks merged in order, so the tree does not depend on the
+        // number of threads.
+        const std::size_t blocks = n / (parallel_bin_points / 4);
+        std::vector<Bins> partial(blocks);
+        parallel_for(blocks, 1, [&](std::size_t b, std::size_t e) {
+            for (std::size_t i = b; i < e; ++i) {
+                fill_bins(binning,
+                          static_cast<std::uint32_t>(r.begin + i * n / blocks),
+                          static_cast<std::uint32_t>(r.begin +
+                                                     (i + 1) * n / blocks),
+                          partial[i]);
+            }
+        });
+        for (const Bins &p : partial) {
+            for (unsigned axis = 0; axis < 3; ++axis) {
+                for (unsigned k = 0; k < bin_count; ++k) {
+                    bins[axis][k].merge(p[axis][k]);
+                }
+            }
+        }
+        return bins;
+    }
+
+    void make_leaf(std::uint32_t node, const Range &r) {
+        bvh_.nodes_[node] = {r.bounds.min, r.begin, r.bounds.max,
+                             r.end - r.begin};
+    }
+
+    void build(std::uint32_t node, const Range &r, unsigned depth) {
+        const std::uint32_t n = r.end - r.begin;
+        if (n <= 2) {
+            make_leaf(node, r);
+            return;
+        }
+
+        Range left{};
+        Range right{};
+        if (depth < sah_depth && !sah_split(r, left, right)) {
+            make_leaf(node, r);
+            return;
+        }
+        if (depth >= sah_depth || left.begin == left.end ||
+            right.begin == right.end) {
+            median_split(r, left, right);
+        }
+
+        const std::uint32_t children = next_node_.fetch_add(2);
+        bvh_.nodes_[node] = {r.bounds.min, children, r.bounds.max, 0};
+        if (n >= parallel_subtree_points) {
+            parallel_invoke([&] { build(children, left, depth + 1); },
+                            [&] { build(children + 1, right, depth + 1); });
+        } else {
+            build(children, left, depth + 1);
+            build(children + 1, right, depth + 1);
+        }
+    }
+
+    // Finds and applies the cheapest binned split. Returns false when a
+    // leaf is cheaper; leaves `left` empty when all centroids coincide.
+    bool sah_split(const Range &r, Range &left, Range &right) {
+        const std::uint32_t n = r.end - r.begin;
+        const Binning binning(r.centroids);
+        const Bins bins = bin(r, binning);
+        const float parent_area = half_area(r.bounds);
+
+        float best_cost = inf;
+        unsigned best_axis = 0;
+        unsigned best_split = 0;
+        for (unsigned axis = 0; axis < 3; ++axis) {
+            if (!binning.active[axis]) {
+                continue;
+            }
+            // Sweep from the right, then from the left with the costs.
+            std::array<float, bin_count> right_cost{};
+            Aabb acc;
+            std::uint32_t count = 0;
+            for (unsigned k = bin_count - 1; k > 0; --k) {
+                acc.merge(bins[axis][k].bounds);
+                count += bins[axis][k].count;
+                right_cost[k] = half_area(acc) * static_cast<float>(count);
+            }
+            acc = {};
+            count = 0;
+            for (unsigned k = 1; k < bin_count; ++k) {
+                acc.merge(bins[axis][k - 1].bounds);
+                count += bins[axis][k - 1].count;
+                const float cost =
+                    half_area(acc) * static_cast<float>(count) +
+                    right_cost[k];
+                if (count != 0 && count != n && cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = k;
+                }
+            }
+        }
+
+        if (best_cost == inf) {
+            // Coincident centroids: no plane separates them.
+            if (n <= max_leaf_primitives) {
+                return false;
+            }
+            left = right = Range{r.begin, r.begin, {}, {}};
+            return true;
+        }
+        // Relative to one box test per primitive in a leaf, plus one node
+        // traversal.
+        const float split_cost =
+            parent_area > 0 ? 1.0F + best_cost / parent_area : inf;
+        if (n <= max_leaf_primitives &&
+            static_cast<float>(n) <= split_cost) {
+            return false;
+        }
+
+        const auto first = bvh_.indices_.begin();
+        const auto mid = std::partition(
+            first + r.begin, first + r.end, [&](std::uint32_t p) {
+                return binning(centroids_[p], best_axis) < best_split;
+            });
+        const auto m = static_cast<std::uint32_t>(mid - first);
+        left = {r.begin, m, {}, {}};
+        right = {m, r.end, {}, {}};
+        for (unsigned k = 0; k < bin_count; ++k) {
+            Range &side = k < best_split ? left : right;
+            side.bounds.merge(bins[best_axis][k].bounds);
+            side.centroids.merge(bins[best_axis][k].centroids);
+        }
+        return true;
+    }
+
+    void median_split(const Range &r, Range &left, Range &right) {
+        const Aabb &cb = r.centroids;
+        const float ex = cb.max.x - cb.min.x;
+        const float ey = cb.max.y - cb.min.y;
+        const float ez = cb.max.z - cb.min.z;
+        const unsigned axis = ex >= ey && ex >= ez ? 0 : ey >= ez ? 1 : 2;
+        const std::uint32_t mid = r.begin + (r.end - r.begin) / 2;
+        const auto first = bvh_.indices_.begin();
+        std::nth_element(first + r.begin, first + mid, first + r.end,
+                         [&](std::uint32_t a, std::uint32_t b) {
+                             return coordinate(centroids_[a], axis) <
+                                    coordinate(centroids_[b], axis);
+                         });
+        left = measure(r.begin, mid);
+        right = measure(mid, r.end);
+    }
+
+    Bvh &bvh_;
+    const Aabb *boxes_;
+    std::vector<VecXYZ> centroids_;
+    std::atomic<std::uint32_t> next_node_{0};
+};
+
+Bvh::Bvh(const Aabb *boxes, std::size_t count) {
+    Builder(*this, boxes, count).run();
+}
+
+Bvh::Bvh(const VecXYZ *points, std::size_t count, float radius) {
+    std::vector<Aabb> boxes(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const VecXYZ &p = points[i];
+        boxes[i].min = {p.x - radius, p.y - radius, p.z - radius};
+        boxes[i].max = {p.x + radius, p.y + radius, p.z + radius};
+    }
+    Builder(*this, boxes.data(), count).run();
+}
+
+RayHit Bvh::intersect(const Ray &ray) const {
+    RayHit hit;
+    if (nodes_.empty()) {
+        return hit;
+    }
+    const RaySlabs slabs(ray);
+    float t_max = ray.t_max;
+    if (slabs.enter(nodes_[0].min, nodes_[0].max, ray.t_min, t_max) == inf) {
+        return hit;
+    }
+
+    std::uint32_t stack[stack_size];
+    std::size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth != 0) {
+        const Node &node = nodes_[stack[--depth]];
+        if (node.leaf()) {
+            for (std::uint32_t i = node.first; i < node.first + node.count;
+                 ++i) {
+                const float t =
+                    slabs.enter(boxes_[i].min, boxes_[i].max, ray.t_min,
+                                t_max);
+                // Equal entries go to the lower index, as in packets.
+                if (t == inf) {
+                    continue;
+                }
+                if (t < hit.t ||
+                    (t == hit.t && indices_[i] < hit.primitive)) {
+                    hit = {indices_[i], t};
+                    t_max = t;
+                }
+            }
+            continue;
+        }
+        const Node &a = nodes_[node.first];
+        const Node &b = nodes_[node.first + 1];
+        const float ta = slabs.enter(a.min, a.max, ray.t_min, t_max);
+        const float tb = slabs.enter(b.min, b.max, ray.t_min, t_max);
+        // Push the nearer child last so it is visited first.
+        if (ta <= tb) {
+            if (tb != inf) {
+                stack[depth++] = node.first + 1;
+            }
+            if (ta != inf) {
+                stack[depth++] = node.first;
+            }
+        } else {
+            if (ta != inf) {
+                stack[depth++] = node.first;
+            }
+            stack[depth++] = node.first + 1;
+        }
+    }
+    return hit;
+}
+
+void Bvh::intersect(const Ray *rays, std::size_t count, RayHit *hits) const {
+    parallel_for(count, packet_grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i += 4) {
+            intersect_packet(rays + i, std::min<std::size_t>(4, end - i),
+                             hits + i);
+        }
+    });
+}
+
+#ifdef VECXYZ_HAS_SSE
+void Bvh::intersect_packet(const Ray *rays, std::size_t count,
+                           RayHit *hits) const {
+    // Lanes past `count` get an empty interval and never hit anything.
+    alignas(16) float ox[4];
+    alignas(16) float oy[4];
+    alignas(16) float oz[4];
+    alignas(16) float ix[4];
+    alignas(16) float iy[4];
+    alignas(16) float iz[4];
+    alignas(16) float t_min[4];
+    alignas(16) float t_max[4];
+    for (std::size_t lane = 0; lane < 4; ++lane) {
+        const Ray r = lane < count ? rays[lane] : Ray{{}, {1, 1, 1}, 1, 0};
+        const VecXYZ inv = inverse_direction(r.direction);
+        ox[lane] = r.origin.x;
+        oy[lane] = r.origin.y;
+        oz[lane] = r.origin.z;
+        ix[lane] = inv.x;
+        iy[lane] = inv.y;
+        iz[lane] = inv.z;
+        t_min[lane] = r.t_min;
+        t_max[lane] = r.t_max;
+    }
+    const __m128 pox = _mm_load_ps(ox);
+    const __m128 poy = _mm_load_ps(oy);
+    const __m128 poz = _mm_load_ps(oz);
+    const __m128 pix = _mm_load_ps(ix);
+    const __m128 piy = _mm_load_ps(iy);
+    const __m128 piz = _mm_load_ps(iz);
+    const __m128 near_limit = _mm_load_ps(t_min);
+    __m128 far_limit = _mm_load_ps(t_max);
+    __m128 best_t = _mm_set1_ps(inf);
+    // no_hit as a signed lane; it only survives in lanes that miss.
+    __m128i best_index = _mm_set1_epi32(-1);
+
+    // Entry t per lane, and the lanes whose interval is not empty.
+    const auto enter = [&](const VecXYZ &min, const VecXYZ &max,
+                           __m128 &t_near) {
+        const __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min.x), pox), pix);
+        const __m128 x2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max.x), pox), pix);
+        const __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min.y), poy), piy);
+        const __m128 y2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max.y), poy), piy);
+        const __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min.z), poz), piz);
+        const __m128 z2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max.z), poz), piz);
+        t_near = _mm_max_ps(
+            _mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)),
+            _mm_max_ps(_mm_min_ps(z1, z2), near_limit));
+        const __m128 t_far = _mm_min_ps(
+            _mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)),
+            _mm_min_ps(_mm_max_ps(z1, z2), far_limit));
+        return _mm_cmple_ps(t_near, t_far);
+    };
+    // Smallest entry t among the hitting lanes, for ordering children.
+    const auto nearest = [](__m128 t_near, __m128 mask) {
+        __m128 t = _mm_or_ps(_mm_and_ps(mask, t_near),
+                             _mm_andnot_ps(mask, _mm_set1_ps(inf)));
+        t = _mm_min_ps(t, _mm_movehl_ps(t, t));
+        t = _mm_min_ss(t, _mm_shuffle_ps(t, t, 1));
+        return _mm_cvtss_f32(t);
+    };
+
+    std::uint32_t stack[stack_size];
+    std::size_t depth = 0;
+    __m128 t_near;
+    if (!nodes_.empty() &&
+        _mm_movemask_ps(enter(nodes_[0].min, nodes_[0].max, t_near)) != 0) {
+        stack[depth++] = 0;
+    }
+    while (depth != 0) {
+        const Node &node = nodes_[stack[--depth]];
+        if (node.leaf()) {
+            for (std::uint32_t i = node.first; i < node.first + node.count;
+                 ++i) {
+                __m128 hit = enter(boxes_[i].min, boxes_[i].max, t_near);
+                if (_mm_movemask_ps(hit) == 0) {
+                    continue;
+                }
+                const __m128i index =
+                    _mm_set1_epi32(static_cast<int>(indices_[i]));
+                const __m128 lower = _mm_castsi128_ps(
+                    _mm_cmplt_epi32(index, best_index));
+                hit = _mm_and_ps(
+                    hit, _mm_or_ps(_mm_cmplt_ps(t_near, best_t),
+                                   _mm_and_ps(_mm_cmpeq_ps(t_near, best_t),
+                                              lower)));
+                best_t = _mm_or_ps(_mm_and_ps(hit, t_near),
+                                   _mm_andnot_ps(hit, best_t));
+                best_index = _mm_or_si128(
+                    _mm_and_si128(_mm_castps_si128(hit), index),
+                    _mm_andnot_si128(_mm_castps_si128(hit), best_index));
+                far_limit = _mm_min_ps(far_limit, best_t);
+            }
+            continue;
+        }
+        __m128 ta;
+        __m128 tb;
+        const __m128 ha = enter(nodes_[node.first].min,
+                                nodes_[node.first].max, ta);
+        const __m128 hb = enter(nodes_[node.first + 1].min,
+                                nodes_[node.first + 1].max, tb);
+        const bool hit_a = _mm_movemask_ps(ha) != 0;
+        const bool hit_b = _mm_movemask_ps(hb) != 0;
+        const bool a_first = !hit_b || (hit_a && nearest(ta, ha) <=
+                                                     nearest(tb, hb));
+        if (a_first) {
+            if (hit_b) {
+                stack[depth++] = node.first + 1;
+            }
+            if (hit_a) {
+                stack[depth++] = node.first;
+            }
+        } else {
+            if (hit_a) {
+                stack[depth++] = node.first;
+            }
+            stack[depth++] = node.first + 1;
+        }
+    }
+
+    alignas(16) float t_out[4];
+    alignas(16) std::uint32_t index_out[4];
+    _mm_store_ps(t_out, best_t);
+    _mm_store_si128(reinterpret_cast<__m128i *>(index_out), best_index);
+    for (std::size_t lane = 0; lane < count; ++lane) {
+        hits[lane] = {index_out[lane], t_out[lane]};
+    }
+}
+#else
+void Bvh::intersect_packet(const Ray *rays, std::size_t count,
+                           RayHit *hits) const {
+    for (std::size_t i = 0; i < count; ++i) {
+        hits[i] = intersect(rays[i]);
+    }
+}
+#endif
+
+void Bvh::append_subtree(std::uint32_t node,
+                         std::vector<std::uint32_t> &out) const {
+    // A subtree's primitives are one contiguous run, from its leftmost
+    // leaf to its rightmost one.
+    std::uint32_t lo = node;
+    while (!nodes_[lo].leaf()) {
+        lo = nodes_[lo].first;
+    }
+    std::uint32_t hi = node;
+    while (!nodes_[hi].leaf()) {
+        hi = nodes_[hi].first + 1;
+    }
+    out.insert(out.end(), indices_.begin() + nodes_[lo].first,
+               indices_.begin() + nodes_[hi].first + nodes_[hi].count);
+}
+
+void Bvh::query(const Aabb &box, std::vector<std::uint32_t> &out) const {
+    if (nodes_.empty()) {
+        return;
+    }
+    std::uint32_t stack[stack_size];
+    std::size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth != 0) {
+        const std::uint32_t index = stack[--depth];
+        const Node &node = nodes_[index];
+        if (!overlaps(box, {node.min, node.max})) {
+            continue;
+        }
+        if (contains(box, node.min, node.max)) {
+            append_subtree(index, out);
+        } else if (node.leaf()) {
+            for (std::uint32_t i = node.first; i < node.first + node.count;
+                 ++i) {
+                if (overlaps(box, boxes_[i])) {
+                    out.push_back(indices_[i]);
+                }
+            }
+        } else {
+            stack[depth++] = node.first + 1;
+            stack[depth++] = node.first;
+        }
+    }
+}
+
+void Bvh::query(const Frustum &frustum,
+                std::vector<std::uint32_t> &out) const {
+    if (nodes_.empty()) {
+        return;
+    }
+    const PlaneColumns planes(frustum);
+    std::uint32_t stack[stack_size];
+    std::size_t depth = 0;
+    stack[depth++] = 0;
+    while (depth != 0) {
+        const std::uint32_t index = stack[--depth];
+        const Node &node = nodes_[index];
+        const Coverage c = classify(planes, node.min, node.max);
+        if (c == Coverage::outside) {
+            continue;
+        }
+        if (c == Coverage::inside) {
+            append_subtree(index, out);
+        } else if (node.leaf()) {
+            for (std::uint32_t i = node.first; i < node.first + node.count;
+                 ++i) {
+                if (classify(planes, boxes_[i].min, boxes_[i].max) !=
+                    Coverage::outside) {
+                    out.push_back(indices_[i]);
+                }
+            }
+        } else {
+            stack[depth++] = node.first + 1;
+            stack[depth++] = node.first;
+        }
+    }
+}
+
+} // namespace vecxyz
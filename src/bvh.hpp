@@ -0,0 +1,102 @@
+#pragma once
+
+#include "point_stats.hpp"
+#include "transform.hpp"
+#include "vecxyz.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace vecxyz {
+
+constexpr std::uint32_t no_hit = std::numeric_limits<std::uint32_t>::max();
+
+struct Ray {
+    VecXYZ origin;
+    VecXYZ direction;
+    float t_min{0.0F};
+    float t_max{std::numeric_limits<float>::infinity()};
+};
+
+// Nearest primitive box along a ray, entered at origin + t * direction.
+struct RayHit {
+    std::uint32_t primitive{no_hit};
+    float t{std::numeric_limits<float>::infinity()};
+};
+
+// Points with dot(normal, p) + offset >= 0 are inside.
+struct Plane {
+    VecXYZ normal;
+    float offset;
+};
+
+struct Frustum {
+    // Left, right, bottom, top, near, far.
+    std::array<Plane, 6> planes;
+
+    // Planes of a view-projection matrix mapping the visible volume to
+    // -w <= x, y, z <= w (OpenGL clip space).
+    static Frustum from_view_projection(const Mat4 &m);
+};
+
+// Bounding volume hierarchy over boxes (or points, as boxes of a given
+// radius). Built top down with binned SAH splits; large nodes are binned
+// in parallel and large subtrees are built in parallel. Nodes live in one
+// array, with the two children of an inner node stored next to each other.
+class Bvh {
+  public:
+    struct Node {
+        VecXYZ min;
+        // Inner node: left child, with the right one at first + 1. Leaf:
+        // first entry in primitive_indices().
+        std::uint32_t first;
+        VecXYZ max;
+        // Primitives in a leaf; 0 for inner nodes.
+        std::uint32_t count;
+
+        bool leaf() const { return count != 0; }
+    };
+    static_assert(sizeof(Node) == 32, "Bvh::Node must stay 32 bytes");
+
+    static constexpr std::size_t max_leaf_primitives = 8;
+
+    Bvh() = default;
+    // Throws std::length_error above 2^31 primitives.
+    Bvh(const Aabb *boxes, std::size_t count);
+    Bvh(const VecXYZ *points, std::size_t count, float radius);
+
+    std::size_t size() const { return indices_.size(); }
+    const std::vector<Node> &nodes() const { return nodes_; }
+    const std::vector<std::uint32_t> &primitive_indices() const {
+        return indices_;
+    }
+
+    // Nearest hit with t in [ray.t_min, ray.t_max], if any.
+    RayHit intersect(const Ray &ray) const;
+    // Traces packets of four rays through the tree together, one SSE lane
+    // per ray, spreading packets across the worker threads.
+    void intersect(const Ray *rays, std::size_t count, RayHit *hits) const;
+
+    // Appends the primitives whose boxes overlap `box`.
+    void query(const Aabb &box, std::vector<std::uint32_t> &out) const;
+    // Appends the primitives whose boxes are not fully outside one of the
+    // planes. Like any plane test this is conservative: boxes just past a
+    // frustum corner may be included.
+    void query(const Frustum &frustum, std::vector<std::uint32_t> &out) const;
+
+  private:
+    class Builder;
+
+    void intersect_packet(const Ray *rays, std::size_t count,
+                          RayHit *hits) const;
+    void append_subtree(std::uint32_t node,
+                        std::vector<std::uint32_t> &out) const;
+
+    std::vector<Node> nodes_;
+    std::vector<std::uint32_t> indices_;
+    std::vector<Aabb> boxes_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace vecxyz {
+
+// Chase-Lev work-stealing deque, with the memory orders of Le, Pop, Cohen
+// and Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (PPoPP 2013). The owning thread pushes and pops at the bottom
+// without atomic read-modify-writes except when taking the last item;
+// other threads steal the oldest item from the top with a CAS.
+//
+// The ring doubles when full. Retired rings stay allocated until the deque
+// is destroyed, since a thief may still be reading one.
+template <class T> class ChaseLevDeque {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "items are read speculatively by thieves");
+
+  public:
+    explicit ChaseLevDeque(std::size_t capacity = 256) {
+        std::size_t n = 2;
+        while (n < capacity) {
+            n *= 2;
+        }
+        rings_.push_back(std::make_unique<Ring>(n));
+        ring_.store(rings_.back().get(), std::memory_order_relaxed);
+    }
+    ChaseLevDeque(const ChaseLevDeque &) = delete;
+    ChaseLevDeque &operator=(const ChaseLevDeque &) = delete;
+
+    // Owner only.
+    void push(T item) {
+        const std::int64_t b = bottom_.load(std::memory_order_relaxed);
+        const std::int64_t t = top_.load(std::memory_order_acquire);
+        Ring *ring = ring_.load(std::memory_order_relaxed);
+        if (b - t > static_cast<std::int64_t>(ring->mask)) {
+            ring = grow(ring, t, b);
+        }
+        ring->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only: the newest item, if any.
+    bool pop(T &item) {
+        const std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Ring *ring = ring_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = ring->get(b);
+        if (t == b) {
+            // Last item: race the thieves for it.
+            const bool won = top_.compare_exchange_strong(
+                t, t + 1, std::memory_order_seq_cst,
+                std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread: the oldest item. Fails when empty or when another thread
+    // took the item first.
+    bool steal(T &item) {
+        std::int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        const T candidate = ring_.load(std::memory_order_acquire)->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1,
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return false;
+        }
+        item = candidate;
+        return true;
+    }
+
+    // A snapshot that may already be stale.
+    bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <=
+               top_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Ring {
+        explicit Ring(std::size_t capacity)
+            : mask(capacity - 1),
+              slots(new std::atomic<T>[capacity]) {}
+
+        T get(std::int64_t i) const {
+            return slots[static_cast<std::size_t>(i) & mask].load(
+                std::memory_order_relaxed);
+        }
+        void put(std::int64_t i, T item) {
+            slots[static_cast<std::size_t>(i) & mask].store(
+                item, std::memory_order_relaxed);
+        }
+
+        std::size_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+    };
+
+    Ring *grow(Ring *ring, std::int64_t t, std::int64_t b) {
+        rings_.push_back(std::make_unique<Ring>(2 * (ring->mask + 1)));
+        Ring *bigger = rings_.back().get();
+        for (std::int64_t i = t; i < b; ++i) {
+            bigger->put(i, ring->get(i));
+        }
+        ring_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<std::int64_t> top_{0};
+    alignas(64) std::atomic<std::int64_t> bottom_{0};
+    std::atomic<Ring *> ring_{nullptr};
+    std::vector<std::unique_ptr<Ring>> rings_; // owner only
+};
+
+} // namespace vecxyz
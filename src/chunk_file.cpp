@@ -0,0 +1,325 @@
+#include "chunk_file.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fmt/core.h>
+
+namespace vecxyz {
+namespace {
+std::uint32_t header_checksum(const ChunkFileHeader &header) {
+    return crc32c(0, &header, offsetof(ChunkFileHeader, header_crc));
+}
+
+std::uint32_t table_checksum(const std::vector<ChunkEntry> &table) {
+    return crc32c(0, table.data(), table.size() * sizeof(ChunkEntry));
+}
+
+void read_exact(std::istream &in, void *data, std::size_t size,
+                std::uint64_t offset, const std::string &path) {
+    in.clear();
+    in.seekg(static_cast<std::streamoff>(offset));
+    in.read(static_cast<char *>(data), static_cast<std::streamsize>(size));
+    if (!in) {
+        throw ChunkFileError(fmt::format("{}: short read of {} bytes at {}",
+                                         path, size, offset));
+    }
+}
+
+// Reads and validates everything except the chunk payloads.
+void read_index(std::istream &in, const std::string &path,
+                ChunkFileHeader &header, std::vector<ChunkEntry> &table) {
+    read_exact(in, &header, sizeof(header), 0, path);
+    check_chunk_header(header, path);
+    in.clear();
+    in.seekg(0, std::ios::end);
+    check_chunk_extent(header, static_cast<std::uint64_t>(in.tellg()), path);
+    table.resize(header.chunk_count);
+    read_exact(in, table.data(), table.size() * sizeof(ChunkEntry),
+               header.table_offset, path);
+    check_chunk_table(header, table, path);
+}
+} // namespace
+
+std::vector<ChunkEntry> plan_chunks(std::uint64_t point_count,
+                                    std::uint32_t chunk_points) {
+    if (chunk_points == 0) {
+        throw ChunkFileError("chunk_points must be positive");
+    }
+    std::vector<ChunkEntry> table(
+        static_cast<std::size_t>((point_count + chunk_points - 1) /
+                                 chunk_points));
+    std::uint64_t offset = sizeof(ChunkFileHeader);
+    for (auto &entry : table) {
+        entry.offset = offset;
+        entry.point_count = static_cast<std::uint32_t>(
+            std::min<std::uint64_t>(point_count, chunk_points));
+        entry.crc = 0;
+        point_count -= entry.point_count;
+        offset += std::uint64_t{entry.point_count} * sizeof(VecXYZ);
+    }
+    return table;
+}
+
+ChunkFileHeader make_chunk_header(std::uint32_t chunk_points,
+                                  std::uint64_t point_count,
+                                  const std::vector<ChunkEntry> &table,
+                                  std::uint64_t table_offset) {
+    ChunkFileHeader header{};
+    std::memcpy(header.magic, chunk_file_magic, sizeof(header.magic));
+    header.version = chunk_file_version;
+    header.chunk_points = chunk_points;
+    header.point_count = point_count;
+    header.chunk_count = table.size();
+    header.table_offset = table_offset;
+    header.table_crc = table_checksum(table);
+    header.header_crc = header_checksum(header);
+    return header;
+}
+
+void check_chunk_header(const ChunkFileHeader &header,
+                        const std::string &path) {
+    if (std::memcmp(header.magic, chunk_file_magic, sizeof(header.magic)) !=
+        0) {
+        throw ChunkFileError(fmt::format("{}: not a chunk file", path));
+    }
+    if (header.header_crc != header_checksum(header)) {
+        throw ChunkFileError(fmt::format("{}: header checksum mismatch", path));
+    }
+    if (header.version != chunk_file_version) {
+        throw ChunkFileError(fmt::format("{}: unsupported version {}", path,
+                                         header.version));
+    }
+}
+
+void check_chunk_table(const ChunkFileHeader &header,
+                       const std::vector<ChunkEntry> &table,
+                       const std::string &path) {
+    if (header.table_crc != table_checksum(table)) {
+        throw ChunkFileError(fmt::format("{}: chunk table checksum mismatch",
+                                         path));
+    }
+
+    std::uint64_t total = 0;
+    for (const auto &entry : table) {
+        // Chunks end before the table; compared without overflowing.
+        if (entry.point_count > header.chunk_points ||
+            entry.offset > header.table_offset ||
+            std::uint64_t{entry.point_count} * sizeof(VecXYZ) >
+                header.table_offset - entry.offset) {
+            throw ChunkFileError(fmt::format("{}: corrupt chunk table", path));
+        }
+        total += entry.point_count;
+    }
+    if (total != header.point_count) {
+        throw ChunkFileError(
+            fmt::format("{}: chunk table covers {} of {} points", path, total,
+                        header.point_count));
+    }
+}
+
+void check_chunk_extent(const ChunkFileHeader &header,
+                        std::uint64_t file_size, const std::string &path) {
+    if (header.table_offset < sizeof(ChunkFileHeader) ||
+        header.table_offset > file_size ||
+        header.chunk_count >
+            (file_size - header.table_offset) / sizeof(ChunkEntry)) {
+        throw ChunkFileError(fmt::format(
+            "{}: table of {} chunks at {} does not fit in {} bytes", path,
+            header.chunk_count, header.table_offset, file_size));
+    }
+}
+
+ChunkFileWriter::ChunkFileWriter(const std::string &path,
+                                 std::uint32_t chunk_points)
+    : out_(path, std::ios::binary | std::ios::trunc),
+      chunk_points_(chunk_points), offset_(sizeof(ChunkFileHeader)) {
+    if (chunk_points_ == 0) {
+        throw ChunkFileError("chunk_points must be positive");
+    }
+    if (!out_) {
+        throw ChunkFileError(fmt::format("{}: cannot open for writing", path));
+    }
+    const ChunkFileHeader placeholder{};
+    out_.write(reinterpret_cast<const char *>(&placeholder),
+               sizeof(placeholder));
+    pending_.reserve(chunk_points_);
+}
+
+ChunkFileWriter::~ChunkFileWriter() {
+    if (!finished_) {
+        try {
+            finish();
+        } catch (...) {
+        }
+    }
+}
+
+void ChunkFileWriter::append(const VecXYZ *points, std::size_t count) {
+    while (count > 0) {
+        const std::size_t take =
+            std::min<std::size_t>(count, chunk_points_ - pending_.size());
+        pending_.insert(pending_.end(), points, points + take);
+        points += take;
+        count -= take;
+        point_count_ += take;
+        if (pending_.size() == chunk_points_) {
+            flush_chunk();
+        }
+    }
+}
+
+void ChunkFileWriter::flush_chunk() {
+    if (pending_.empty()) {
+        return;
+    }
+    const std::size_t bytes = pending_.size() * sizeof(VecXYZ);
+    table_.push_back({offset_, static_cast<std::uint32_t>(pending_.size()),
+                      crc32c(0, pending_.data(), bytes)});
+    out_.write(reinterpret_cast<const char *>(pending_.data()),
+               static_cast<std::streamsize>(bytes));
+    offset_ += bytes;
+    pending_.clear();
+}
+
+void ChunkFileWriter::finish() {
+    if (finished_) {
+        return;
+    }
+    finished_ = true;
+    flush_chunk();
+
+    const ChunkFileHeader header =
+        make_chunk_header(chunk_points_, point_count_, table_, offset_);
+    out_.write(reinterpret_cast<const char *>(table_.data()),
+               static_cast<std::streamsize>(table_.size() *
+                                            sizeof(ChunkEntry)));
+    out_.seekp(0);
+    out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out_.close();
+    if (!out_) {
+        throw ChunkFileError("chunk file write failed");
+    }
+}
+
+void save_chunk_file(const std::string &path, const std::vector<VecXYZ> &points,
+                     std::uint32_t chunk_points) {
+    ChunkFileWriter writer(path, chunk_points);
+    writer.append(points);
+    writer.finish();
+}
+
+ChunkFileReader::ChunkFileReader(const std::string &path)
+    : in_(path, std::ios::binary), path_(path) {
+    if (!in_) {
+        throw ChunkFileError(fmt::format("{}: cannot open", path));
+    }
+    read_index(in_, path_, header_, table_);
+    cache_.resize(table_.size());
+    loaded_.resize(table_.size());
+}
+
+void ChunkFileReader::load_chunk(std::size_t index,
+                                 std::vector<VecXYZ> &out) {
+    const ChunkEntry &entry = table_.at(index);
+    out.resize(entry.point_count);
+    const std::size_t bytes = out.size() * sizeof(VecXYZ);
+    read_exact(in_, out.data(), bytes, entry.offset, path_);
+    if (crc32c(0, out.data(), bytes) != entry.crc) {
+        throw ChunkFileError(
+            fmt::format("{}: chunk {} checksum mismatch", path_, index));
+    }
+}
+
+const std::vector<VecXYZ> &ChunkFileReader::chunk(std::size_t index) {
+    if (!loaded_.at(index)) {
+        load_chunk(index, cache_[index]);
+        loaded_[index] = true;
+    }
+    return cache_[index];
+}
+
+void ChunkFileReader::release(std::size_t index) {
+    loaded_.at(index) = false;
+    std::vector<VecXYZ>().swap(cache_[index]);
+}
+
+std::vector<VecXYZ> ChunkFileReader::read_all() {
+    std::vector<VecXYZ> points;
+    points.reserve(header_.point_count);
+    std::vector<VecXYZ> buffer;
+    for (std::size_t i = 0; i < table_.size(); ++i) {
+        const std::vector<VecXYZ> *source = &cache_[i];
+        if (!loaded_[i]) {
+            load_chunk(i, buffer);
+            source = &buffer;
+        }
+        points.insert(points.end(), source->begin(), source->end());
+    }
+    return points;
+}
+
+std::vector<VecXYZ> ChunkFileReader::read_all(const ValidationOptions &options,
+                                              ValidationReport &report) {
+    // Each chunk is checked into a reused buffer while it is in cache and
+    // appended from there, so the output is written once and never
+    // zero-filled.
+    std::vector<VecXYZ> points;
+    points.reserve(header_.point_count);
+    std::vector<VecXYZ> buffer;
+    std::uint32_t largest = 0;
+    for (const ChunkEntry &entry : table_) {
+        largest = std::max(largest, entry.point_count);
+    }
+    std::vector<VecXYZ> checked(largest);
+    std::uint64_t index = 0;
+    for (std::size_t i = 0; i < table_.size(); ++i) {
+        const std::vector<VecXYZ> *source = &cache_[i];
+        if (!loaded_[i]) {
+            load_chunk(i, buffer);
+            source = &buffer;
+        }
+        const std::size_t kept =
+            decode_points_checked(source->data(), source->size(),
+                                  checked.data(), index, options, report);
+        points.insert(points.end(), checked.begin(),
+                      checked.begin() + static_cast<std::ptrdiff_t>(kept));
+        index += source->size();
+    }
+    return points;
+}
+
+ChunkFileReport verify_chunk_file(const std::string &path) {
+    ChunkFileReport report;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        report.error = fmt::format("{}: cannot open", path);
+        return report;
+    }
+
+    ChunkFileHeader header{};
+    std::vector<ChunkEntry> table;
+    try {
+        read_index(in, path, header, table);
+    } catch (const ChunkFileError &e) {
+        report.error = e.what();
+        return report;
+    }
+    report.index_ok = true;
+    report.point_count = header.point_count;
+    report.chunk_count = table.size();
+
+    std::vector<char> buffer;
+    for (std::size_t i = 0; i < table.size(); ++i) {
+        buffer.resize(std::size_t{table[i].point_count} * sizeof(VecXYZ));
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(table[i].offset));
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!in || crc32c(0, buffer.data(), buffer.size()) != table[i].crc) {
+            report.bad_chunks.push_back(i);
+        }
+    }
+    return report;
+}
+
+} // namespace vecxyz
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "point_validation.hpp"
+#include "vecxyz.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+// Chunked binary VecXYZ file:
+//
+//   [ChunkFileHeader][chunk 0 points][chunk 1 points]...[ChunkEntry table]
+//
+// Each chunk stores up to `chunk_points` packed points and carries its own
+// CRC32C in the table, so a reader only pays for the chunks it touches.
+// All integers and floats are little-endian.
+constexpr char chunk_file_magic[8] = {'V', 'X', 'Y', 'Z', 'C', 'H', 'K', '1'};
+constexpr std::uint32_t chunk_file_version = 1;
+constexpr std::uint32_t default_chunk_points = 64 * 1024;
+
+struct ChunkFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t chunk_points;
+    std::uint64_t point_count;
+    std::uint64_t chunk_count;
+    std::uint64_t table_offset;
+    std::uint32_t table_crc;
+    std::uint32_t flags;
+    std::uint8_t reserved[12];
+    std::uint32_t header_crc; // CRC32C of every byte before this field
+};
+static_assert(sizeof(ChunkFileHeader) == 64, "header layout is on disk");
+
+struct ChunkEntry {
+    std::uint64_t offset;
+    std::uint32_t point_count;
+    std::uint32_t crc;
+};
+static_assert(sizeof(ChunkEntry) == 16, "table layout is on disk");
+
+class ChunkFileError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Table for `point_count` points written back to back after the header.
+// The crc fields are left zero for the writer to fill in chunk by chunk.
+std::vector<ChunkEntry> plan_chunks(std::uint64_t point_count,
+                                    std::uint32_t chunk_points);
+
+// Header describing a complete table, with both checksums filled in.
+ChunkFileHeader make_chunk_header(std::uint32_t chunk_points,
+                                  std::uint64_t point_count,
+                                  const std::vector<ChunkEntry> &table,
+                                  std::uint64_t table_offset);
+
+// Throw ChunkFileError when a header or table read from `path` is corrupt.
+void check_chunk_header(const ChunkFileHeader &header,
+                        const std::string &path);
+void check_chunk_table(const ChunkFileHeader &header,
+                       const std::vector<ChunkEntry> &table,
+                       const std::string &path);
+// Throws ChunkFileError unless the table of a checked header fits in a
+// file of `file_size` bytes; call it before sizing the table.
+void check_chunk_extent(const ChunkFileHeader &header,
+                        std::uint64_t file_size, const std::string &path);
+
+// Streams points into a chunk file. The header is patched in finish(), so
+// the total point count does not have to be known up front.
+class ChunkFileWriter {
+  public:
+    explicit ChunkFileWriter(const std::string &path,
+                             std::uint32_t chunk_points = default_chunk_points);
+    ChunkFileWriter(const ChunkFileWriter &) = delete;
+    ChunkFileWriter &operator=(const ChunkFileWriter &) = delete;
+    ~ChunkFileWriter();
+
+    void append(const VecXYZ *points, std::size_t count);
+    void append(const std::vector<VecXYZ> &points) {
+        append(points.data(), points.size());
+    }
+
+    // Writes the pending chunk, the table and the final header.
+    void finish();
+
+  private:
+    void flush_chunk();
+
+    std::ofstream out_;
+    std::uint32_t chunk_points_;
+    std::uint64_t point_count_{};
+    std::uint64_t offset_;
+    std::vector<VecXYZ> pending_;
+    std::vector<ChunkEntry> table_;
+    bool finished_{false};
+};
+
+void save_chunk_file(const std::string &path, const std::vector<VecXYZ> &points,
+                     std::uint32_t chunk_points = default_chunk_points);
+
+// Opens a chunk file after checking only the header and the chunk table.
+// Chunk payloads are checked against their CRC32C the first time they are
+// loaded, so opening a large file costs the same as opening a small one.
+class ChunkFileReader {
+  public:
+    explicit ChunkFileReader(const std::string &path);
+
+    const ChunkFileHeader &header() const { return header_; }
+    std::uint64_t point_count() const { return header_.point_count; }
+    std::size_t chunk_count() const { return table_.size(); }
+    const std::vector<ChunkEntry> &table() const { return table_; }
+
+    // Loads and verifies chunk `index` on first use; later calls return the
+    // cached points. Throws ChunkFileError on a checksum mismatch.
+    const std::vector<VecXYZ> &chunk(std::size_t index);
+
+    // Drops the cached points of a chunk; the next access reloads and
+    // re-verifies it.
+    void release(std::size_t index);
+
+    std::vector<VecXYZ> read_all();
+
+    // read_all() for untrusted files: every component is checked for NaN
+    // and Inf while the chunk is copied out of the read buffer, and
+    // `options.policy` decides what happens to offending points.
+    std::vector<VecXYZ> read_all(const ValidationOptions &options,
+                                 ValidationReport &report);
+
+  private:
+    void load_chunk(std::size_t index, std::vector<VecXYZ> &out);
+
+    std::ifstream in_;
+    std::string path_;
+    ChunkFileHeader header_{};
+    std::vector<ChunkEntry> table_;
+    std::vector<std::vector<VecXYZ>> cache_;
+    std::vector<bool> loaded_;
+};
+
+struct ChunkFileReport {
+    bool index_ok{false}; // header and chunk table checksums match
+    std::uint64_t point_count{};
+    std::size_t chunk_count{};
+    std::vector<std::size_t> bad_chunks;
+    std::string error;
+
+    bool ok() const { return index_ok && bad_chunks.empty(); }
+};
+
+// Checks every checksum in the file without keeping the points around.
+ChunkFileReport verify_chunk_file(const std::string &path);
+
+} // namespace vecxyz
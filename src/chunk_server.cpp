@@ -0,0 +1,525 @@
+#include "chunk_server.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <array>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fmt/core.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace vecxyz {
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+namespace {
+class FileHandle {
+  public:
+    FileHandle() = default;
+    FileHandle(const FileHandle &) = delete;
+    FileHandle &operator=(const FileHandle &) = delete;
+    ~FileHandle() { reset(); }
+
+    int get() const { return fd_; }
+    void reset(int fd = -1) {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+  private:
+    int fd_{-1};
+};
+
+// Names stay inside the served directory: relative, with no empty, "." or
+// ".." components.
+bool safe_name(const std::string &name) {
+    if (name.empty() || name.front() == '/' ||
+        name.find('\0') != std::string::npos) {
+        return false;
+    }
+    std::size_t begin = 0;
+    while (begin <= name.size()) {
+        const std::size_t end = std::min(name.find('/', begin), name.size());
+        const std::string part = name.substr(begin, end - begin);
+        if (part.empty() || part == "." || part == "..") {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
+
+std::uint64_t chunk_bytes(const ChunkEntry &entry) {
+    return std::uint64_t{entry.point_count} * sizeof(VecXYZ);
+}
+
+void read_at(int fd, void *data, std::size_t size, std::uint64_t offset,
+             const std::string &name) {
+    auto *out = static_cast<char *>(data);
+    std::size_t done = 0;
+    while (done < size) {
+        const ssize_t got = ::pread(fd, out + done, size - done,
+                                    static_cast<off_t>(offset + done));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            throw ChunkFileError(fmt::format(
+                "{}: short read of {} bytes at {}", name, size, offset));
+        }
+        done += static_cast<std::size_t>(got);
+    }
+}
+
+// The checked chunk table of an open file. Reading it from the descriptor
+// the payload is sent from keeps the two consistent if the path is
+// replaced in between.
+std::vector<ChunkEntry> read_table(int fd, std::uint64_t file_size,
+                                   const std::string &name) {
+    ChunkFileHeader header;
+    read_at(fd, &header, sizeof(header), 0, name);
+    check_chunk_header(header, name);
+    check_chunk_extent(header, file_size, name);
+    std::vector<ChunkEntry> table(header.chunk_count);
+    read_at(fd, table.data(), table.size() * sizeof(ChunkEntry),
+            header.table_offset, name);
+    check_chunk_table(header, table, name);
+    return table;
+}
+} // namespace
+
+class ChunkFileServer::Session : public std::enable_shared_from_this<Session> {
+  public:
+    Session(tcp::socket socket, std::string root)
+        : socket_(std::move(socket)), root_(std::move(root)) {}
+
+    void start() {
+        boost::system::error_code ignored;
+        socket_.set_option(tcp::no_delay(true), ignored);
+        // sendfile() must not block the thread running this strand.
+        socket_.native_non_blocking(true, ignored);
+        read_size();
+    }
+
+  private:
+    struct Segment {
+        std::uint64_t offset;
+        std::uint64_t length;
+    };
+
+    void stop() {
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+
+    void read_size() {
+        asio::async_read(
+            socket_, asio::buffer(&size_, sizeof(size_)),
+            [self = shared_from_this()](boost::system::error_code ec,
+                                        std::size_t) {
+                if (ec || self->size_ < sizeof(ChunkRequest) ||
+                    self->size_ >
+                        sizeof(ChunkRequest) + max_chunk_request_name) {
+                    // Without a sane size there is no next request to
+                    // resynchronize on.
+                    self->stop();
+                    return;
+                }
+                self->read_body();
+            });
+    }
+
+    void read_body() {
+        request_.resize(size_);
+        asio::async_read(socket_, asio::buffer(request_),
+                         [self = shared_from_this()](
+                             boost::system::error_code ec, std::size_t) {
+                             if (ec) {
+                                 self->stop();
+                                 return;
+                             }
+                             self->handle();
+                         });
+    }
+
+    void handle() {
+        ChunkResponse response{};
+        std::vector<ChunkEntry> rows;
+        segments_.clear();
+        segment_ = 0;
+        try {
+            plan(response, rows);
+        } catch (const ChunkServeError &e) {
+            file_.reset();
+            segments_.clear();
+            const std::string message = e.what();
+            response = {};
+            response.status = e.status();
+            response.payload_bytes = message.size();
+            head_.resize(sizeof(response) + message.size());
+            std::memcpy(head_.data(), &response, sizeof(response));
+            std::memcpy(head_.data() + sizeof(response), message.data(),
+                        message.size());
+            write_head();
+            return;
+        }
+        head_.resize(sizeof(response) + rows.size() * sizeof(ChunkEntry));
+        std::memcpy(head_.data(), &response, sizeof(response));
+        if (!rows.empty()) {
+            std::memcpy(head_.data() + sizeof(response), rows.data(),
+                        rows.size() * sizeof(ChunkEntry));
+        }
+        write_head();
+    }
+
+    // Resolves the request into a response header, its table rows and the
+    // file segments that make up the payload. Throws ChunkServeError.
+    void plan(ChunkResponse &response, std::vector<ChunkEntry> &rows) {
+        ChunkRequest request;
+        std::memcpy(&request, request_.data(), sizeof(request));
+        if (request.name_bytes != request_.size() - sizeof(request)) {
+            throw ChunkServeError(ChunkServeStatus::bad_request,
+                                  "name length does not match the request");
+        }
+        const std::string name(request_.data() + sizeof(request),
+                               request.name_bytes);
+        if (!safe_name(name)) {
+            throw ChunkServeError(ChunkServeStatus::bad_request,
+                                  fmt::format("{}: invalid name", name));
+        }
+        const std::string path = root_ + "/" + name;
+        file_.reset(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat info {};
+        if (file_.get() < 0 || ::fstat(file_.get(), &info) != 0 ||
+            !S_ISREG(info.st_mode)) {
+            throw ChunkServeError(
+                ChunkServeStatus::not_found,
+                fmt::format("{}: {}", name,
+                            file_.get() < 0 ? std::strerror(errno)
+                                            : "not a regular file"));
+        }
+        const auto file_size = static_cast<std::uint64_t>(info.st_size);
+
+        std::vector<ChunkEntry> table;
+        try {
+            table = read_table(file_.get(), file_size, name);
+        } catch (const ChunkFileError &e) {
+            throw ChunkServeError(ChunkServeStatus::bad_file, e.what());
+        }
+
+        response.status = ChunkServeStatus::ok;
+        if (request.kind == ChunkRequestKind::chunks) {
+            if (request.first > table.size() ||
+                (request.first == table.size() && request.count != 0)) {
+                throw ChunkServeError(
+                    ChunkServeStatus::bad_range,
+                    fmt::format("{}: chunk {} of {}", name, request.first,
+                                table.size()));
+            }
+            const std::size_t first = request.first;
+            const std::size_t n = static_cast<std::size_t>(
+                std::min<std::uint64_t>(request.count, table.size() - first));
+            rows.assign(table.begin() + first, table.begin() + first + n);
+            for (const ChunkEntry &entry : rows) {
+                if (entry.offset + chunk_bytes(entry) > file_size) {
+                    throw ChunkServeError(
+                        ChunkServeStatus::bad_file,
+                        fmt::format("{}: chunk past the end of the file",
+                                    name));
+                }
+                add_segment(entry.offset, chunk_bytes(entry));
+            }
+            response.first_chunk = first;
+        } else if (request.kind == ChunkRequestKind::bytes) {
+            if (request.first > file_size) {
+                throw ChunkServeError(
+                    ChunkServeStatus::bad_range,
+                    fmt::format("{}: offset {} past {} bytes", name,
+                                request.first, file_size));
+            }
+            const std::uint64_t end =
+                request.first +
+                std::min(request.count, file_size - request.first);
+            // The chunks the range overlaps, as one run of the table.
+            // Empty chunks overlap nothing; they are only listed between
+            // chunks that do.
+            std::size_t first = 0;
+            while (first < table.size() &&
+                   (chunk_bytes(table[first]) == 0 ||
+                    table[first].offset + chunk_bytes(table[first]) <=
+                        request.first)) {
+                ++first;
+            }
+            std::size_t last = first;
+            for (std::size_t i = first;
+                 i < table.size() && table[i].offset < end; ++i) {
+                if (chunk_bytes(table[i]) != 0) {
+                    last = i + 1;
+                }
+            }
+            rows.assign(table.begin() + first, table.begin() + last);
+            response.first_chunk = first;
+            add_segment(request.first, end - request.first);
+        } else {
+            throw ChunkServeError(ChunkServeStatus::bad_request,
+                                  "unknown request kind");
+        }
+        response.chunk_count = rows.size();
+        response.payload_offset = segments_.empty() ? 0 : segments_[0].offset;
+        response.payload_bytes = 0;
+        for (const Segment &s : segments_) {
+            response.payload_bytes += s.length;
+        }
+    }
+
+    // Appends a file range to the payload, merging it with the previous
+    // one when they touch, as the chunks of one file usually do.
+    void add_segment(std::uint64_t offset, std::uint64_t length) {
+        if (!segments_.empty() &&
+            segments_.back().offset + segments_.back().length == offset) {
+            segments_.back().length += length;
+        } else if (length != 0) {
+            segments_.push_back({offset, length});
+        }
+    }
+
+    void write_head() {
+        asio::async_write(socket_, asio::buffer(head_),
+                          [self = shared_from_this()](
+                              boost::system::error_code ec, std::size_t) {
+                              if (ec) {
+                                  self->stop();
+                                  return;
+                              }
+                              self->send_payload();
+                          });
+    }
+
+#ifdef __linux__
+    // Sends the segments from the page cache until the socket buffer is
+    // full, then waits for the socket to drain.
+    void send_payload() {
+        while (segment_ < segments_.size()) {
+            Segment &s = segments_[segment_];
+            if (s.length == 0) {
+                ++segment_;
+                continue;
+            }
+            auto offset = static_cast<off_t>(s.offset);
+            const ssize_t sent = ::sendfile(
+                socket_.native_handle(), file_.get(), &offset,
+                static_cast<std::size_t>(
+                    std::min<std::uint64_t>(s.length, 1U << 30U)));
+            if (sent > 0) {
+                s.offset += static_cast<std::uint64_t>(sent);
+                s.length -= static_cast<std::uint64_t>(sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                socket_.async_wait(
+                    tcp::socket::wait_write,
+                    [self = shared_from_this()](boost::system::error_code ec) {
+                        if (ec) {
+                            self->stop();
+                            return;
+                        }
+                        self->send_payload();
+                    });
+                return;
+            }
+            // An error, or the file shrank after the response promised
+            // its bytes: the stream cannot be resynchronized.
+            stop();
+            return;
+        }
+        file_.reset();
+        read_size();
+    }
+#else
+    void send_payload() {
+        while (segment_ < segments_.size() && segments_[segment_].length == 0) {
+            ++segment_;
+        }
+        if (segment_ == segments_.size()) {
+            file_.reset();
+            read_size();
+            return;
+        }
+        Segment &s = segments_[segment_];
+        const std::size_t n = static_cast<std::size_t>(
+            std::min<std::uint64_t>(s.length, buffer_.size()));
+        const ssize_t got = ::pread(file_.get(), buffer_.data(), n,
+                                    static_cast<off_t>(s.offset));
+        if (got <= 0) {
+            stop();
+            return;
+        }
+        s.offset += static_cast<std::uint64_t>(got);
+        s.length -= static_cast<std::uint64_t>(got);
+        asio::async_write(socket_,
+                          asio::buffer(buffer_.data(),
+                                       static_cast<std::size_t>(got)),
+                          [self = shared_from_this()](
+                              boost::system::error_code ec, std::size_t) {
+                              if (ec) {
+                                  self->stop();
+                                  return;
+                              }
+                              self->send_payload();
+                          });
+    }
+
+    std::array<char, 1U << 20U> buffer_;
+#endif
+
+    tcp::socket socket_;
+    std::string root_;
+    std::uint32_t size_{};
+    std::vector<char> request_;
+    std::vector<char> head_; // response header, then rows or a message
+    FileHandle file_;
+    std::vector<Segment> segments_;
+    std::size_t segment_{};
+};
+
+ChunkFileServer::ChunkFileServer(asio::io_context &io,
+                                 const tcp::endpoint &endpoint,
+                                 std::string root)
+    : io_(io), strand_(asio::make_strand(io)), acceptor_(strand_, endpoint),
+      root_(std::move(root)) {
+    accept();
+}
+
+tcp::endpoint ChunkFileServer::local_endpoint() const {
+    return acceptor_.local_endpoint();
+}
+
+void ChunkFileServer::accept() {
+    acceptor_.async_accept(
+        asio::make_strand(io_),
+        [this](boost::system::error_code ec, tcp::socket socket) {
+            if (ec == asio::error::operation_aborted || !acceptor_.is_open()) {
+                return;
+            }
+            if (!ec) {
+                std::make_shared<Session>(std::move(socket), root_)->start();
+            }
+            accept();
+        });
+}
+
+void ChunkFileServer::close() {
+    asio::post(strand_, [this] {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+    });
+}
+
+ChunkFileClient::ChunkFileClient(asio::io_context &io,
+                                 const tcp::endpoint &server)
+    : socket_(io) {
+    socket_.connect(server);
+    socket_.set_option(tcp::no_delay(true));
+}
+
+ChunkResponse ChunkFileClient::request(ChunkRequestKind kind,
+                                       const std::string &name,
+                                       std::uint64_t first,
+                                       std::uint64_t count,
+                                       std::vector<ChunkEntry> &entries) {
+    if (name.size() > max_chunk_request_name) {
+        throw ChunkServeError(ChunkServeStatus::bad_request,
+                              fmt::format("{}: name too long", name));
+    }
+    const ChunkRequest request{kind, static_cast<std::uint32_t>(name.size()),
+                               first, count};
+    const auto size =
+        static_cast<std::uint32_t>(sizeof(request) + name.size());
+    const std::array<asio::const_buffer, 3> buffers{
+        asio::buffer(&size, sizeof(size)),
+        asio::buffer(&request, sizeof(request)), asio::buffer(name)};
+    asio::write(socket_, buffers);
+
+    ChunkResponse response;
+    asio::read(socket_, asio::buffer(&response, sizeof(response)));
+    if (response.status != ChunkServeStatus::ok) {
+        std::string message(
+            std::min<std::uint64_t>(response.payload_bytes, 1U << 16U), '\0');
+        asio::read(socket_, asio::buffer(message));
+        if (message.size() != response.payload_bytes) {
+            socket_.close(); // the rest of the message is still in flight
+        }
+        throw ChunkServeError(response.status, message);
+    }
+    entries.resize(response.chunk_count);
+    asio::read(socket_, asio::buffer(entries.data(),
+                                     entries.size() * sizeof(ChunkEntry)));
+    return response;
+}
+
+FetchedChunks ChunkFileClient::fetch_chunks(const std::string &name,
+                                            std::uint64_t first,
+                                            std::uint64_t count) {
+    FetchedChunks fetched;
+    const ChunkResponse response = request(ChunkRequestKind::chunks, name,
+                                           first, count, fetched.entries);
+    fetched.first_chunk = response.first_chunk;
+    std::uint64_t points = 0;
+    for (const ChunkEntry &entry : fetched.entries) {
+        points += entry.point_count;
+    }
+    if (response.payload_bytes != points * sizeof(VecXYZ)) {
+        socket_.close();
+        throw ChunkFileError(fmt::format(
+            "{}: {} payload bytes for {} points", name,
+            response.payload_bytes, points));
+    }
+    fetched.points.resize(static_cast<std::size_t>(points));
+    asio::read(socket_, asio::buffer(fetched.points.data(),
+                                     fetched.points.size() * sizeof(VecXYZ)));
+    const VecXYZ *p = fetched.points.data();
+    for (std::size_t i = 0; i < fetched.entries.size(); ++i) {
+        const ChunkEntry &entry = fetched.entries[i];
+        if (crc32c(0, p, chunk_bytes(entry)) != entry.crc) {
+            throw ChunkFileError(
+                fmt::format("{}: chunk {} checksum mismatch", name,
+                            fetched.first_chunk + i));
+        }
+        p += entry.point_count;
+    }
+    return fetched;
+}
+
+std::vector<char> ChunkFileClient::fetch_bytes(const std::string &name,
+                                               std::uint64_t offset,
+                                               std::uint64_t length,
+                                               FetchedChunks *overlap) {
+    std::vector<ChunkEntry> entries;
+    const ChunkResponse response =
+        request(ChunkRequestKind::bytes, name, offset, length, entries);
+    std::vector<char> bytes(static_cast<std::size_t>(response.payload_bytes));
+    asio::read(socket_, asio::buffer(bytes));
+    if (overlap != nullptr) {
+        overlap->first_chunk = response.first_chunk;
+        overlap->entries = std::move(entries);
+        overlap->points.clear();
+    }
+    return bytes;
+}
+
+} // namespace vecxyz
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "chunk_file.hpp"
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+// Chunk file serving protocol. A request is a std::uint32_t body size and
+// a body of ChunkRequest followed by the file name, relative to the served
+// directory. The response is a ChunkResponse, then `chunk_count`
+// ChunkEntry rows, then `payload_bytes` bytes: file bytes on success, an
+// error message otherwise. All integers are little-endian.
+enum class ChunkRequestKind : std::uint32_t {
+    // Bytes [first, first + count) of the file, clipped to its size. The
+    // response lists the chunks the range overlaps.
+    bytes = 0,
+    // The payloads of chunks [first, first + count), clipped to the table,
+    // back to back in table order.
+    chunks = 1,
+};
+
+enum class ChunkServeStatus : std::uint32_t {
+    ok = 0,
+    bad_request = 1,
+    not_found = 2,
+    bad_file = 3, // not a readable chunk file
+    bad_range = 4,
+};
+
+struct ChunkRequest {
+    ChunkRequestKind kind;
+    std::uint32_t name_bytes;
+    std::uint64_t first;
+    std::uint64_t count;
+};
+static_assert(sizeof(ChunkRequest) == 24, "request layout is on the wire");
+
+struct ChunkResponse {
+    ChunkServeStatus status;
+    std::uint32_t reserved;
+    std::uint64_t first_chunk;
+    std::uint64_t chunk_count;
+    std::uint64_t payload_offset; // file offset of the first payload byte
+    std::uint64_t payload_bytes;
+};
+static_assert(sizeof(ChunkResponse) == 40, "response layout is on the wire");
+
+constexpr std::size_t max_chunk_request_name = 4096;
+
+class ChunkServeError : public std::runtime_error {
+  public:
+    ChunkServeError(ChunkServeStatus status, const std::string &what)
+        : std::runtime_error(what), status_(status) {}
+
+    ChunkServeStatus status() const { return status_; }
+
+  private:
+    ChunkServeStatus status_;
+};
+
+// Serves the chunk files under `root`. Payload bytes go from the page
+// cache to the socket with sendfile(2) (on Linux; elsewhere through a
+// read buffer), so serving a file costs no user-space copy; only the
+// response header and the requested rows of the chunk table are written
+// from memory. Every connection runs on its own strand and handles its
+// requests in order.
+class ChunkFileServer {
+  public:
+    ChunkFileServer(boost::asio::io_context &io,
+                    const boost::asio::ip::tcp::endpoint &endpoint,
+                    std::string root);
+    ChunkFileServer(const ChunkFileServer &) = delete;
+    ChunkFileServer &operator=(const ChunkFileServer &) = delete;
+
+    boost::asio::ip::tcp::endpoint local_endpoint() const;
+
+    // Stops accepting; open connections finish when their clients leave.
+    // Thread-safe.
+    void close();
+
+  private:
+    class Session;
+
+    void accept();
+
+    boost::asio::io_context &io_;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    std::string root_;
+};
+
+// Chunks fetched from a ChunkFileServer, checked against their CRC32C.
+struct FetchedChunks {
+    std::uint64_t first_chunk{};
+    std::vector<ChunkEntry> entries;
+    std::vector<VecXYZ> points; // the chunks' points back to back
+};
+
+// Blocking client for a ChunkFileServer. Error responses are thrown as
+// ChunkServeError, checksum mismatches as ChunkFileError and socket errors
+// as boost::system::system_error.
+class ChunkFileClient {
+  public:
+    ChunkFileClient(boost::asio::io_context &io,
+                    const boost::asio::ip::tcp::endpoint &server);
+
+    FetchedChunks fetch_chunks(const std::string &name, std::uint64_t first,
+                               std::uint64_t count);
+    // Raw file bytes; `overlap`, if given, receives the chunks they touch.
+    std::vector<char> fetch_bytes(const std::string &name,
+                                  std::uint64_t offset, std::uint64_t length,
+                                  FetchedChunks *overlap = nullptr);
+
+  private:
+    ChunkResponse request(ChunkRequestKind kind, const std::string &name,
+                          std::uint64_t first, std::uint64_t count,
+                          std::vector<ChunkEntry> &entries);
+
+    boost::asio::ip::tcp::socket socket_;
+};
+
+} // namespace vecxyz
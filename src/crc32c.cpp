@@ -0,0 +1,94 @@
+#include "crc32c.hpp"
+#include <boost/crc.hpp>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                             \
+    (defined(__GNUC__) || defined(__clang__))
+#define VECXYZ_CRC32C_X86 1
+#include <nmmintrin.h>
+#endif
+
+namespace vecxyz {
+namespace {
+using crc32c_table_t = boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF,
+                                          0xFFFFFFFF, true, true>;
+
+std::uint32_t reflect32(std::uint32_t value) noexcept {
+    std::uint32_t result = 0;
+    for (int bit = 0; bit < 32; ++bit) {
+        result = (result << 1U) | (value & 1U);
+        value >>= 1U;
+    }
+    return result;
+}
+
+std::uint32_t crc32c_table(std::uint32_t crc, const void *data,
+                           std::size_t size) noexcept {
+    // boost::crc takes the initial remainder unreflected, so resuming from a
+    // finished checksum means undoing both the final xor and the reflection.
+    crc32c_table_t engine(reflect32(~crc));
+    engine.process_bytes(data, size);
+    return engine.checksum();
+}
+
+#ifdef VECXYZ_CRC32C_X86
+__attribute__((target("sse4.2"))) std::uint32_t
+crc32c_sse42(std::uint32_t crc, const void *data, std::size_t size) noexcept {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    std::uint32_t state = ~crc;
+
+    while (size > 0 && (reinterpret_cast<std::uintptr_t>(bytes) & 7U) != 0) {
+        state = _mm_crc32_u8(state, *bytes++);
+        --size;
+    }
+#ifdef __x86_64__
+    std::uint64_t state64 = state;
+    while (size >= sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        state64 = _mm_crc32_u64(state64, word);
+        bytes += sizeof(word);
+        size -= sizeof(word);
+    }
+    state = static_cast<std::uint32_t>(state64);
+#endif
+    while (size >= sizeof(std::uint32_t)) {
+        std::uint32_t word;
+        std::memcpy(&word, bytes, sizeof(word));
+        state = _mm_crc32_u32(state, word);
+        bytes += sizeof(word);
+        size -= sizeof(word);
+    }
+    while (size > 0) {
+        state = _mm_crc32_u8(state, *bytes++);
+        --size;
+    }
+    return ~state;
+}
+#endif
+
+using crc32c_fn = std::uint32_t (*)(std::uint32_t, const void *,
+                                    std::size_t) noexcept;
+
+crc32c_fn select_crc32c() noexcept {
+#ifdef VECXYZ_CRC32C_X86
+    if (__builtin_cpu_supports("sse4.2")) {
+        return &crc32c_sse42;
+    }
+#endif
+    return &crc32c_table;
+}
+
+const crc32c_fn active_crc32c = select_crc32c();
+} // namespace
+
+std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                     std::size_t size) noexcept {
+    return active_crc32c(crc, data, size);
+}
+
+bool crc32c_hardware_available() noexcept {
+    return active_crc32c != &crc32c_table;
+}
+
+} // namespace vecxyz
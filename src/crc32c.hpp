@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vecxyz {
+
+// CRC32C (Castagnoli). `crc` is a previously returned checksum, so
+// crc32c(crc32c(0, a), b) == crc32c(0, a + b).
+std::uint32_t crc32c(std::uint32_t crc, const void *data,
+                     std::size_t size) noexcept;
+
+// True when crc32c() runs on the SSE4.2 crc32 instruction instead of the
+// boost::crc table fallback.
+bool crc32c_hardware_available() noexcept;
+
+} // namespace vecxyz
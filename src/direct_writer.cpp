@@ -0,0 +1,187 @@
+#include "direct_writer.hpp"
+#include "crc32c.hpp"
+#include <algorithm>
+#include <boost/system/system_error.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <unistd.h>
+
+namespace vecxyz {
+namespace {
+[[noreturn]] void throw_errno(const std::string &what) {
+    throw boost::system::system_error(errno, boost::system::system_category(),
+                                      what);
+}
+
+std::size_t round_up(std::size_t value) {
+    return (value + direct_io_alignment - 1) / direct_io_alignment *
+           direct_io_alignment;
+}
+} // namespace
+
+AlignedBufferPool::AlignedBufferPool(std::size_t buffer_size,
+                                     std::size_t max_cached)
+    : buffer_size_(std::max(round_up(buffer_size), direct_io_alignment)),
+      max_cached_(max_cached) {}
+
+AlignedBufferPool::~AlignedBufferPool() {
+    for (char *data : free_) {
+        std::free(data);
+    }
+}
+
+AlignedBufferPool::Buffer AlignedBufferPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            char *data = free_.back();
+            free_.pop_back();
+            return Buffer(data, Recycle{this});
+        }
+    }
+    void *data = nullptr;
+    if (::posix_memalign(&data, direct_io_alignment, buffer_size_) != 0) {
+        throw std::bad_alloc();
+    }
+    return Buffer(static_cast<char *>(data), Recycle{this});
+}
+
+void AlignedBufferPool::release(char *data) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.size() < max_cached_) {
+            free_.push_back(data);
+            return;
+        }
+    }
+    std::free(data);
+}
+
+DirectFileWriter::DirectFileWriter(const std::string &path,
+                                   AlignedBufferPool &pool, bool use_direct)
+    : path_(path), buffer_(pool.acquire()), capacity_(pool.buffer_size()) {
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if (use_direct) {
+        fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+        direct_ = fd_ >= 0;
+        if (fd_ < 0 && errno != EINVAL) {
+            throw_errno(path);
+        }
+    }
+    if (fd_ < 0) {
+        fd_ = ::open(path.c_str(), flags, 0644);
+        if (fd_ < 0) {
+            throw_errno(path);
+        }
+    }
+}
+
+DirectFileWriter::~DirectFileWriter() {
+    if (fd_ >= 0) {
+        try {
+            close();
+        } catch (...) {
+        }
+    }
+}
+
+void DirectFileWriter::write(const void *data, std::size_t size) {
+    const auto *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        const std::size_t take = std::min(size, capacity_ - fill_);
+        std::memcpy(buffer_.get() + fill_, bytes, take);
+        fill_ += take;
+        bytes += take;
+        size -= take;
+        if (fill_ == capacity_) {
+            flush(fill_);
+        }
+    }
+}
+
+void DirectFileWriter::flush(std::size_t bytes) {
+    std::size_t done = 0;
+    while (done < bytes) {
+        const ssize_t n =
+            ::pwrite(fd_, buffer_.get() + done, bytes - done,
+                     static_cast<off_t>(written_ + done));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Some filesystems accept O_DIRECT at open and only reject the
+            // first I/O.
+            if (errno == EINVAL && direct_ && written_ == 0 && done == 0) {
+                disable_direct();
+                continue;
+            }
+            throw_errno(path_);
+        }
+        done += static_cast<std::size_t>(n);
+    }
+    // A padded tail block counts only its real bytes; close() trims the rest.
+    written_ += std::min(bytes, fill_);
+    fill_ -= std::min(bytes, fill_);
+}
+
+void DirectFileWriter::disable_direct() {
+    const int flags = ::fcntl(fd_, F_GETFL);
+    if (flags < 0 || ::fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0) {
+        throw_errno(path_);
+    }
+    direct_ = false;
+}
+
+void DirectFileWriter::close() {
+    if (fd_ < 0) {
+        return;
+    }
+    const std::uint64_t total = size();
+    const bool padded = direct_ && fill_ % direct_io_alignment != 0;
+    if (fill_ > 0) {
+        const std::size_t bytes = padded ? round_up(fill_) : fill_;
+        std::memset(buffer_.get() + fill_, 0, bytes - fill_);
+        flush(bytes);
+    }
+    if (padded && ::ftruncate(fd_, static_cast<off_t>(total)) != 0) {
+        const int error = errno;
+        ::close(fd_);
+        fd_ = -1;
+        errno = error;
+        throw_errno(path_);
+    }
+    if (::close(fd_) != 0) {
+        fd_ = -1;
+        throw_errno(path_);
+    }
+    fd_ = -1;
+}
+
+bool save_chunk_file_direct(const std::string &path,
+                            const std::vector<VecXYZ> &points,
+                            AlignedBufferPool &pool,
+                            std::uint32_t chunk_points) {
+    // The header goes first and carries the table checksum, so the chunk
+    // checksums are taken up front instead of seeking back to block 0.
+    std::vector<ChunkEntry> table = plan_chunks(points.size(), chunk_points);
+    for (std::size_t i = 0; i < table.size(); ++i) {
+        table[i].crc = crc32c(0, points.data() + i * std::size_t{chunk_points},
+                              table[i].point_count * sizeof(VecXYZ));
+    }
+    const std::uint64_t table_offset =
+        sizeof(ChunkFileHeader) + points.size() * sizeof(VecXYZ);
+    const ChunkFileHeader header =
+        make_chunk_header(chunk_points, points.size(), table, table_offset);
+
+    DirectFileWriter writer(path, pool);
+    writer.write(&header, sizeof(header));
+    writer.write(points.data(), points.size() * sizeof(VecXYZ));
+    writer.write(table.data(), table.size() * sizeof(ChunkEntry));
+    writer.close();
+    return writer.direct();
+}
+
+} // namespace vecxyz
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "chunk_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+// O_DIRECT wants buffer addresses, file offsets and lengths on this boundary.
+constexpr std::size_t direct_io_alignment = 4096;
+
+// Hands out direct_io_alignment-aligned buffers of one size and keeps up to
+// `max_cached` of them when they come back, so repeated snapshots do not
+// go back to the allocator.
+class AlignedBufferPool {
+    struct Recycle {
+        AlignedBufferPool *pool;
+        void operator()(char *data) const { pool->release(data); }
+    };
+
+  public:
+    using Buffer = std::unique_ptr<char[], Recycle>;
+
+    explicit AlignedBufferPool(std::size_t buffer_size = 1U << 20U,
+                               std::size_t max_cached = 8);
+    AlignedBufferPool(const AlignedBufferPool &) = delete;
+    AlignedBufferPool &operator=(const AlignedBufferPool &) = delete;
+    ~AlignedBufferPool();
+
+    std::size_t buffer_size() const { return buffer_size_; }
+    Buffer acquire();
+
+  private:
+    void release(char *data);
+
+    std::size_t buffer_size_;
+    std::size_t max_cached_;
+    std::mutex mutex_;
+    std::vector<char *> free_;
+};
+
+// Sequential file writer that bypasses the page cache with O_DIRECT. When
+// the filesystem refuses O_DIRECT, either at open or on the first write,
+// it switches to buffered writes of the same data.
+class DirectFileWriter {
+  public:
+    DirectFileWriter(const std::string &path, AlignedBufferPool &pool,
+                     bool use_direct = true);
+    DirectFileWriter(const DirectFileWriter &) = delete;
+    DirectFileWriter &operator=(const DirectFileWriter &) = delete;
+    ~DirectFileWriter();
+
+    void write(const void *data, std::size_t size);
+
+    // Writes the padded tail block and trims the file to the bytes written.
+    void close();
+
+    bool direct() const { return direct_; }
+    std::uint64_t size() const { return written_ + fill_; }
+
+  private:
+    void flush(std::size_t bytes);
+    void disable_direct();
+
+    std::string path_;
+    AlignedBufferPool::Buffer buffer_;
+    std::size_t capacity_;
+    std::size_t fill_{};
+    std::uint64_t written_{};
+    int fd_{-1};
+    bool direct_{false};
+};
+
+// Snapshot of `points` in the chunk file format through a DirectFileWriter.
+// Returns whether the data actually went through O_DIRECT.
+bool save_chunk_file_direct(const std::string &path,
+                            const std::vector<VecXYZ> &points,
+                            AlignedBufferPool &pool,
+                            std::uint32_t chunk_points = default_chunk_points);
+
+} // namespace vecxyz
@@ -0,0 +1,348 @@
+#include "kdtree.hpp"
+#include "parallel.hpp"
+#include "simd_transpose.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace vecxyz {
+namespace {
+constexpr std::size_t query_grain = 256;
+// Median splits of fewer than 2^30 points stay far shallower than this.
+constexpr std::size_t max_depth = 63;
+
+float coordinate(const VecXYZ &p, unsigned axis) {
+    return axis == 0 ? p.x : axis == 1 ? p.y : p.z;
+}
+} // namespace
+
+KdTree::KdTree(const VecXYZ *points, std::size_t count)
+    : points_(points, points + count), indices_(count),
+      data_crc_(points_checksum(points, count)) {
+    if (count >= (std::size_t{1} << 30U)) {
+        throw std::length_error("KdTree supports fewer than 2^30 points");
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        indices_[i] = static_cast<std::uint32_t>(i);
+    }
+    if (count != 0) {
+        nodes_.reserve(2 * count / leaf_points + 1);
+        build(0, static_cast<std::uint32_t>(count));
+    }
+    // Gather the points into tree order once, so leaves scan contiguously.
+    for (std::size_t i = 0; i < count; ++i) {
+        points_[i] = points[indices_[i]];
+    }
+}
+
+std::uint32_t KdTree::build(std::uint32_t begin, std::uint32_t end) {
+    const auto self = static_cast<std::uint32_t>(nodes_.size());
+    nodes_.push_back({0.0F, begin, end, 3U});
+    if (end - begin <= leaf_points) {
+        return self;
+    }
+
+    VecXYZ lo = points_[indices_[begin]];
+    VecXYZ hi = lo;
+    for (std::uint32_t i = begin + 1; i < end; ++i) {
+        const VecXYZ &p = points_[indices_[i]];
+        lo = {std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z)};
+        hi = {std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z)};
+    }
+    const float ex = hi.x - lo.x;
+    const float ey = hi.y - lo.y;
+    const float ez = hi.z - lo.z;
+    const unsigned axis = ex >= ey && ex >= ez ? 0 : ey >= ez ? 1 : 2;
+
+    const std::uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(indices_.begin() + begin, indices_.begin() + mid,
+                     indices_.begin() + end,
+                     [&](std::uint32_t a, std::uint32_t b) {
+                         return coordinate(points_[a], axis) <
+                                coordinate(points_[b], axis);
+                     });
+    const float split = coordinate(points_[indices_[mid]], axis);
+
+    build(begin, mid);
+    const std::uint32_t right = build(mid, end);
+    nodes_[self].split = split;
+    nodes_[self].right_axis = right << 2U | axis;
+    return self;
+}
+
+void KdTreeView::knn(const VecXYZ *queries, std::size_t query_count,
+                     std::size_t k, Neighbor *out) const {
+    if (k == 0) {
+        return;
+    }
+    parallel_for(query_count, query_grain,
+                 [&](std::size_t begin, std::size_t end) {
+                     detail::TopK best;
+                     for (std::size_t q = begin; q < end; ++q) {
+                         best.reset(k);
+                         if (node_count_ != 0) {
+                             search(queries[q], best);
+                         }
+                         best.finish(out + q * k);
+                     }
+                 });
+}
+
+void KdTreeView::search(const VecXYZ &query, detail::TopK &best) const {
+    struct Pending {
+        std::uint32_t node;
+        float squared_distance; // lower bound to anything under node
+    };
+    Pending stack[max_depth + 1];
+    std::size_t depth = 0;
+    stack[depth++] = {0, 0.0F};
+
+    while (depth != 0) {
+        const Pending top = stack[--depth];
+        if (top.squared_distance > best.bound().squared_distance) {
+            continue;
+        }
+        const KdNode &node = nodes_[top.node];
+        if (!node.leaf()) {
+            // Visit the query's side first; the other side is at least the
+            // distance to the splitting plane away.
+            const float delta = coordinate(query, node.axis()) - node.split;
+            const std::uint32_t left = top.node + 1;
+            const std::uint32_t near = delta < 0 ? left : node.right();
+            const std::uint32_t far = delta < 0 ? node.right() : left;
+            stack[depth++] = {far, std::max(top.squared_distance,
+                                            delta * delta)};
+            stack[depth++] = {near, top.squared_distance};
+            continue;
+        }
+
+        std::uint32_t i = node.begin;
+#ifdef VECXYZ_HAS_SSE
+        const __m128 qx = _mm_set1_ps(query.x);
+        const __m128 qy = _mm_set1_ps(query.y);
+        const __m128 qz = _mm_set1_ps(query.z);
+        for (; i + 4 <= node.end; i += 4) {
+            __m128 x;
+            __m128 y;
+            __m128 z;
+            load_transpose4(points_ + i, x, y, z);
+            const __m128 dx = _mm_sub_ps(x, qx);
+            const __m128 dy = _mm_sub_ps(y, qy);
+            const __m128 dz = _mm_sub_ps(z, qz);
+            alignas(16) float d[4];
+            _mm_store_ps(d, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                                                  _mm_mul_ps(dy, dy)),
+                                       _mm_mul_ps(dz, dz)));
+            for (std::uint32_t lane = 0; lane < 4; ++lane) {
+                best.offer(indices_[i + lane], d[lane]);
+            }
+        }
+#endif
+        for (; i < node.end; ++i) {
+            const float dx = points_[i].x - query.x;
+            const float dy = points_[i].y - query.y;
+            const float dz = points_[i].z - query.z;
+            best.offer(indices_[i], dx * dx + dy * dy + dz * dz);
+        }
+    }
+}
+
+bool KdTreeView::radius(const VecXYZ &center, float radius,
+                        std::vector<std::uint32_t> &out,
+                        std::size_t limit) const {
+    if (node_count_ == 0 || !(radius >= 0.0F)) {
+        return true;
+    }
+    const std::size_t first = out.size();
+    const float r2 = radius * radius;
+    struct Pending {
+        std::uint32_t node;
+        float squared_distance; // lower bound, as in search()
+    };
+    Pending stack[max_depth + 1];
+    std::size_t depth = 0;
+    stack[depth++] = {0, 0.0F};
+
+    while (depth != 0) {
+        const Pending top = stack[--depth];
+        if (top.squared_distance > r2) {
+            continue;
+        }
+        const KdNode &node = nodes_[top.node];
+        if (!node.leaf()) {
+            const float delta = coordinate(center, node.axis()) - node.split;
+            const std::uint32_t left = top.node + 1;
+            const std::uint32_t near = delta < 0 ? left : node.right();
+            const std::uint32_t far = delta < 0 ? node.right() : left;
+            stack[depth++] = {far, std::max(top.squared_distance,
+                                            delta * delta)};
+            stack[depth++] = {near, top.squared_distance};
+            continue;
+        }
+
+        std::uint32_t i = node.begin;
+#ifdef VECXYZ_HAS_SSE
+        const __m128 cx = _mm_set1_ps(center.x);
+        const __m128 cy = _mm_set1_ps(center.y);
+        const __m128 cz = _mm_set1_ps(center.z);
+        const __m128 reach = _mm_set1_ps(r2);
+        for (; i + 4 <= node.end; i += 4) {
+            __m128 x;
+            __m128 y;
+            __m128 z;
+            load_transpose4(points_ + i, x, y, z);
+            const __m128 dx = _mm_sub_ps(x, cx);
+            const __m128 dy = _mm_sub_ps(y, cy);
+            const __m128 dz = _mm_sub_ps(z, cz);
+            const __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                _mm_mul_ps(dz, dz));
+            const int inside = _mm_movemask_ps(_mm_cmple_ps(d, reach));
+            for (std::uint32_t lane = 0; lane < 4; ++lane) {
+                if ((inside >> lane & 1) != 0) {
+                    out.push_back(indices_[i + lane]);
+                }
+            }
+        }
+#endif
+        for (; i < node.end; ++i) {
+            const float dx = points_[i].x - center.x;
+            const float dy = points_[i].y - center.y;
+            const float dz = points_[i].z - center.z;
+            if (dx * dx + dy * dy + dz * dz <= r2) {
+                out.push_back(indices_[i]);
+            }
+        }
+        if (out.size() - first > limit) {
+            out.resize(first);
+            return false;
+        }
+    }
+    std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end());
+    return true;
+}
+
+bool KdTreeView::box(const Aabb &box, std::vector<std::uint32_t> &out,
+                     std::size_t limit) const {
+    if (node_count_ == 0 || box.empty()) {
+        return true;
+    }
+    const std::size_t first = out.size();
+    std::uint32_t stack[max_depth + 1];
+    std::size_t depth = 0;
+    stack[depth++] = 0;
+
+    while (depth != 0) {
+        const std::uint32_t index = stack[--depth];
+        const KdNode &node = nodes_[index];
+        if (!node.leaf()) {
+            // Points equal to the split may sit on either side.
+            if (coordinate(box.max, node.axis()) >= node.split) {
+                stack[depth++] = node.right();
+            }
+            if (coordinate(box.min, node.axis()) <= node.split) {
+                stack[depth++] = index + 1;
+            }
+            continue;
+        }
+
+        std::uint32_t i = node.begin;
+#ifdef VECXYZ_HAS_SSE
+        const __m128 lo_x = _mm_set1_ps(box.min.x);
+        const __m128 lo_y = _mm_set1_ps(box.min.y);
+        const __m128 lo_z = _mm_set1_ps(box.min.z);
+        const __m128 hi_x = _mm_set1_ps(box.max.x);
+        const __m128 hi_y = _mm_set1_ps(box.max.y);
+        const __m128 hi_z = _mm_set1_ps(box.max.z);
+        for (; i + 4 <= node.end; i += 4) {
+            __m128 x;
+            __m128 y;
+            __m128 z;
+            load_transpose4(points_ + i, x, y, z);
+            const __m128 in_x =
+                _mm_and_ps(_mm_cmpge_ps(x, lo_x), _mm_cmple_ps(x, hi_x));
+            const __m128 in_y =
+                _mm_and_ps(_mm_cmpge_ps(y, lo_y), _mm_cmple_ps(y, hi_y));
+            const __m128 in_z =
+                _mm_and_ps(_mm_cmpge_ps(z, lo_z), _mm_cmple_ps(z, hi_z));
+            const int inside =
+                _mm_movemask_ps(_mm_and_ps(_mm_and_ps(in_x, in_y), in_z));
+            for (std::uint32_t lane = 0; lane < 4; ++lane) {
+                if ((inside >> lane & 1) != 0) {
+                    out.push_back(indices_[i + lane]);
+                }
+            }
+        }
+#endif
+        for (; i < node.end; ++i) {
+            const VecXYZ &p = points_[i];
+            if (p.x >= box.min.x && p.x <= box.max.x && p.y >= box.min.y &&
+                p.y <= box.max.y && p.z >= box.min.z && p.z <= box.max.z) {
+                out.push_back(indices_[i]);
+            }
+        }
+        if (out.size() - first > limit) {
+            out.resize(first);
+            return false;
+        }
+    }
+    std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end());
+    return true;
+}
+
+void KdTreeView::check(std::size_t data_size) const {
+    if (size_ == 0 ? node_count_ != 0 : node_count_ == 0) {
+        throw KdTreeError("k-d tree nodes do not match its points");
+    }
+    for (std::size_t i = 0; i < size_; ++i) {
+        if (indices_[i] >= data_size) {
+            throw KdTreeError("k-d tree index out of range");
+        }
+    }
+    if (node_count_ == 0) {
+        return;
+    }
+
+    // Walk the tree: every node must be reached exactly once, in depth
+    // first order, with children splitting their parent's range.
+    struct Expected {
+        std::uint32_t node;
+        std::uint32_t begin;
+        std::uint32_t end;
+        std::size_t depth;
+    };
+    std::vector<Expected> stack{{0, 0, static_cast<std::uint32_t>(size_), 0}};
+    std::size_t visited = 0;
+    while (!stack.empty()) {
+        const Expected e = stack.back();
+        stack.pop_back();
+        if (e.node != visited || e.node >= node_count_) {
+            throw KdTreeError("k-d tree nodes are out of order");
+        }
+        // A search holds at most one pending node per level, plus one.
+        if (e.depth >= max_depth) {
+            throw KdTreeError("k-d tree is too deep");
+        }
+        ++visited;
+        const KdNode &n = nodes_[e.node];
+        if (n.begin != e.begin || n.end != e.end || n.begin > n.end) {
+            throw KdTreeError("k-d tree node ranges are inconsistent");
+        }
+        if (n.leaf()) {
+            continue;
+        }
+        const std::uint32_t mid =
+            n.right() < node_count_ ? nodes_[n.right()].begin : 0;
+        if (n.right() <= e.node + 1 || n.right() >= node_count_ ||
+            mid < n.begin || mid > n.end) {
+            throw KdTreeError("k-d tree child links are inconsistent");
+        }
+        stack.push_back({n.right(), mid, n.end, e.depth + 1});
+        stack.push_back({e.node + 1, n.begin, mid, e.depth + 1});
+    }
+    if (visited != node_count_) {
+        throw KdTreeError("k-d tree has unreachable nodes");
+    }
+}
+
+} // namespace vecxyz
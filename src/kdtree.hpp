@@ -0,0 +1,173 @@
+#pragma once
+
+#include "crc32c.hpp"
+#include "knn.hpp"
+#include "point_stats.hpp"
+#include "vecxyz.hpp"
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/collection_size_type.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace vecxyz {
+
+class KdTreeError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+struct KdNode {
+    float split;
+    std::uint32_t begin; // range in the tree's points
+    std::uint32_t end;
+    // Right child << 2 | split axis; axis 3 marks a leaf. The left child
+    // always follows its parent.
+    std::uint32_t right_axis;
+
+    bool leaf() const { return (right_axis & 3U) == 3U; }
+    unsigned axis() const { return right_axis & 3U; }
+    std::uint32_t right() const { return right_axis >> 2U; }
+
+    template <class Archive> void serialize(Archive &ar, const unsigned int) {
+        ar & split;
+        ar & begin;
+        ar & end;
+        ar & right_axis;
+    }
+};
+static_assert(sizeof(KdNode) == 16, "KdNode layout is on disk");
+
+// CRC32C of the packed points an index was built from. Loaders compare it
+// with the stored one to make sure the index belongs to the data.
+inline std::uint32_t points_checksum(const VecXYZ *points, std::size_t count) {
+    return crc32c(0, points, count * sizeof(VecXYZ));
+}
+
+// Queries over k-d tree arrays owned elsewhere: a KdTree or a mapped file.
+class KdTreeView {
+  public:
+    KdTreeView() = default;
+    KdTreeView(const KdNode *nodes, std::size_t node_count,
+               const VecXYZ *points, const std::uint32_t *indices,
+               std::size_t size)
+        : nodes_(nodes), node_count_(node_count), points_(points),
+          indices_(indices), size_(size) {}
+
+    std::size_t size() const { return size_; }
+
+    // Same contract and results as BruteForceKnn::knn.
+    void knn(const VecXYZ *queries, std::size_t query_count, std::size_t k,
+             Neighbor *out) const;
+
+    // Append the input indices of the points within `radius` of `center`,
+    // or inside `box`, boundaries included, in ascending order. Return
+    // false, leaving `out` as it was, once more than `limit` points match;
+    // the search stops there.
+    bool radius(const VecXYZ &center, float radius,
+                std::vector<std::uint32_t> &out,
+                std::size_t limit = std::numeric_limits<std::size_t>::max())
+        const;
+    bool box(const Aabb &box, std::vector<std::uint32_t> &out,
+             std::size_t limit = std::numeric_limits<std::size_t>::max())
+        const;
+
+    // Throws KdTreeError unless the nodes form one well-formed tree over
+    // all points, shallow enough for the query stack, with input indices
+    // below `data_size`.
+    void check(std::size_t data_size) const;
+
+  private:
+    void search(const VecXYZ &query, detail::TopK &best) const;
+
+    const KdNode *nodes_{};
+    std::size_t node_count_{};
+    const VecXYZ *points_{};
+    const std::uint32_t *indices_{};
+    std::size_t size_{};
+};
+
+// Static k-d tree over a copy of the points. Nodes, points and the map back
+// to input indices are flat arrays with no pointers, laid out depth first.
+// Serializable through Boost archives; see also kdtree_file.hpp.
+class KdTree {
+  public:
+    static constexpr std::size_t leaf_points = 16;
+
+    using Node = KdNode;
+
+    KdTree() = default;
+    // Median splits on the widest axis. Throws std::length_error above
+    // 2^30 points.
+    KdTree(const VecXYZ *points, std::size_t count);
+
+    std::size_t size() const { return points_.size(); }
+    const std::vector<Node> &nodes() const { return nodes_; }
+    // Points in tree order, and the input index of each.
+    const std::vector<VecXYZ> &points() const { return points_; }
+    const std::vector<std::uint32_t> &indices() const { return indices_; }
+    // points_checksum() of the input.
+    std::uint32_t data_checksum() const { return data_crc_; }
+
+    KdTreeView view() const {
+        return {nodes_.data(), nodes_.size(), points_.data(),
+                indices_.data(), points_.size()};
+    }
+
+    void knn(const VecXYZ *queries, std::size_t query_count, std::size_t k,
+             Neighbor *out) const {
+        view().knn(queries, query_count, k, out);
+    }
+    bool radius(const VecXYZ &center, float radius,
+                std::vector<std::uint32_t> &out,
+                std::size_t limit = std::numeric_limits<std::size_t>::max())
+        const {
+        return view().radius(center, radius, out, limit);
+    }
+    bool box(const Aabb &box, std::vector<std::uint32_t> &out,
+             std::size_t limit = std::numeric_limits<std::size_t>::max())
+        const {
+        return view().box(box, out, limit);
+    }
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive> void save(Archive &ar, const unsigned int) const {
+        const boost::serialization::collection_size_type nodes(nodes_.size());
+        const boost::serialization::collection_size_type points(size());
+        ar << data_crc_ << nodes << points;
+        ar << boost::serialization::make_array(nodes_.data(), nodes_.size());
+        ar << boost::serialization::make_array(points_.data(), size());
+        ar << boost::serialization::make_array(indices_.data(), size());
+    }
+
+    // A loaded tree is checked for shape, but only the caller can compare
+    // data_checksum() against the data it is about to query.
+    template <class Archive> void load(Archive &ar, const unsigned int) {
+        boost::serialization::collection_size_type nodes;
+        boost::serialization::collection_size_type points;
+        ar >> data_crc_ >> nodes >> points;
+        nodes_.resize(nodes);
+        points_.resize(points);
+        indices_.resize(points);
+        ar >> boost::serialization::make_array(nodes_.data(), nodes_.size());
+        ar >> boost::serialization::make_array(points_.data(), size());
+        ar >> boost::serialization::make_array(indices_.data(), size());
+        view().check(size());
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    std::uint32_t build(std::uint32_t begin, std::uint32_t end);
+
+    std::vector<Node> nodes_;
+    std::vector<VecXYZ> points_;
+    std::vector<std::uint32_t> indices_;
+    std::uint32_t data_crc_{};
+};
+
+} // namespace vecxyz
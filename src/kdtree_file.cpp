@@ -0,0 +1,131 @@
+#include "kdtree_file.hpp"
+#include "crc32c.hpp"
+#include <cstddef>
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+
+namespace vecxyz {
+namespace {
+std::uint32_t header_checksum(const KdTreeFileHeader &header) {
+    return crc32c(0, &header, offsetof(KdTreeFileHeader, header_crc));
+}
+
+// Offsets of the three arrays for the given sizes.
+KdTreeFileHeader layout(std::uint64_t point_count, std::uint64_t node_count) {
+    KdTreeFileHeader header{};
+    std::memcpy(header.magic, kdtree_file_magic, sizeof(header.magic));
+    header.version = kdtree_file_version;
+    header.point_count = point_count;
+    header.node_count = node_count;
+    header.nodes_offset = sizeof(KdTreeFileHeader);
+    header.points_offset = header.nodes_offset + node_count * sizeof(KdNode);
+    header.indices_offset =
+        header.points_offset + point_count * sizeof(VecXYZ);
+    return header;
+}
+
+std::uint64_t file_size(const KdTreeFileHeader &header) {
+    return header.indices_offset +
+           header.point_count * sizeof(std::uint32_t);
+}
+} // namespace
+
+void save_kdtree(const std::string &path, const KdTree &tree) {
+    KdTreeFileHeader header = layout(tree.size(), tree.nodes().size());
+    header.data_crc = tree.data_checksum();
+    std::uint32_t crc = crc32c(0, tree.nodes().data(),
+                               tree.nodes().size() * sizeof(KdNode));
+    crc = crc32c(crc, tree.points().data(), tree.size() * sizeof(VecXYZ));
+    crc = crc32c(crc, tree.indices().data(),
+                 tree.size() * sizeof(std::uint32_t));
+    header.body_crc = crc;
+    header.header_crc = header_checksum(header);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw KdTreeError(fmt::format("{}: cannot open for writing", path));
+    }
+    const auto write = [&](const void *data, std::size_t size) {
+        out.write(static_cast<const char *>(data),
+                  static_cast<std::streamsize>(size));
+    };
+    write(&header, sizeof(header));
+    write(tree.nodes().data(), tree.nodes().size() * sizeof(KdNode));
+    write(tree.points().data(), tree.size() * sizeof(VecXYZ));
+    write(tree.indices().data(), tree.size() * sizeof(std::uint32_t));
+    out.flush();
+    if (!out) {
+        throw KdTreeError(fmt::format("{}: write failed", path));
+    }
+}
+
+MappedKdTree::MappedKdTree(const std::string &path, std::uint32_t data_crc,
+                           bool verify_body) {
+    namespace bip = boost::interprocess;
+    try {
+        file_ = bip::file_mapping(path.c_str(), bip::read_only);
+        region_ = bip::mapped_region(file_, bip::read_only);
+    } catch (const bip::interprocess_exception &e) {
+        throw KdTreeError(fmt::format("{}: {}", path, e.what()));
+    }
+
+    const auto *bytes = static_cast<const char *>(region_.get_address());
+    const std::size_t size = region_.get_size();
+    KdTreeFileHeader header{};
+    if (size < sizeof(header)) {
+        throw KdTreeError(fmt::format("{}: not a k-d tree file", path));
+    }
+    std::memcpy(&header, bytes, sizeof(header));
+    if (std::memcmp(header.magic, kdtree_file_magic, sizeof(header.magic)) !=
+        0) {
+        throw KdTreeError(fmt::format("{}: not a k-d tree file", path));
+    }
+    if (header.header_crc != header_checksum(header)) {
+        throw KdTreeError(fmt::format("{}: header checksum mismatch", path));
+    }
+    if (header.version != kdtree_file_version) {
+        throw KdTreeError(fmt::format("{}: unsupported version {}", path,
+                                      header.version));
+    }
+    // Sizes bounded by the file first, so the layout arithmetic below
+    // cannot overflow.
+    const KdTreeFileHeader expected =
+        header.point_count <= size && header.node_count <= size
+            ? layout(header.point_count, header.node_count)
+            : KdTreeFileHeader{};
+    if (expected.nodes_offset == 0 ||
+        header.nodes_offset != expected.nodes_offset ||
+        header.points_offset != expected.points_offset ||
+        header.indices_offset != expected.indices_offset ||
+        file_size(header) != size) {
+        throw KdTreeError(fmt::format("{}: corrupt layout", path));
+    }
+    if (header.data_crc != data_crc) {
+        throw KdTreeError(fmt::format(
+            "{}: index was built from other data (crc {:08x}, expected "
+            "{:08x})",
+            path, header.data_crc, data_crc));
+    }
+
+    view_ = KdTreeView(
+        reinterpret_cast<const KdNode *>(bytes + header.nodes_offset),
+        header.node_count,
+        reinterpret_cast<const VecXYZ *>(bytes + header.points_offset),
+        reinterpret_cast<const std::uint32_t *>(bytes +
+                                                header.indices_offset),
+        header.point_count);
+    if (verify_body && header.body_crc != crc32c(0, bytes + sizeof(header),
+                                                 size - sizeof(header))) {
+        throw KdTreeError(fmt::format("{}: body checksum mismatch", path));
+    }
+    // The queries trust node links and depth, so the shape is checked even
+    // when the checksum is skipped.
+    try {
+        view_.check(header.point_count);
+    } catch (const KdTreeError &e) {
+        throw KdTreeError(fmt::format("{}: {}", path, e.what()));
+    }
+}
+
+} // namespace vecxyz
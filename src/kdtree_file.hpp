@@ -0,0 +1,62 @@
+#pragma once
+
+#include "kdtree.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
+#include <string>
+
+namespace vecxyz {
+
+// Position-independent k-d tree file, queried in place once mapped:
+//
+//   [KdTreeFileHeader][KdNode x node_count][VecXYZ x point_count]
+//   [uint32 input index x point_count]
+//
+// data_crc is points_checksum() of the points the tree was built from, so
+// a loader can refuse an index that belongs to other data. All integers
+// and floats are little-endian.
+constexpr char kdtree_file_magic[8] = {'V', 'X', 'Y', 'Z', 'K', 'D', 'T', '1'};
+constexpr std::uint32_t kdtree_file_version = 1;
+
+struct KdTreeFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t data_crc;
+    std::uint64_t point_count;
+    std::uint64_t node_count;
+    std::uint64_t nodes_offset;
+    std::uint64_t points_offset;
+    std::uint64_t indices_offset;
+    std::uint32_t body_crc;
+    std::uint32_t header_crc; // CRC32C of every byte before this field
+};
+static_assert(sizeof(KdTreeFileHeader) == 64, "header layout is on disk");
+
+void save_kdtree(const std::string &path, const KdTree &tree);
+
+// Maps a saved tree read-only. Throws KdTreeError when the file is corrupt
+// or its data_crc differs from `data_crc`. The tree shape is always
+// checked, an O(n) scan of the nodes and indices but no rebuild; with
+// verify_body the arrays are checksummed as well, which also reads every
+// point.
+class MappedKdTree {
+  public:
+    MappedKdTree(const std::string &path, std::uint32_t data_crc,
+                 bool verify_body = true);
+
+    const KdTreeView &view() const { return view_; }
+    std::size_t size() const { return view_.size(); }
+
+    void knn(const VecXYZ *queries, std::size_t query_count, std::size_t k,
+             Neighbor *out) const {
+        view_.knn(queries, query_count, k, out);
+    }
+
+  private:
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    KdTreeView view_;
+};
+
+} // namespace vecxyz
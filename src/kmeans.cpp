@@ -0,0 +1,330 @@
+#include "kmeans.hpp"
+#include "aligned_allocator.hpp"
+#include "parallel.hpp"
+#include "simd_transpose.hpp"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#ifdef VECXYZ_HAS_SSE
+#include <emmintrin.h>
+#endif
+
+namespace vecxyz {
+namespace {
+// Fixed partitioning of the input: the partials and their merge order do
+// not depend on the thread count, which keeps results reproducible.
+constexpr std::size_t partitions = 64;
+
+// splitmix64: tiny, fast and identical on every platform, unlike the
+// std:: distributions.
+class Random {
+  public:
+    explicit Random(std::uint64_t seed) : state_(seed) {}
+
+    std::uint64_t next() {
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27U)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31U);
+    }
+    // Uniform in [0, bound).
+    std::uint64_t below(std::uint64_t bound) { return next() % bound; }
+    // Uniform in [0, 1).
+    double unit() { return static_cast<double>(next() >> 11U) * 0x1.0p-53; }
+
+  private:
+    std::uint64_t state_;
+};
+
+// Centroids as columns, padded to a multiple of four with far-away
+// entries so the SIMD loop needs no tail.
+class CentroidColumns {
+  public:
+    explicit CentroidColumns(const std::vector<VecXYZ> &centroids)
+        : k_(centroids.size()) {
+        const std::size_t padded = (k_ + 3) / 4 * 4;
+        const float far = std::numeric_limits<float>::max();
+        x_.assign(padded, far);
+        y_.assign(padded, far);
+        z_.assign(padded, far);
+        for (std::size_t c = 0; c < k_; ++c) {
+            x_[c] = centroids[c].x;
+            y_[c] = centroids[c].y;
+            z_[c] = centroids[c].z;
+        }
+    }
+
+    // Index of the nearest centroid (lowest index on ties) and its squared
+    // distance.
+    std::uint32_t nearest(const VecXYZ &p, float &distance) const {
+        std::uint32_t best = 0;
+        float best_d = std::numeric_limits<float>::infinity();
+        std::size_t c = 0;
+#ifdef VECXYZ_HAS_SSE
+        const __m128 px = _mm_set1_ps(p.x);
+        const __m128 py = _mm_set1_ps(p.y);
+        const __m128 pz = _mm_set1_ps(p.z);
+        __m128 lane_d = _mm_set1_ps(best_d);
+        // Indices stay in integer lanes: floats are exact only to 2^24.
+        __m128i lane_i = _mm_setzero_si128();
+        __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+        const __m128i step = _mm_set1_epi32(4);
+        for (; c < x_.size(); c += 4) {
+            const __m128 dx = _mm_sub_ps(_mm_load_ps(x_.data() + c), px);
+            const __m128 dy = _mm_sub_ps(_mm_load_ps(y_.data() + c), py);
+            const __m128 dz = _mm_sub_ps(_mm_load_ps(z_.data() + c), pz);
+            const __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                _mm_mul_ps(dz, dz));
+            const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, lane_d));
+            lane_d = _mm_min_ps(d, lane_d);
+            lane_i = _mm_or_si128(_mm_and_si128(closer, index),
+                                  _mm_andnot_si128(closer, lane_i));
+            index = _mm_add_epi32(index, step);
+        }
+        alignas(16) float ds[4];
+        alignas(16) std::uint32_t is[4];
+        _mm_store_ps(ds, lane_d);
+        _mm_store_si128(reinterpret_cast<__m128i *>(is), lane_i);
+        for (int lane = 0; lane < 4; ++lane) {
+            const std::uint32_t i = is[lane];
+            if (ds[lane] < best_d || (ds[lane] == best_d && i < best)) {
+                best_d = ds[lane];
+                best = i;
+            }
+        }
+#else
+        for (; c < k_; ++c) {
+            const float dx = x_[c] - p.x;
+            const float dy = y_[c] - p.y;
+            const float dz = z_[c] - p.z;
+            const float d = dx * dx + dy * dy + dz * dz;
+            if (d < best_d) {
+                best_d = d;
+                best = static_cast<std::uint32_t>(c);
+            }
+        }
+#endif
+        distance = best_d;
+        return best;
+    }
+
+  private:
+    using Column = std::vector<float, AlignedAllocator<float, 16>>;
+    std::size_t k_;
+    Column x_;
+    Column y_;
+    Column z_;
+};
+
+float squared_distance(const VecXYZ &a, const VecXYZ &b) {
+    const float dx = a.x - b.x;
+    const float dy = a.y - b.y;
+    const float dz = a.z - b.z;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+// Runs fn(partition, begin, end) over the fixed partitions of [0, count).
+template <class Fn> void for_partitions(std::size_t count, const Fn &fn) {
+    parallel_for(partitions, 1, [&](std::size_t first, std::size_t last) {
+        for (std::size_t p = first; p < last; ++p) {
+            fn(p, p * count / partitions, (p + 1) * count / partitions);
+        }
+    });
+}
+
+std::vector<VecXYZ> seed_plus_plus(const VecXYZ *points, std::size_t count,
+                                   const KMeansOptions &options,
+                                   Random &random) {
+    std::vector<VecXYZ> sample;
+    if (count > options.init_sample_size) {
+        sample.reserve(options.init_sample_size);
+        for (std::size_t i = 0; i < options.init_sample_size; ++i) {
+            sample.push_back(points[random.below(count)]);
+        }
+        points = sample.data();
+        count = sample.size();
+    }
+
+    std::vector<VecXYZ> centroids;
+    centroids.reserve(options.k);
+    centroids.push_back(points[random.below(count)]);
+    std::vector<float> d2(count, std::numeric_limits<float>::infinity());
+    std::vector<double> partial(partitions);
+
+    while (centroids.size() < options.k) {
+        const VecXYZ latest = centroids.back();
+        for_partitions(count, [&](std::size_t p, std::size_t b,
+                                  std::size_t e) {
+            double sum = 0;
+            for (std::size_t i = b; i < e; ++i) {
+                d2[i] = std::min(d2[i], squared_distance(points[i], latest));
+                sum += d2[i];
+            }
+            partial[p] = sum;
+        });
+
+        double total = 0;
+        for (double s : partial) {
+            total += s;
+        }
+        if (!(total > 0)) {
+            // Fewer distinct points than k; repeat one.
+            centroids.push_back(points[random.below(count)]);
+            continue;
+        }
+
+        // D^2 sampling: find the partition first, then the point.
+        double target = random.unit() * total;
+        std::size_t p = 0;
+        while (p + 1 < partitions && target >= partial[p]) {
+            target -= partial[p++];
+        }
+        std::size_t i = p * count / partitions;
+        const std::size_t end = (p + 1) * count / partitions;
+        while (i + 1 < end && target >= d2[i]) {
+            target -= d2[i++];
+        }
+        centroids.push_back(points[i]);
+    }
+    return centroids;
+}
+
+struct Accumulator {
+    std::vector<double> sum; // x, y, z per centroid
+    std::vector<std::uint64_t> count;
+    double inertia{};
+
+    explicit Accumulator(std::size_t k) : sum(3 * k), count(k) {}
+};
+
+// One Lloyd step; returns the largest squared centroid move.
+float lloyd_step(const VecXYZ *points, std::size_t count,
+                 std::vector<VecXYZ> &centroids) {
+    const std::size_t k = centroids.size();
+    const CentroidColumns columns(centroids);
+    std::vector<Accumulator> partial(partitions, Accumulator(k));
+    for_partitions(count, [&](std::size_t p, std::size_t b, std::size_t e) {
+        Accumulator &acc = partial[p];
+        for (std::size_t i = b; i < e; ++i) {
+            float d = 0;
+            const std::uint32_t c = columns.nearest(points[i], d);
+            acc.sum[3 * c] += points[i].x;
+            acc.sum[3 * c + 1] += points[i].y;
+            acc.sum[3 * c + 2] += points[i].z;
+            ++acc.count[c];
+        }
+    });
+
+    float shift = 0;
+    for (std::size_t c = 0; c < k; ++c) {
+        double s[3] = {};
+        std::uint64_t n = 0;
+        for (const auto &acc : partial) {
+            s[0] += acc.sum[3 * c];
+            s[1] += acc.sum[3 * c + 1];
+            s[2] += acc.sum[3 * c + 2];
+            n += acc.count[c];
+        }
+        if (n == 0) {
+            continue; // an empty cluster keeps its centroid
+        }
+        const auto dn = static_cast<double>(n);
+        const VecXYZ moved{static_cast<float>(s[0] / dn),
+                           static_cast<float>(s[1] / dn),
+                           static_cast<float>(s[2] / dn)};
+        shift = std::max(shift, squared_distance(moved, centroids[c]));
+        centroids[c] = moved;
+    }
+    return shift;
+}
+
+// One mini-batch step with per-centroid learning rates 1 / count.
+float mini_batch_step(const VecXYZ *points, std::size_t count,
+                      std::size_t batch_size, std::vector<VecXYZ> &centroids,
+                      std::vector<std::uint64_t> &seen, Random &random) {
+    std::vector<std::uint64_t> batch(batch_size);
+    for (auto &index : batch) {
+        index = random.below(count);
+    }
+    const CentroidColumns columns(centroids);
+    std::vector<std::uint32_t> nearest(batch_size);
+    for_partitions(batch_size,
+                   [&](std::size_t, std::size_t b, std::size_t e) {
+                       for (std::size_t i = b; i < e; ++i) {
+                           float d = 0;
+                           nearest[i] = columns.nearest(points[batch[i]], d);
+                       }
+                   });
+
+    const std::vector<VecXYZ> before = centroids;
+    for (std::size_t i = 0; i < batch_size; ++i) {
+        const std::uint32_t c = nearest[i];
+        const float eta = 1.0F / static_cast<float>(++seen[c]);
+        const VecXYZ &p = points[batch[i]];
+        VecXYZ &m = centroids[c];
+        m = {m.x + eta * (p.x - m.x), m.y + eta * (p.y - m.y),
+             m.z + eta * (p.z - m.z)};
+    }
+
+    float shift = 0;
+    for (std::size_t c = 0; c < centroids.size(); ++c) {
+        shift = std::max(shift, squared_distance(before[c], centroids[c]));
+    }
+    return shift;
+}
+} // namespace
+
+KMeansResult kmeans(const VecXYZ *points, std::size_t count,
+                    const KMeansOptions &options) {
+    if (options.k == 0 || options.k > count) {
+        throw std::invalid_argument("kmeans needs 0 < k <= point count");
+    }
+    if (options.k > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::invalid_argument("kmeans supports at most 2^32 - 1 "
+                                    "clusters");
+    }
+
+    Random random(options.seed);
+    KMeansResult result;
+    result.centroids = seed_plus_plus(points, count, options, random);
+
+    const float tolerance2 = options.tolerance * options.tolerance;
+    std::vector<std::uint64_t> seen(options.k);
+    while (result.iterations < options.max_iterations) {
+        ++result.iterations;
+        const float shift =
+            options.batch_size == 0
+                ? lloyd_step(points, count, result.centroids)
+                : mini_batch_step(points, count, options.batch_size,
+                                  result.centroids, seen, random);
+        if (shift <= tolerance2) {
+            break;
+        }
+    }
+
+    const CentroidColumns columns(result.centroids);
+    if (options.compute_labels) {
+        result.labels.resize(count);
+    }
+    std::vector<double> inertia(partitions);
+    for_partitions(count, [&](std::size_t p, std::size_t b, std::size_t e) {
+        double sum = 0;
+        for (std::size_t i = b; i < e; ++i) {
+            float d = 0;
+            const std::uint32_t c = columns.nearest(points[i], d);
+            if (options.compute_labels) {
+                result.labels[i] = c;
+            }
+            sum += d;
+        }
+        inertia[p] = sum;
+    });
+    for (double s : inertia) {
+        result.inertia += s;
+    }
+    return result;
+}
+
+} // namespace vecxyz
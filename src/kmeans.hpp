@@ -0,0 +1,48 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vecxyz {
+
+struct KMeansOptions {
+    std::size_t k = 8;
+    std::size_t max_iterations = 100;
+    // Stop once no centroid moves further than this between iterations.
+    float tolerance = 1e-4F;
+    // Same seed and input give the same clustering on any thread count.
+    std::uint64_t seed = 1;
+    // 0 runs full Lloyd iterations. Otherwise each iteration updates the
+    // centroids from this many sampled points (Sculley's mini-batch
+    // k-means), which scales to inputs that are too big to sweep often.
+    std::size_t batch_size = 0;
+    // k-means++ seeding looks at no more than this many sampled points.
+    std::size_t init_sample_size = std::size_t{1} << 20U;
+    bool compute_labels = true;
+};
+
+struct KMeansResult {
+    std::vector<VecXYZ> centroids;
+    // Index of the nearest centroid per point, if requested.
+    std::vector<std::uint32_t> labels;
+    // Sum of squared distances from each point to its centroid.
+    double inertia{};
+    std::size_t iterations{};
+};
+
+// k-means++ seeding followed by Lloyd or mini-batch iterations. Distances
+// are computed four centroids at a time with SSE, and each fixed partition
+// of the input accumulates into its own centroid sums, which are merged in
+// partition order. Throws std::invalid_argument when k is 0 or exceeds the
+// number of points.
+KMeansResult kmeans(const VecXYZ *points, std::size_t count,
+                    const KMeansOptions &options = {});
+
+inline KMeansResult kmeans(const std::vector<VecXYZ> &points,
+                           const KMeansOptions &options = {}) {
+    return kmeans(points.data(), points.size(), options);
+}
+
+} // namespace vecxyz
@@ -0,0 +1,131 @@
+#include "knn.hpp"
+#include "parallel.hpp"
+#include "simd_transpose.hpp"
+#include <stdexcept>
+
+namespace vecxyz {
+namespace {
+// References per tile: 12 KiB of columns, comfortably inside L1.
+constexpr std::size_t tile_points = 1024;
+// Queries per task; their TopK state stays hot across the tiles.
+constexpr std::size_t query_block = 64;
+// Below this many distance evaluations a batch runs on the calling thread.
+constexpr std::size_t parallel_work = std::size_t{1} << 22U;
+} // namespace
+
+BruteForceKnn::BruteForceKnn(const VecXYZ *points, std::size_t count)
+    : count_(count) {
+    if (count > no_neighbor) {
+        throw std::length_error("BruteForceKnn supports at most 2^32 - 1 "
+                                "points");
+    }
+    // Padding sits at +max so its distances overflow to +inf and never win.
+    const std::size_t padded = (count + 3) / 4 * 4;
+    const float far = std::numeric_limits<float>::max();
+    x_.assign(padded, far);
+    y_.assign(padded, far);
+    z_.assign(padded, far);
+    for (std::size_t i = 0; i < count; ++i) {
+        x_[i] = points[i].x;
+        y_[i] = points[i].y;
+        z_[i] = points[i].z;
+    }
+}
+
+void BruteForceKnn::knn(const VecXYZ *queries, std::size_t query_count,
+                        std::size_t k, Neighbor *out) const {
+    if (k == 0 || query_count == 0) {
+        return;
+    }
+    if (query_count * count_ < parallel_work) {
+        knn_block(queries, query_count, k, out);
+        return;
+    }
+    parallel_for(query_count, query_block,
+                 [&](std::size_t begin, std::size_t end) {
+                     for (std::size_t q = begin; q < end; q += query_block) {
+                         const std::size_t n =
+                             std::min(query_block, end - q);
+                         knn_block(queries + q, n, k, out + q * k);
+                     }
+                 });
+}
+
+void BruteForceKnn::knn_block(const VecXYZ *queries, std::size_t query_count,
+                              std::size_t k, Neighbor *out) const {
+    thread_local std::vector<detail::TopK> scratch;
+    // A plain reference keeps the thread_local lookup out of the loops.
+    std::vector<detail::TopK> &best = scratch;
+    if (best.size() < query_count) {
+        best.resize(query_count);
+    }
+    for (std::size_t q = 0; q < query_count; ++q) {
+        best[q].reset(k);
+    }
+
+    const std::size_t padded = x_.size();
+    for (std::size_t tile = 0; tile < padded; tile += tile_points) {
+        const std::size_t tile_end = std::min(padded, tile + tile_points);
+#ifdef VECXYZ_HAS_SSE
+        for (std::size_t q0 = 0; q0 < query_count; q0 += 4) {
+            // Register block of 4 queries x 4 references.
+            const std::size_t lanes =
+                std::min<std::size_t>(4, query_count - q0);
+            __m128 qx[4];
+            __m128 qy[4];
+            __m128 qz[4];
+            for (std::size_t j = 0; j < lanes; ++j) {
+                const VecXYZ &p = queries[q0 + j];
+                qx[j] = _mm_set1_ps(p.x);
+                qy[j] = _mm_set1_ps(p.y);
+                qz[j] = _mm_set1_ps(p.z);
+            }
+            for (std::size_t r = tile; r < tile_end; r += 4) {
+                const __m128 rx = _mm_load_ps(x_.data() + r);
+                const __m128 ry = _mm_load_ps(y_.data() + r);
+                const __m128 rz = _mm_load_ps(z_.data() + r);
+                for (std::size_t j = 0; j < lanes; ++j) {
+                    const __m128 dx = _mm_sub_ps(rx, qx[j]);
+                    const __m128 dy = _mm_sub_ps(ry, qy[j]);
+                    const __m128 dz = _mm_sub_ps(rz, qz[j]);
+                    const __m128 d = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                        _mm_mul_ps(dz, dz));
+                    detail::TopK &top = best[q0 + j];
+                    const __m128 bound =
+                        _mm_set1_ps(top.bound().squared_distance);
+                    const int mask = _mm_movemask_ps(_mm_cmple_ps(d, bound));
+                    if (mask == 0) {
+                        continue;
+                    }
+                    alignas(16) float ds[4];
+                    _mm_store_ps(ds, d);
+                    for (std::size_t lane = 0; lane < 4; ++lane) {
+                        if ((mask >> lane & 1) != 0 && r + lane < count_) {
+                            top.offer(static_cast<std::uint32_t>(r + lane),
+                                      ds[lane]);
+                        }
+                    }
+                }
+            }
+        }
+#else
+        for (std::size_t q = 0; q < query_count; ++q) {
+            const VecXYZ &p = queries[q];
+            for (std::size_t r = tile; r < std::min(tile_end, count_); ++r) {
+                const float dx = x_[r] - p.x;
+                const float dy = y_[r] - p.y;
+                const float dz = z_[r] - p.z;
+                best[q].offer(static_cast<std::uint32_t>(r),
+                              dx * dx + dy * dy + dz * dz);
+            }
+        }
+#endif
+    }
+
+    for (std::size_t q = 0; q < query_count; ++q) {
+        best[q].finish(out + q * k);
+    }
+}
+
+} // namespace vecxyz
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include "vecxyz.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace vecxyz {
+
+// Index marking the padding of results when fewer than k points exist.
+constexpr std::uint32_t no_neighbor = std::numeric_limits<std::uint32_t>::max();
+
+struct Neighbor {
+    std::uint32_t index;
+    float squared_distance;
+};
+
+// Nearest first; equal distances go to the lower index, so every search
+// method returns the same neighbors.
+inline bool operator<(const Neighbor &a, const Neighbor &b) {
+    return a.squared_distance < b.squared_distance ||
+           (a.squared_distance == b.squared_distance && a.index < b.index);
+}
+
+namespace detail {
+// The k best candidates seen so far. For small k they are kept sorted by
+// insertion, which tightens the bound after every accepted candidate. For
+// larger k candidates collect unsorted; at 2k they are cut back to k with
+// nth_element, and only the final k are sorted.
+class TopK {
+  public:
+    static constexpr std::size_t insertion_limit = 32;
+
+    void reset(std::size_t k) {
+        k_ = k;
+        items_.clear();
+        items_.reserve(2 * k);
+        bound_ = {no_neighbor, std::numeric_limits<float>::infinity()};
+    }
+
+    // Every candidate better than this may still be kept.
+    const Neighbor &bound() const { return bound_; }
+
+    void offer(std::uint32_t index, float squared_distance) {
+        const Neighbor n{index, squared_distance};
+        if (!(n < bound_)) {
+            return;
+        }
+        if (k_ <= insertion_limit) {
+            if (items_.size() == k_) {
+                items_.pop_back();
+            }
+            items_.insert(std::upper_bound(items_.begin(), items_.end(), n),
+                          n);
+            if (items_.size() == k_) {
+                bound_ = items_.back();
+            }
+            return;
+        }
+        items_.push_back(n);
+        if (items_.size() == 2 * k_) {
+            std::nth_element(items_.begin(), items_.begin() + (k_ - 1),
+                             items_.end());
+            items_.resize(k_);
+            bound_ = items_.back();
+        } else if (items_.size() == k_ && bound_.index == no_neighbor) {
+            bound_ = *std::max_element(items_.begin(), items_.end());
+        }
+    }
+
+    // Writes the k results nearest first, padded with no_neighbor.
+    void finish(Neighbor *out) {
+        const std::size_t n = std::min(k_, items_.size());
+        std::partial_sort(items_.begin(), items_.begin() + n, items_.end());
+        std::copy_n(items_.begin(), n, out);
+        const Neighbor none{no_neighbor,
+                            std::numeric_limits<float>::infinity()};
+        std::fill(out + n, out + k_, none);
+    }
+
+  private:
+    std::size_t k_{};
+    std::vector<Neighbor> items_;
+    Neighbor bound_{};
+};
+} // namespace detail
+
+// Exhaustive k-nearest-neighbor search, the fastest option for small
+// reference sets. References are kept as padded columns; queries are
+// matched four at a time against four references per SSE step, tile by
+// tile, so each reference tile stays in L1 while every query visits it.
+class BruteForceKnn {
+  public:
+    BruteForceKnn() = default;
+    BruteForceKnn(const VecXYZ *points, std::size_t count);
+
+    std::size_t size() const { return count_; }
+
+    // Writes k neighbors per query into out[q * k, (q + 1) * k), nearest
+    // first. Large batches are split across the worker threads.
+    void knn(const VecXYZ *queries, std::size_t query_count, std::size_t k,
+             Neighbor *out) const;
+
+  private:
+    void knn_block(const VecXYZ *queries, std::size_t query_count,
+                   std::size_t k, Neighbor *out) const;
+
+    using Column = std::vector<float, AlignedAllocator<float, 64>>;
+    std::size_t count_{};
+    Column x_;
+    Column y_;
+    Column z_;
+};
+
+inline void knn_brute_force(const VecXYZ *points, std::size_t count,
+                            const VecXYZ *queries, std::size_t query_count,
+                            std::size_t k, Neighbor *out) {
+    BruteForceKnn(points, count).knn(queries, query_count, k, out);
+}
+
+} // namespace vecxyz
@@ -1,21 +1,11 @@
+#include "memory_archive.hpp"
+#include "vecxyz.hpp"
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <fmt/core.h>
 #include <fstream>
 
-namespace {
-struct VecXYZ {
-    float x{}, y{}, z{};
-    friend class boost::serialization::access;
-
-    template <class Archive>
-    void serialize(Archive &ar, const unsigned int version) {
-        ar & x;
-        ar & y;
-        ar & z;
-    }
-};
-} // namespace
+using vecxyz::VecXYZ;
 
 int main() {
     fmt::print("Hello, world!\n");
@@ -32,5 +22,11 @@ int main() {
     fmt::print("v2.x = {}\n", v2.x);
     fmt::print("v2.y = {}\n", v2.y);
     fmt::print("v2.z = {}\n", v2.z);
+
+    std::vector<char> bytes;
+    vecxyz::save_to_vector(v1, bytes);
+    VecXYZ v3;
+    vecxyz::load_from_view(bytes, v3);
+    fmt::print("in-memory archive: {} bytes, v3.z = {}\n", bytes.size(), v3.z);
     return 0;
 }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "memory_streambuf.hpp"
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace vecxyz {
+
+// Archive round trips through memory instead of a temporary file. Any Boost
+// archive works; binary archives are the default because they copy floats
+// as bytes.
+
+// Appends the archive holding `value` to `out`.
+template <class Archive = boost::archive::binary_oarchive, class T>
+void save_to_vector(const T &value, std::vector<char> &out,
+                    unsigned flags = 0) {
+    VectorStreambuf buffer(out);
+    {
+        std::ostream stream(&buffer);
+        Archive archive(stream, flags);
+        archive << value;
+    }
+    buffer.finish();
+}
+
+// Writes the archive into [data, data + capacity) and returns its size.
+// Throws boost::archive::archive_exception when it does not fit.
+template <class Archive = boost::archive::binary_oarchive, class T>
+std::size_t save_to_buffer(const T &value, char *data, std::size_t capacity,
+                           unsigned flags = 0) {
+    FixedBufferStreambuf buffer(data, capacity);
+    std::ostream stream(&buffer);
+    {
+        Archive archive(stream, flags);
+        archive << value;
+    }
+    return buffer.written();
+}
+
+// Loads `value` from the bytes in `bytes` without copying them. Returns the
+// number of bytes the archive used.
+template <class Archive = boost::archive::binary_iarchive, class T>
+std::size_t load_from_view(ByteView bytes, T &value, unsigned flags = 0) {
+    ViewStreambuf buffer(bytes);
+    std::istream stream(&buffer);
+    {
+        Archive archive(stream, flags);
+        archive >> value;
+    }
+    return buffer.consumed();
+}
+
+} // namespace vecxyz
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+// Read-only view of contiguous bytes.
+struct ByteView {
+    const char *data{};
+    std::size_t size{};
+
+    ByteView() = default;
+    ByteView(const char *data, std::size_t size) : data(data), size(size) {}
+    ByteView(const std::vector<char> &bytes)
+        : data(bytes.data()), size(bytes.size()) {}
+    ByteView(const std::string &bytes)
+        : data(bytes.data()), size(bytes.size()) {}
+};
+
+// Output streambuf over a caller-owned buffer. The whole buffer is the put
+// area, so writes are plain copies; a write past the end fails the stream.
+class FixedBufferStreambuf : public std::streambuf {
+  public:
+    FixedBufferStreambuf() = default;
+    FixedBufferStreambuf(char *data, std::size_t size) { reset(data, size); }
+
+    void reset(char *data, std::size_t size) { setp(data, data + size); }
+    std::size_t written() const {
+        return static_cast<std::size_t>(pptr() - pbase());
+    }
+};
+
+// Input streambuf reading straight out of a caller-owned buffer.
+class ViewStreambuf : public std::streambuf {
+  public:
+    ViewStreambuf() = default;
+    ViewStreambuf(const char *data, std::size_t size) { reset(data, size); }
+    explicit ViewStreambuf(ByteView bytes) { reset(bytes.data, bytes.size); }
+
+    void reset(const char *data, std::size_t size) {
+        // The get area is never written through; std::streambuf just has no
+        // const flavour.
+        char *begin = const_cast<char *>(data);
+        setg(begin, begin, begin + size);
+    }
+    std::size_t consumed() const {
+        return static_cast<std::size_t>(gptr() - eback());
+    }
+};
+
+// Output streambuf appending to a std::vector<char>. The vector's slack is
+// the put area, so a write is a copy unless the vector has to grow; the
+// vector is trimmed to the bytes written by finish() or the destructor.
+class VectorStreambuf : public std::streambuf {
+  public:
+    explicit VectorStreambuf(std::vector<char> &out) : out_(out) {
+        grow(0);
+    }
+    VectorStreambuf(const VectorStreambuf &) = delete;
+    VectorStreambuf &operator=(const VectorStreambuf &) = delete;
+    ~VectorStreambuf() override { finish(); }
+
+    // Trims the vector to what was written; the buffer stays usable.
+    void finish() {
+        out_.resize(used());
+        setp(out_.data() + out_.size(), out_.data() + out_.size());
+    }
+
+  protected:
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) {
+            return traits_type::not_eof(ch);
+        }
+        grow(1);
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        return ch;
+    }
+
+    std::streamsize xsputn(const char *data, std::streamsize count) override {
+        const auto bytes = static_cast<std::size_t>(count);
+        if (static_cast<std::size_t>(epptr() - pptr()) < bytes) {
+            grow(bytes);
+        }
+        std::memcpy(pptr(), data, bytes);
+        // setp instead of pbump, which takes an int.
+        setp(pptr() + bytes, epptr());
+        return count;
+    }
+
+  private:
+    std::size_t used() const {
+        return static_cast<std::size_t>(pptr() - out_.data());
+    }
+
+    // Makes room for `extra` more bytes, growing by at least half.
+    void grow(std::size_t extra) {
+        const std::size_t written = pbase() == nullptr ? out_.size() : used();
+        out_.resize(std::max({out_.capacity(), written + extra,
+                              written + written / 2, written + 256}));
+        setp(out_.data() + written, out_.data() + out_.size());
+    }
+
+    std::vector<char> &out_;
+};
+
+} // namespace vecxyz
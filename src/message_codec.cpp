@@ -0,0 +1,54 @@
+#include "message_codec.hpp"
+#include <boost/archive/archive_exception.hpp>
+#include <boost/serialization/serialization.hpp>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+namespace vecxyz {
+namespace {
+constexpr unsigned archive_flags =
+    boost::archive::no_header | boost::archive::no_codecvt;
+} // namespace
+
+MessageEncoder::MessageEncoder(unsigned version)
+    : archive_(buffer_, archive_flags), version_(version) {}
+
+std::size_t MessageEncoder::encode(const VecXYZ *points, std::size_t count,
+                                   char *buffer, std::size_t capacity) {
+    if (count > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::length_error("message count exceeds its 32-bit field");
+    }
+    buffer_.reset(buffer, capacity);
+    const auto count32 = static_cast<std::uint32_t>(count);
+    archive_ << count32;
+    for (std::size_t i = 0; i < count; ++i) {
+        // Going through serialize_adl skips the class and tracking
+        // information operator<< would write the first time it sees VecXYZ.
+        boost::serialization::serialize_adl(
+            archive_, const_cast<VecXYZ &>(points[i]), version_);
+    }
+    return buffer_.written();
+}
+
+MessageDecoder::MessageDecoder(unsigned version)
+    : archive_(buffer_, archive_flags), version_(version) {}
+
+std::size_t MessageDecoder::decode(const char *data, std::size_t size,
+                                   std::vector<VecXYZ> &out) {
+    buffer_.reset(data, size);
+    std::uint32_t count = 0;
+    archive_ >> count;
+    // Every point takes its three packed floats.
+    if (count > (size - buffer_.consumed()) / sizeof(VecXYZ)) {
+        throw boost::archive::archive_exception(
+            boost::archive::archive_exception::input_stream_error);
+    }
+    out.resize(count);
+    for (auto &point : out) {
+        boost::serialization::serialize_adl(archive_, point, version_);
+    }
+    return buffer_.consumed();
+}
+
+} // namespace vecxyz
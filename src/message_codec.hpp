@@ -0,0 +1,67 @@
+#pragma once
+
+#include "memory_streambuf.hpp"
+#include "vecxyz.hpp"
+#include <algorithm>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace vecxyz {
+
+// Newest VecXYZ class version this build can encode. Peers agree on
+// min(ours, theirs) once per connection and pass it to the codecs.
+constexpr unsigned latest_message_version = 0;
+
+inline unsigned negotiate_message_version(unsigned peer_version) {
+    return std::min(peer_version, latest_message_version);
+}
+
+// Encodes VecXYZ messages with one binary archive built up front. The
+// archive has no header and the points bypass class tracking, so the
+// archive carries no state from one message to the next; each encode()
+// only repoints its streambuf at the caller's buffer.
+//
+// Message layout: std::uint32_t count, then `count` points.
+class MessageEncoder {
+  public:
+    explicit MessageEncoder(unsigned version = latest_message_version);
+
+    // Returns the bytes written to [buffer, buffer + capacity). Throws
+    // boost::archive::archive_exception when the message does not fit and
+    // std::length_error above 2^32 - 1 points.
+    std::size_t encode(const VecXYZ *points, std::size_t count, char *buffer,
+                       std::size_t capacity);
+    std::size_t encode(const std::vector<VecXYZ> &points, char *buffer,
+                       std::size_t capacity) {
+        return encode(points.data(), points.size(), buffer, capacity);
+    }
+
+    unsigned version() const { return version_; }
+
+  private:
+    FixedBufferStreambuf buffer_;
+    boost::archive::binary_oarchive archive_;
+    unsigned version_;
+};
+
+class MessageDecoder {
+  public:
+    explicit MessageDecoder(unsigned version = latest_message_version);
+
+    // Replaces `out` with the message at the front of [data, data + size)
+    // and returns the bytes it used. Throws boost::archive::archive_exception
+    // on truncated or malformed input.
+    std::size_t decode(const char *data, std::size_t size,
+                       std::vector<VecXYZ> &out);
+
+    unsigned version() const { return version_; }
+
+  private:
+    ViewStreambuf buffer_;
+    boost::archive::binary_iarchive archive_;
+    unsigned version_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+namespace vecxyz {
+
+// Bounded lock-free multi-producer multi-consumer queue (Dmitry Vyukov's
+// array queue). Every cell carries a sequence number telling which lap of
+// the ring it is ready for, so producers and consumers only contend on
+// their own position counter, each on its own cache line, and never on a
+// lock.
+//
+// The bulk calls claim a run of consecutive cells with a single CAS, which
+// is what lets a few consumers keep up with many producers: the shared
+// counter is touched once per batch instead of once per item. They move as
+// many items as are ready right now, possibly none, and never wait.
+template <class T> class MpmcQueue {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "items are copied in and out of shared cells");
+
+  public:
+    // Capacity is rounded up to a power of two, at least 2.
+    explicit MpmcQueue(std::size_t capacity) {
+        capacity_ = 2;
+        while (capacity_ < capacity) {
+            capacity_ *= 2;
+        }
+        mask_ = capacity_ - 1;
+        cells_.reset(new Cell[capacity_]);
+        for (std::size_t i = 0; i < capacity_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    std::size_t capacity() const { return capacity_; }
+    // A snapshot that may already be stale.
+    std::size_t size_approx() const {
+        const std::size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+        const std::size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        return tail > head ? std::min(tail - head, capacity_) : 0;
+    }
+
+    // False when the queue is full.
+    bool try_enqueue(const T &item) { return try_enqueue_bulk(&item, 1) != 0; }
+    // Enqueues a prefix of items[0, count) as one run; returns its length.
+    std::size_t try_enqueue_bulk(const T *items, std::size_t count) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            const std::size_t n = ready_run(pos, 0, count);
+            if (n == 0) {
+                if (lagging(pos, 0, enqueue_pos_)) {
+                    continue;
+                }
+                return 0;
+            }
+            if (enqueue_pos_.compare_exchange_weak(
+                    pos, pos + n, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    Cell &cell = cells_[(pos + i) & mask_];
+                    cell.value = items[i];
+                    cell.sequence.store(pos + i + 1,
+                                        std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    // False when the queue is empty.
+    bool try_dequeue(T &item) { return try_dequeue_bulk(&item, 1) != 0; }
+    // Dequeues up to max_count items in FIFO order; returns how many.
+    std::size_t try_dequeue_bulk(T *out, std::size_t max_count) {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            const std::size_t n = ready_run(pos, 1, max_count);
+            if (n == 0) {
+                if (lagging(pos, 1, dequeue_pos_)) {
+                    continue;
+                }
+                return 0;
+            }
+            if (dequeue_pos_.compare_exchange_weak(
+                    pos, pos + n, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    Cell &cell = cells_[(pos + i) & mask_];
+                    out[i] = cell.value;
+                    cell.sequence.store(pos + i + capacity_,
+                                        std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+  private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    // Length of the run of cells from `pos` whose sequence is `pos + lap`,
+    // i.e. free (lap 0) or filled (lap 1) for this position, up to `limit`.
+    std::size_t ready_run(std::size_t pos, std::size_t lap,
+                          std::size_t limit) const {
+        limit = std::min(limit, capacity_);
+        std::size_t n = 0;
+        while (n < limit && cells_[(pos + n) & mask_].sequence.load(
+                                std::memory_order_acquire) == pos + n + lap) {
+            ++n;
+        }
+        return n;
+    }
+
+    // Whether the first cell was not ready only because `pos` is behind
+    // the counter; reloads `pos` if so. Otherwise the queue is full or
+    // empty.
+    bool lagging(std::size_t &pos, std::size_t lap,
+                 const std::atomic<std::size_t> &counter) const {
+        const std::size_t sequence =
+            cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(sequence - (pos + lap)) > 0) {
+            pos = counter.load(std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t capacity_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    // The alignment also pads the object, keeping whatever follows it off
+    // the consumers' line.
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+};
+
+} // namespace vecxyz
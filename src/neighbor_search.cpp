@@ -0,0 +1,47 @@
+#include "neighbor_search.hpp"
+
+namespace vecxyz {
+
+NeighborSearch::NeighborSearch(const VecXYZ *points, std::size_t count,
+                               std::size_t brute_force_limit)
+    : use_tree_(count > brute_force_limit) {
+    if (use_tree_) {
+        tree_ = KdTree(points, count);
+    } else {
+        brute_force_ = BruteForceKnn(points, count);
+    }
+}
+
+void NeighborSearch::knn(const VecXYZ *queries, std::size_t query_count,
+                         std::size_t k, Neighbor *out) const {
+    if (use_tree_) {
+        tree_.knn(queries, query_count, k, out);
+    } else {
+        brute_force_.knn(queries, query_count, k, out);
+    }
+}
+
+std::vector<Neighbor> NeighborSearch::knn(const std::vector<VecXYZ> &queries,
+                                          std::size_t k) const {
+    std::vector<Neighbor> out(queries.size() * k);
+    knn(queries.data(), queries.size(), k, out.data());
+    return out;
+}
+
+void knn_search(const VecXYZ *points, std::size_t count,
+                const VecXYZ *queries, std::size_t query_count, std::size_t k,
+                Neighbor *out) {
+    // A build costs a few scans per tree level; compare against one scan
+    // per query.
+    std::size_t levels = 1;
+    for (std::size_t n = count; n > KdTree::leaf_points; n /= 2) {
+        ++levels;
+    }
+    if (count <= default_brute_force_limit || query_count <= 4 * levels) {
+        knn_brute_force(points, count, queries, query_count, k, out);
+    } else {
+        KdTree(points, count).knn(queries, query_count, k, out);
+    }
+}
+
+} // namespace vecxyz
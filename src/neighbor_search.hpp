@@ -0,0 +1,51 @@
+#pragma once
+
+#include "kdtree.hpp"
+#include "knn.hpp"
+#include "vecxyz.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace vecxyz {
+
+// Up to this many points an exhaustive scan beats building and walking a
+// tree.
+constexpr std::size_t default_brute_force_limit = 50000;
+
+// k-nearest-neighbor search that picks its backend from the size of the
+// point set: BruteForceKnn for small sets, a KdTree otherwise.
+class NeighborSearch {
+  public:
+    NeighborSearch() = default;
+    NeighborSearch(const VecXYZ *points, std::size_t count,
+                   std::size_t brute_force_limit = default_brute_force_limit);
+    explicit NeighborSearch(
+        const std::vector<VecXYZ> &points,
+        std::size_t brute_force_limit = default_brute_force_limit)
+        : NeighborSearch(points.data(), points.size(), brute_force_limit) {}
+
+    bool uses_tree() const { return use_tree_; }
+    std::size_t size() const {
+        return use_tree_ ? tree_.size() : brute_force_.size();
+    }
+
+    void knn(const VecXYZ *queries, std::size_t query_count, std::size_t k,
+             Neighbor *out) const;
+    // query_count * k results, nearest first per query.
+    std::vector<Neighbor> knn(const std::vector<VecXYZ> &queries,
+                              std::size_t k) const;
+
+  private:
+    bool use_tree_{};
+    BruteForceKnn brute_force_;
+    KdTree tree_;
+};
+
+// One-off search without keeping an index. Besides the size of the point
+// set, this counts the queries: a handful of them over a large set is
+// cheaper to scan than to build a tree for.
+void knn_search(const VecXYZ *points, std::size_t count,
+                const VecXYZ *queries, std::size_t query_count, std::size_t k,
+                Neighbor *out);
+
+} // namespace vecxyz
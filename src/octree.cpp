@@ -0,0 +1,358 @@
+#include "octree.hpp"
+#include "crc32c.hpp"
+#include "parallel.hpp"
+#include "point_stats.hpp"
+#include "radix_sort.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fmt/core.h>
+#include <fstream>
+#include <limits>
+
+namespace vecxyz {
+namespace {
+constexpr std::size_t parallel_grain = std::size_t{1} << 14U;
+constexpr std::size_t compact_block = std::size_t{1} << 16U;
+constexpr std::size_t rank_group = 8;
+
+std::uint32_t header_checksum(const OctreeHeader &header) {
+    return crc32c(0, &header, offsetof(OctreeHeader, header_crc));
+}
+
+std::size_t align8(std::size_t n) { return (n + 7) / 8 * 8; }
+
+// Spreads the low 21 bits of v to every third bit.
+std::uint64_t spread_bits(std::uint64_t v) {
+    v &= 0x1FFFFFULL;
+    v = (v | v << 32U) & 0x1F00000000FFFFULL;
+    v = (v | v << 16U) & 0x1F0000FF0000FFULL;
+    v = (v | v << 8U) & 0x100F00F00F00F00FULL;
+    v = (v | v << 4U) & 0x10C30C30C30C30C3ULL;
+    v = (v | v << 2U) & 0x1249249249249249ULL;
+    return v;
+}
+
+std::uint64_t morton(std::uint32_t x, std::uint32_t y, std::uint32_t z) {
+    return spread_bits(x) | spread_bits(y) << 1U | spread_bits(z) << 2U;
+}
+
+// Collapses sorted codes to the distinct values of code >> shift, and for
+// shift 3 also records which of the eight children each parent has. Blocks
+// count their run heads in parallel, a prefix sum places them, and each
+// head then writes its run.
+void compact(const std::vector<std::uint64_t> &codes, unsigned shift,
+             std::vector<std::uint64_t> &parents,
+             std::vector<std::uint8_t> *masks) {
+    const std::size_t n = codes.size();
+    const std::size_t blocks = (n + compact_block - 1) / compact_block;
+    const auto head = [&](std::size_t i) {
+        return i == 0 || codes[i] >> shift != codes[i - 1] >> shift;
+    };
+
+    std::vector<std::size_t> offsets(blocks + 1);
+    parallel_for(blocks, 1, [&](std::size_t b, std::size_t e) {
+        for (std::size_t block = b; block < e; ++block) {
+            const std::size_t end = std::min(n, (block + 1) * compact_block);
+            std::size_t heads = 0;
+            for (std::size_t i = block * compact_block; i < end; ++i) {
+                heads += head(i) ? 1 : 0;
+            }
+            offsets[block + 1] = heads;
+        }
+    });
+    for (std::size_t block = 0; block < blocks; ++block) {
+        offsets[block + 1] += offsets[block];
+    }
+
+    parents.resize(offsets[blocks]);
+    if (masks != nullptr) {
+        masks->resize(offsets[blocks]);
+    }
+    parallel_for(blocks, 1, [&](std::size_t b, std::size_t e) {
+        for (std::size_t block = b; block < e; ++block) {
+            const std::size_t end = std::min(n, (block + 1) * compact_block);
+            std::size_t out = offsets[block];
+            for (std::size_t i = block * compact_block; i < end; ++i) {
+                if (!head(i)) {
+                    continue;
+                }
+                const std::uint64_t parent = codes[i] >> shift;
+                parents[out] = parent;
+                if (masks != nullptr) {
+                    unsigned mask = 0;
+                    for (std::size_t j = i;
+                         j < n && codes[j] >> shift == parent; ++j) {
+                        mask |= 1U << (codes[j] & 7U);
+                    }
+                    (*masks)[out] = static_cast<std::uint8_t>(mask);
+                }
+                ++out;
+            }
+        }
+    });
+}
+} // namespace
+
+OctreeView::OctreeView(const void *data, std::size_t size, bool verify_body) {
+    const auto *bytes = static_cast<const std::uint8_t *>(data);
+    if (size < sizeof(OctreeHeader)) {
+        throw OctreeError("octree image is truncated");
+    }
+    const auto *header = reinterpret_cast<const OctreeHeader *>(bytes);
+    if (std::memcmp(header->magic, octree_file_magic, sizeof(header->magic)) !=
+        0) {
+        throw OctreeError("not an octree image");
+    }
+    if (header->header_crc != header_checksum(*header)) {
+        throw OctreeError("octree header checksum mismatch");
+    }
+    if (header->version != octree_file_version) {
+        throw OctreeError(
+            fmt::format("unsupported octree version {}", header->version));
+    }
+    if (header->depth == 0 || header->depth > max_octree_depth ||
+        header->body_size != size - sizeof(OctreeHeader)) {
+        throw OctreeError("corrupt octree header");
+    }
+    if (verify_body && header->body_crc != crc32c(0, bytes + sizeof(*header),
+                                                  header->body_size)) {
+        throw OctreeError("octree body checksum mismatch");
+    }
+
+    const std::size_t table_end =
+        sizeof(OctreeHeader) + header->depth * sizeof(OctreeLevelEntry);
+    if (table_end > size) {
+        throw OctreeError("corrupt octree level table");
+    }
+    const auto *table =
+        reinterpret_cast<const OctreeLevelEntry *>(bytes + sizeof(*header));
+    for (std::uint32_t l = 0; l < header->depth; ++l) {
+        const OctreeLevelEntry &e = table[l];
+        const std::uint64_t groups = (e.node_count + rank_group - 1) /
+                                     rank_group;
+        if (e.node_count > size || e.masks_offset % 8 != 0 ||
+            e.ranks_offset % 8 != 0 || e.masks_offset > size ||
+            groups * rank_group > size - e.masks_offset ||
+            e.ranks_offset > size ||
+            groups * sizeof(std::uint32_t) > size - e.ranks_offset ||
+            (l == 0 && e.node_count > 1)) {
+            throw OctreeError(fmt::format("corrupt octree level {}", l));
+        }
+        levels_.push_back(
+            {bytes + e.masks_offset,
+             reinterpret_cast<const std::uint32_t *>(bytes + e.ranks_offset),
+             e.node_count});
+    }
+    header_ = header;
+}
+
+bool OctreeView::occupied(std::uint32_t x, std::uint32_t y,
+                          std::uint32_t z) const {
+    const unsigned d = depth();
+    if (levels_[0].count == 0 || (std::max({x, y, z}) >> d) != 0) {
+        return false;
+    }
+    std::uint64_t node = 0;
+    for (unsigned l = 0;; ++l) {
+        const unsigned s = d - 1 - l;
+        const unsigned child =
+            (x >> s & 1U) | (y >> s & 1U) << 1U | (z >> s & 1U) << 2U;
+        const Level &level = levels_[l];
+        // Unverified masks may rank past the level; stay inside the image.
+        if (node >= level.count) {
+            return false;
+        }
+        const std::uint8_t mask = level.masks[node];
+        if ((mask >> child & 1U) == 0) {
+            return false;
+        }
+        if (l + 1 == d) {
+            return true;
+        }
+        // Children before this one: the rank of the node's group, the
+        // masks before it in the group, and its own lower bits.
+        const std::uint64_t group = node / rank_group;
+        std::uint64_t word;
+        std::memcpy(&word, level.masks + group * rank_group, sizeof(word));
+        const unsigned before = static_cast<unsigned>(node % rank_group) * 8;
+        word = before == 0 ? 0 : word & (~std::uint64_t{0} >> (64 - before));
+        node = level.ranks[group] +
+               static_cast<std::uint64_t>(__builtin_popcountll(word)) +
+               static_cast<std::uint64_t>(
+                   __builtin_popcount(mask & ((1U << child) - 1U)));
+    }
+}
+
+bool OctreeView::occupied(const VecXYZ &p) const {
+    const float inv = 1.0F / voxel_size();
+    const float fx = std::floor((p.x - header_->origin[0]) * inv);
+    const float fy = std::floor((p.y - header_->origin[1]) * inv);
+    const float fz = std::floor((p.z - header_->origin[2]) * inv);
+    const auto cells = static_cast<float>(std::uint64_t{1} << depth());
+    // Also rejects NaN.
+    if (!(fx >= 0 && fy >= 0 && fz >= 0 && fx < cells && fy < cells &&
+          fz < cells)) {
+        return false;
+    }
+    return occupied(static_cast<std::uint32_t>(fx),
+                    static_cast<std::uint32_t>(fy),
+                    static_cast<std::uint32_t>(fz));
+}
+
+void OctreeView::occupied(const VecXYZ *points, std::size_t count,
+                          std::uint8_t *out) const {
+    parallel_for(count, parallel_grain, [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; ++i) {
+            out[i] = occupied(points[i]) ? 1 : 0;
+        }
+    });
+}
+
+SparseOctree::SparseOctree(const VecXYZ *points, std::size_t count,
+                           const OctreeOptions &options) {
+    if (!(options.voxel_size > 0)) {
+        throw OctreeError("voxel_size must be positive");
+    }
+    if (count > std::numeric_limits<std::uint32_t>::max()) {
+        throw OctreeError("octrees support fewer than 2^32 points");
+    }
+    const Aabb bounds = compute_bounds(points, count);
+    const VecXYZ origin = bounds.empty() ? VecXYZ{0, 0, 0} : bounds.min;
+    const float inv = 1.0F / options.voxel_size;
+
+    unsigned depth = 1;
+    if (!bounds.empty()) {
+        const float extent =
+            std::max({bounds.max.x - origin.x, bounds.max.y - origin.y,
+                      bounds.max.z - origin.z});
+        const double cells = std::floor(double{extent} * inv) + 1;
+        while (depth <= max_octree_depth &&
+               static_cast<double>(std::uint64_t{1} << depth) < cells) {
+            ++depth;
+        }
+        if (depth > max_octree_depth) {
+            throw OctreeError(
+                fmt::format("octree would need more than {} levels",
+                            max_octree_depth));
+        }
+    }
+    const std::uint32_t last_cell = (std::uint32_t{1} << depth) - 1;
+
+    // Leaves: sorted, distinct Morton codes of the occupied voxels.
+    std::vector<KeyIndex> keys(count);
+    parallel_for(count, parallel_grain, [&](std::size_t b, std::size_t e) {
+        const auto cell = [&](float v, float o) {
+            const float f = std::floor((v - o) * inv);
+            return std::min(last_cell,
+                            static_cast<std::uint32_t>(std::max(f, 0.0F)));
+        };
+        for (std::size_t i = b; i < e; ++i) {
+            keys[i] = {morton(cell(points[i].x, origin.x),
+                              cell(points[i].y, origin.y),
+                              cell(points[i].z, origin.z)),
+                       static_cast<std::uint32_t>(i)};
+        }
+    });
+    radix_sort(keys, 3 * depth);
+    std::vector<std::uint64_t> codes(count);
+    parallel_for(count, parallel_grain, [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; ++i) {
+            codes[i] = keys[i].key;
+        }
+    });
+    keys = {};
+    std::vector<std::uint64_t> leaves;
+    compact(codes, 0, leaves, nullptr);
+
+    // Bottom up: each level's nodes are the parents of the level below.
+    std::vector<std::vector<std::uint8_t>> masks(depth);
+    std::vector<std::uint64_t> below = std::move(leaves);
+    const std::uint64_t voxel_count = below.size();
+    for (unsigned l = depth; l-- > 0;) {
+        std::vector<std::uint64_t> nodes;
+        compact(below, 3, nodes, &masks[l]);
+        below = std::move(nodes);
+    }
+
+    // Lay out the image.
+    std::size_t offset =
+        sizeof(OctreeHeader) + depth * sizeof(OctreeLevelEntry);
+    offset = align8(offset);
+    std::vector<OctreeLevelEntry> table(depth);
+    for (unsigned l = 0; l < depth; ++l) {
+        const std::size_t n = masks[l].size();
+        const std::size_t groups = (n + rank_group - 1) / rank_group;
+        table[l].node_count = n;
+        table[l].masks_offset = offset;
+        offset = align8(offset + groups * rank_group);
+        table[l].ranks_offset = offset;
+        offset = align8(offset + groups * sizeof(std::uint32_t));
+    }
+    size_ = offset;
+    image_.assign(size_ / 8, 0);
+    auto *bytes = reinterpret_cast<std::uint8_t *>(image_.data());
+    std::memcpy(bytes + sizeof(OctreeHeader), table.data(),
+                table.size() * sizeof(OctreeLevelEntry));
+    for (unsigned l = 0; l < depth; ++l) {
+        std::memcpy(bytes + table[l].masks_offset, masks[l].data(),
+                    masks[l].size());
+        auto *ranks =
+            reinterpret_cast<std::uint32_t *>(bytes + table[l].ranks_offset);
+        std::uint32_t rank = 0;
+        for (std::size_t i = 0; i < masks[l].size(); ++i) {
+            if (i % rank_group == 0) {
+                ranks[i / rank_group] = rank;
+            }
+            rank += static_cast<std::uint32_t>(
+                __builtin_popcount(masks[l][i]));
+        }
+    }
+
+    OctreeHeader header{};
+    std::memcpy(header.magic, octree_file_magic, sizeof(header.magic));
+    header.version = octree_file_version;
+    header.depth = depth;
+    header.origin[0] = origin.x;
+    header.origin[1] = origin.y;
+    header.origin[2] = origin.z;
+    header.voxel_size = options.voxel_size;
+    header.voxel_count = voxel_count;
+    header.body_size = size_ - sizeof(OctreeHeader);
+    header.body_crc =
+        crc32c(0, bytes + sizeof(OctreeHeader), header.body_size);
+    header.header_crc = header_checksum(header);
+    std::memcpy(bytes, &header, sizeof(header));
+
+    view_ = OctreeView(bytes, size_, false);
+}
+
+void SparseOctree::save(const std::string &path) const {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        throw OctreeError(fmt::format("{}: cannot open for writing", path));
+    }
+    out.write(data(), static_cast<std::streamsize>(size_));
+    out.flush();
+    if (!out) {
+        throw OctreeError(fmt::format("{}: write failed", path));
+    }
+}
+
+MappedOctree::MappedOctree(const std::string &path, bool verify_body) {
+    namespace bip = boost::interprocess;
+    try {
+        file_ = bip::file_mapping(path.c_str(), bip::read_only);
+        region_ = bip::mapped_region(file_, bip::read_only);
+    } catch (const bip::interprocess_exception &e) {
+        throw OctreeError(fmt::format("{}: {}", path, e.what()));
+    }
+    try {
+        view_ = OctreeView(region_.get_address(), region_.get_size(),
+                           verify_body);
+    } catch (const OctreeError &e) {
+        throw OctreeError(fmt::format("{}: {}", path, e.what()));
+    }
+}
+
+} // namespace vecxyz
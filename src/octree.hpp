@@ -0,0 +1,144 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+// Sparse voxel octree image, identical in memory and on disk:
+//
+//   [OctreeHeader][OctreeLevelEntry x depth][level 0][level 1]...
+//
+// Level l holds one child-mask byte per occupied node at that depth, in
+// Morton order, followed by ranks: the number of children before every
+// group of eight nodes. A node's children are found from the ranks and a
+// popcount, so the image has no pointers and can be used straight from a
+// read-only mapping. Leaves (level `depth`) are implied by the masks of
+// the last level. All integers and floats are little-endian.
+constexpr char octree_file_magic[8] = {'V', 'X', 'Y', 'Z', 'O', 'C', 'T', '1'};
+constexpr std::uint32_t octree_file_version = 1;
+// Three bits per level in a 64-bit Morton code.
+constexpr unsigned max_octree_depth = 21;
+
+struct OctreeHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t depth;
+    float origin[3]; // minimum corner of voxel (0, 0, 0)
+    float voxel_size;
+    std::uint64_t voxel_count; // occupied leaves
+    std::uint64_t body_size;   // bytes after the header
+    std::uint32_t body_crc;
+    std::uint8_t reserved[8];
+    std::uint32_t header_crc; // CRC32C of every byte before this field
+};
+static_assert(sizeof(OctreeHeader) == 64, "header layout is on disk");
+
+struct OctreeLevelEntry {
+    std::uint64_t node_count;
+    std::uint64_t masks_offset; // from the start of the image
+    std::uint64_t ranks_offset;
+};
+static_assert(sizeof(OctreeLevelEntry) == 24, "level layout is on disk");
+
+class OctreeError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Occupancy queries over an octree image owned by someone else.
+class OctreeView {
+  public:
+    OctreeView() = default;
+    // Throws OctreeError when the image is malformed. Without verify_body
+    // only the header and layout are checked, which keeps opening a mapped
+    // file O(depth); corrupt masks then give wrong answers, but queries
+    // never read outside the image.
+    OctreeView(const void *data, std::size_t size, bool verify_body = true);
+
+    unsigned depth() const { return header_->depth; }
+    float voxel_size() const { return header_->voxel_size; }
+    VecXYZ origin() const {
+        return {header_->origin[0], header_->origin[1], header_->origin[2]};
+    }
+    std::uint64_t voxel_count() const { return header_->voxel_count; }
+    std::uint64_t node_count(unsigned level) const {
+        return levels_[level].count;
+    }
+
+    // Whether the voxel containing `p` holds a point; false outside the
+    // grid.
+    bool occupied(const VecXYZ &p) const;
+    bool occupied(std::uint32_t x, std::uint32_t y, std::uint32_t z) const;
+    // out[i] = occupied(points[i]), spread across the worker threads.
+    void occupied(const VecXYZ *points, std::size_t count,
+                  std::uint8_t *out) const;
+
+  private:
+    struct Level {
+        const std::uint8_t *masks;
+        const std::uint32_t *ranks;
+        std::uint64_t count;
+    };
+
+    const OctreeHeader *header_{};
+    std::vector<Level> levels_;
+};
+
+struct OctreeOptions {
+    float voxel_size = 0.1F;
+};
+
+// Builds the octree image for a point set: Morton codes are computed and
+// radix sorted in parallel, then each level is compacted from the one
+// below it in parallel blocks. The grid starts at the minimum corner of the
+// points. Input points must be finite. Throws OctreeError when the grid
+// would need more than max_octree_depth levels or for 2^32 or more points.
+class SparseOctree {
+  public:
+    SparseOctree(const VecXYZ *points, std::size_t count,
+                 const OctreeOptions &options = {});
+    explicit SparseOctree(const std::vector<VecXYZ> &points,
+                          const OctreeOptions &options = {})
+        : SparseOctree(points.data(), points.size(), options) {}
+    // The view points into image_, which a copy would not share.
+    SparseOctree(const SparseOctree &) = delete;
+    SparseOctree &operator=(const SparseOctree &) = delete;
+    SparseOctree(SparseOctree &&) = default;
+    SparseOctree &operator=(SparseOctree &&) = default;
+
+    const OctreeView &view() const { return view_; }
+    const char *data() const {
+        return reinterpret_cast<const char *>(image_.data());
+    }
+    std::size_t size() const { return size_; }
+
+    void save(const std::string &path) const;
+
+  private:
+    std::vector<std::uint64_t> image_; // 8-byte aligned storage
+    std::size_t size_{};
+    OctreeView view_;
+};
+
+// A saved octree mapped read-only: pages load on first touch and are
+// shared with every other process mapping the same file.
+class MappedOctree {
+  public:
+    explicit MappedOctree(const std::string &path, bool verify_body = true);
+
+    const OctreeView &view() const { return view_; }
+
+  private:
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    OctreeView view_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,85 @@
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace vecxyz {
+namespace {
+// Pieces per worker a loop is split into, so stragglers even out.
+constexpr std::size_t pieces_per_worker = 8;
+
+std::mutex scheduler_mutex;
+std::unique_ptr<TaskScheduler> scheduler_owner;
+std::atomic<TaskScheduler *> scheduler{nullptr};
+
+void for_range(std::size_t begin, std::size_t end, std::size_t leaf,
+               const std::function<void(std::size_t, std::size_t)> &fn) {
+    if (end - begin < 2 * leaf) {
+        fn(begin, end);
+        return;
+    }
+    const std::size_t middle = begin + (end - begin) / 2;
+    parallel_invoke([&] { for_range(begin, middle, leaf, fn); },
+                    [&] { for_range(middle, end, leaf, fn); });
+}
+} // namespace
+
+TaskScheduler &parallel_scheduler() {
+    TaskScheduler *s = scheduler.load(std::memory_order_acquire);
+    if (s != nullptr) {
+        return *s;
+    }
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    if (!scheduler_owner) {
+        scheduler_owner = std::make_unique<TaskScheduler>();
+        scheduler.store(scheduler_owner.get(), std::memory_order_release);
+    }
+    return *scheduler_owner;
+}
+
+void configure_parallelism(const SchedulerOptions &options) {
+    std::lock_guard<std::mutex> lock(scheduler_mutex);
+    scheduler.store(nullptr, std::memory_order_release);
+    scheduler_owner.reset();
+    scheduler_owner = std::make_unique<TaskScheduler>(options);
+    scheduler.store(scheduler_owner.get(), std::memory_order_release);
+}
+
+std::size_t parallel_concurrency() {
+    return parallel_scheduler().concurrency();
+}
+
+namespace detail {
+void parallel_fork_join(TaskFn a, TaskFn b) {
+    TaskScheduler &s = parallel_scheduler();
+    if (s.concurrency() == 1) {
+        a();
+        b();
+        return;
+    }
+    s.fork_join(a, b);
+}
+
+std::size_t parallel_leaf(std::size_t count, std::size_t grain) {
+    const std::size_t pieces = parallel_concurrency() * pieces_per_worker;
+    return std::max({grain, std::size_t{1}, (count + pieces - 1) / pieces});
+}
+} // namespace detail
+
+void parallel_for(std::size_t count, std::size_t grain,
+                  const std::function<void(std::size_t, std::size_t)> &fn) {
+    grain = std::max<std::size_t>(grain, 1);
+    if (count <= grain || parallel_concurrency() == 1) {
+        if (count > 0) {
+            fn(0, count);
+        }
+        return;
+    }
+    const std::size_t leaf = detail::parallel_leaf(count, grain);
+    TaskScheduler &s = parallel_scheduler();
+    const auto root = [&] { for_range(0, count, leaf, fn); };
+    s.run(detail::task_fn(root));
+}
+
+} // namespace vecxyz
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "task_scheduler.hpp"
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace vecxyz {
+
+// The work-stealing scheduler behind the library's parallel kernels,
+// started on first use.
+TaskScheduler &parallel_scheduler();
+// Replaces the shared scheduler, e.g. to pin its threads or change their
+// number. Call it before any parallel work starts, or while none is in
+// flight.
+void configure_parallelism(const SchedulerOptions &options);
+
+// Worker threads behind the library's parallel kernels.
+std::size_t parallel_concurrency();
+
+namespace detail {
+void parallel_fork_join(TaskFn a, TaskFn b);
+// Parallel loops split ranges in halves while both stay at least this
+// long: `grain`, or more when that would give every worker more than a
+// few pieces.
+std::size_t parallel_leaf(std::size_t count, std::size_t grain);
+
+template <class Fn> TaskFn task_fn(Fn &fn) {
+    return {[](void *context) { (*static_cast<Fn *>(context))(); },
+            const_cast<void *>(static_cast<const void *>(&fn))};
+}
+} // namespace detail
+
+// Runs a() and b(), possibly in parallel, and returns once both are done.
+// Calls may nest: a forked task runs on whichever worker steals it.
+template <class A, class B> void parallel_invoke(A &&a, B &&b) {
+    detail::parallel_fork_join(detail::task_fn(a), detail::task_fn(b));
+}
+
+// Calls fn(begin, end) on disjoint blocks covering [0, count), each at
+// least `grain` long, and returns once all of them are done. The range is
+// split in halves that idle workers steal, so nested calls, like the ones
+// made from inside a block, are spread across the workers too. The first
+// exception thrown by a block is rethrown here; small ranges run inline.
+void parallel_for(std::size_t count, std::size_t grain,
+                  const std::function<void(std::size_t, std::size_t)> &fn);
+
+namespace detail {
+template <class T, class Map, class Combine>
+T reduce_range(std::size_t begin, std::size_t end, std::size_t leaf,
+               const T &identity, const Map &map, const Combine &combine) {
+    if (end - begin < 2 * leaf) {
+        return map(begin, end);
+    }
+    const std::size_t middle = begin + (end - begin) / 2;
+    T left = identity;
+    T right = identity;
+    parallel_invoke(
+        [&] { left = reduce_range(begin, middle, leaf, identity, map,
+                                  combine); },
+        [&] { right = reduce_range(middle, end, leaf, identity, map,
+                                   combine); });
+    return combine(std::move(left), std::move(right));
+}
+} // namespace detail
+
+// combine(map(b0, e0), map(b1, e1), ...) over disjoint blocks covering
+// [0, count), each at least `grain` long, folded in a balanced tree in
+// block order. The blocks depend only on count, grain and the worker
+// count, so for a given machine the result does not depend on timing.
+// Returns identity when count is 0.
+template <class T, class Map, class Combine>
+T parallel_reduce(std::size_t count, std::size_t grain, const T &identity,
+                  const Map &map, const Combine &combine) {
+    if (count == 0) {
+        return identity;
+    }
+    return detail::reduce_range(std::size_t{0}, count,
+                                detail::parallel_leaf(count, grain),
+                                identity, map, combine);
+}
+
+} // namespace vecxyz
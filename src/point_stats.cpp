@@ -0,0 +1,325 @@
+#include "point_stats.hpp"
+#include "parallel.hpp"
+#include "simd_transpose.hpp"
+#include <algorithm>
+
+#ifdef VECXYZ_HAS_SSE
+#include <emmintrin.h>
+#endif
+
+namespace vecxyz {
+namespace {
+constexpr std::size_t parallel_blocks = 16;
+
+Aabb block_bounds(const VecXYZ *points, std::size_t count) {
+    Aabb box;
+    std::size_t i = 0;
+#ifdef VECXYZ_HAS_SSE
+    if (count >= 4) {
+        __m128 lo[3];
+        __m128 hi[3];
+        load_transpose4(points, lo[0], lo[1], lo[2]);
+        hi[0] = lo[0];
+        hi[1] = lo[1];
+        hi[2] = lo[2];
+        for (i = 4; i + 4 <= count; i += 4) {
+            __m128 c[3];
+            load_transpose4(points + i, c[0], c[1], c[2]);
+            for (int k = 0; k < 3; ++k) {
+                lo[k] = _mm_min_ps(lo[k], c[k]);
+                hi[k] = _mm_max_ps(hi[k], c[k]);
+            }
+        }
+        alignas(16) float l[3][4];
+        alignas(16) float h[3][4];
+        for (int k = 0; k < 3; ++k) {
+            _mm_store_ps(l[k], lo[k]);
+            _mm_store_ps(h[k], hi[k]);
+        }
+        for (int lane = 0; lane < 4; ++lane) {
+            box.extend({l[0][lane], l[1][lane], l[2][lane]});
+            box.extend({h[0][lane], h[1][lane], h[2][lane]});
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        box.extend(points[i]);
+    }
+    return box;
+}
+
+#ifdef VECXYZ_HAS_SSE
+// Four floats widened to doubles: lanes 0-1 and lanes 2-3.
+void widen(__m128 v, __m128d &lo, __m128d &hi) {
+    lo = _mm_cvtps_pd(v);
+    hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+}
+
+// Lanes folded in a fixed order, so a block's sums do not depend on
+// anything but its points.
+double lane_sum(__m128d lo, __m128d hi) {
+    alignas(16) double l[2];
+    alignas(16) double h[2];
+    _mm_store_pd(l, lo);
+    _mm_store_pd(h, hi);
+    return (l[0] + l[1]) + (h[0] + h[1]);
+}
+#endif
+
+// Leaf of the reduction tree: block mean first, then moments about it
+// while the block is still in cache, which keeps the sums well conditioned.
+// Both passes sum four points at a time in double lanes.
+PointStats block_stats(const VecXYZ *points, std::size_t count) {
+    PointStats s;
+    s.count = count;
+    if (count == 0) {
+        return s;
+    }
+    s.bounds = block_bounds(points, count);
+
+    double sx = 0;
+    double sy = 0;
+    double sz = 0;
+    std::size_t i = 0;
+#ifdef VECXYZ_HAS_SSE
+    {
+        __m128d sum[3][2];
+        for (auto &axis : sum) {
+            axis[0] = _mm_setzero_pd();
+            axis[1] = _mm_setzero_pd();
+        }
+        for (; i + 4 <= count; i += 4) {
+            __m128 c[3];
+            load_transpose4(points + i, c[0], c[1], c[2]);
+            for (int k = 0; k < 3; ++k) {
+                __m128d lo;
+                __m128d hi;
+                widen(c[k], lo, hi);
+                sum[k][0] = _mm_add_pd(sum[k][0], lo);
+                sum[k][1] = _mm_add_pd(sum[k][1], hi);
+            }
+        }
+        sx = lane_sum(sum[0][0], sum[0][1]);
+        sy = lane_sum(sum[1][0], sum[1][1]);
+        sz = lane_sum(sum[2][0], sum[2][1]);
+    }
+#endif
+    for (; i < count; ++i) {
+        sx += points[i].x;
+        sy += points[i].y;
+        sz += points[i].z;
+    }
+    const double n = static_cast<double>(count);
+    s.mean = {sx / n, sy / n, sz / n};
+
+    std::array<double, 6> m{};
+    i = 0;
+#ifdef VECXYZ_HAS_SSE
+    {
+        const __m128d mean[3] = {_mm_set1_pd(s.mean[0]),
+                                 _mm_set1_pd(s.mean[1]),
+                                 _mm_set1_pd(s.mean[2])};
+        __m128d sum[6][2];
+        for (auto &moment : sum) {
+            moment[0] = _mm_setzero_pd();
+            moment[1] = _mm_setzero_pd();
+        }
+        for (; i + 4 <= count; i += 4) {
+            __m128 c[3];
+            load_transpose4(points + i, c[0], c[1], c[2]);
+            __m128d d[3][2];
+            for (int k = 0; k < 3; ++k) {
+                widen(c[k], d[k][0], d[k][1]);
+                d[k][0] = _mm_sub_pd(d[k][0], mean[k]);
+                d[k][1] = _mm_sub_pd(d[k][1], mean[k]);
+            }
+            for (int h = 0; h < 2; ++h) {
+                sum[0][h] = _mm_add_pd(sum[0][h], _mm_mul_pd(d[0][h], d[0][h]));
+                sum[1][h] = _mm_add_pd(sum[1][h], _mm_mul_pd(d[0][h], d[1][h]));
+                sum[2][h] = _mm_add_pd(sum[2][h], _mm_mul_pd(d[0][h], d[2][h]));
+                sum[3][h] = _mm_add_pd(sum[3][h], _mm_mul_pd(d[1][h], d[1][h]));
+                sum[4][h] = _mm_add_pd(sum[4][h], _mm_mul_pd(d[1][h], d[2][h]));
+                sum[5][h] = _mm_add_pd(sum[5][h], _mm_mul_pd(d[2][h], d[2][h]));
+            }
+        }
+        for (std::size_t k = 0; k < m.size(); ++k) {
+            m[k] = lane_sum(sum[k][0], sum[k][1]);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        const double dx = points[i].x - s.mean[0];
+        const double dy = points[i].y - s.mean[1];
+        const double dz = points[i].z - s.mean[2];
+        m[0] += dx * dx;
+        m[1] += dx * dy;
+        m[2] += dx * dz;
+        m[3] += dy * dy;
+        m[4] += dy * dz;
+        m[5] += dz * dz;
+    }
+    s.comoment = m;
+    return s;
+}
+
+// Combines leaves like a binary counter: two subtrees merge as soon as
+// they have the same height. The shape depends on the leaf count alone.
+template <class Stack> void push_leaf(Stack &stack, const PointStats &leaf) {
+    stack.push_back({0, leaf});
+    while (stack.size() >= 2 &&
+           stack[stack.size() - 1].level == stack[stack.size() - 2].level) {
+        auto top = stack.back();
+        stack.pop_back();
+        stack.back().stats.merge(top.stats);
+        ++stack.back().level;
+    }
+}
+
+template <class Stack> PointStats fold(const Stack &stack) {
+    PointStats result;
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+        PointStats left = it->stats;
+        left.merge(result);
+        result = left;
+    }
+    return result;
+}
+
+struct TreeNode {
+    unsigned level;
+    PointStats stats;
+};
+} // namespace
+
+void Aabb::extend(const VecXYZ &p) {
+    min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+    max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+}
+
+void Aabb::merge(const Aabb &other) {
+    if (!other.empty()) {
+        extend(other.min);
+        extend(other.max);
+    }
+}
+
+VecXYZ PointStats::mean_point() const {
+    return {static_cast<float>(mean[0]), static_cast<float>(mean[1]),
+            static_cast<float>(mean[2])};
+}
+
+std::array<double, 3> PointStats::variance() const {
+    const auto c = covariance();
+    return {c[0], c[3], c[5]};
+}
+
+std::array<double, 6> PointStats::covariance() const {
+    std::array<double, 6> c{};
+    if (count > 0) {
+        for (std::size_t k = 0; k < c.size(); ++k) {
+            c[k] = comoment[k] / static_cast<double>(count);
+        }
+    }
+    return c;
+}
+
+void PointStats::merge(const PointStats &other) {
+    if (other.count == 0) {
+        return;
+    }
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    const double na = static_cast<double>(count);
+    const double nb = static_cast<double>(other.count);
+    const double n = na + nb;
+    const double d[3] = {other.mean[0] - mean[0], other.mean[1] - mean[1],
+                         other.mean[2] - mean[2]};
+    const double f = na * nb / n;
+    const int pairs[6][2] = {{0, 0}, {0, 1}, {0, 2}, {1, 1}, {1, 2}, {2, 2}};
+    for (int k = 0; k < 6; ++k) {
+        comoment[k] += other.comoment[k] + d[pairs[k][0]] * d[pairs[k][1]] * f;
+    }
+    for (int k = 0; k < 3; ++k) {
+        mean[k] += d[k] * nb / n;
+    }
+    count += other.count;
+    bounds.merge(other.bounds);
+}
+
+Aabb compute_bounds(const VecXYZ *points, std::size_t count) {
+    const std::size_t blocks =
+        (count + stats_block_points - 1) / stats_block_points;
+    // Merging boxes is exact, so any split gives the same result.
+    return parallel_reduce(
+        blocks, parallel_blocks, Aabb{},
+        [&](std::size_t b, std::size_t e) {
+            Aabb box;
+            for (std::size_t i = b; i < e; ++i) {
+                const std::size_t first = i * stats_block_points;
+                box.merge(block_bounds(points + first,
+                                       std::min(stats_block_points,
+                                                count - first)));
+            }
+            return box;
+        },
+        [](Aabb a, const Aabb &b) {
+            a.merge(b);
+            return a;
+        });
+}
+
+PointStats compute_stats(const VecXYZ *points, std::size_t count) {
+    const std::size_t blocks =
+        (count + stats_block_points - 1) / stats_block_points;
+    std::vector<PointStats> leaves(blocks);
+    parallel_for(blocks, parallel_blocks, [&](std::size_t b, std::size_t e) {
+        for (std::size_t i = b; i < e; ++i) {
+            const std::size_t first = i * stats_block_points;
+            leaves[i] = block_stats(
+                points + first, std::min(stats_block_points, count - first));
+        }
+    });
+
+    std::vector<TreeNode> stack;
+    for (const auto &leaf : leaves) {
+        push_leaf(stack, leaf);
+    }
+    return fold(stack);
+}
+
+void StatsAccumulator::add(const VecXYZ *points, std::size_t count) {
+    while (count > 0) {
+        if (pending_.empty() && count >= stats_block_points) {
+            push(block_stats(points, stats_block_points));
+            points += stats_block_points;
+            count -= stats_block_points;
+            continue;
+        }
+        const std::size_t take =
+            std::min(count, stats_block_points - pending_.size());
+        pending_.insert(pending_.end(), points, points + take);
+        points += take;
+        count -= take;
+        if (pending_.size() == stats_block_points) {
+            push(block_stats(pending_.data(), pending_.size()));
+            pending_.clear();
+        }
+    }
+}
+
+void StatsAccumulator::push(const PointStats &block) {
+    push_leaf(stack_, block);
+}
+
+PointStats StatsAccumulator::result() const {
+    if (pending_.empty()) {
+        return fold(stack_);
+    }
+    auto stack = stack_;
+    push_leaf(stack, block_stats(pending_.data(), pending_.size()));
+    return fold(stack);
+}
+
+} // namespace vecxyz
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace vecxyz {
+
+struct Aabb {
+    VecXYZ min{std::numeric_limits<float>::infinity(),
+               std::numeric_limits<float>::infinity(),
+               std::numeric_limits<float>::infinity()};
+    VecXYZ max{-std::numeric_limits<float>::infinity(),
+               -std::numeric_limits<float>::infinity(),
+               -std::numeric_limits<float>::infinity()};
+
+    bool empty() const { return min.x > max.x; }
+    void extend(const VecXYZ &p);
+    void merge(const Aabb &other);
+};
+
+// Count, bounds, mean and centred second moments of a point set.
+struct PointStats {
+    std::uint64_t count{};
+    Aabb bounds;
+    std::array<double, 3> mean{};
+    // Sums of (a - mean_a)(b - mean_b) for xx, xy, xz, yy, yz, zz.
+    std::array<double, 6> comoment{};
+
+    VecXYZ mean_point() const;
+    // Population variance of x, y and z.
+    std::array<double, 3> variance() const;
+    // Population covariance in comoment order.
+    std::array<double, 6> covariance() const;
+
+    // Chan et al. pairwise update; exact for the bounds and count.
+    void merge(const PointStats &other);
+};
+
+// Points per leaf of the reduction tree. Results depend on this and on the
+// input order only, never on how many threads ran or how a stream was cut
+// into chunks.
+constexpr std::size_t stats_block_points = 4096;
+
+// Bounds only; min and max are exact, so this is one SIMD pass.
+Aabb compute_bounds(const VecXYZ *points, std::size_t count);
+
+PointStats compute_stats(const VecXYZ *points, std::size_t count);
+
+inline PointStats compute_stats(const std::vector<VecXYZ> &points) {
+    return compute_stats(points.data(), points.size());
+}
+
+// Builds the same reduction tree as compute_stats from points that arrive
+// in pieces, e.g. from AsyncChunkReader's per-chunk callback, and gives
+// bit-identical results for the same point sequence.
+class StatsAccumulator {
+  public:
+    void add(const VecXYZ *points, std::size_t count);
+    void add(const std::vector<VecXYZ> &points) {
+        add(points.data(), points.size());
+    }
+
+    PointStats result() const;
+
+  private:
+    struct Node {
+        unsigned level;
+        PointStats stats;
+    };
+
+    void push(const PointStats &block);
+
+    std::vector<VecXYZ> pending_;
+    std::vector<Node> stack_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,186 @@
+#include "point_store.hpp"
+#include <algorithm>
+#include <boost/interprocess/allocators/allocator.hpp>
+#include <boost/interprocess/containers/vector.hpp>
+#include <boost/interprocess/sync/interprocess_sharable_mutex.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/sync/sharable_lock.hpp>
+#include <cstring>
+#include <fmt/core.h>
+#include <mutex>
+
+namespace vecxyz {
+namespace bip = boost::interprocess;
+
+namespace {
+using SegmentManager = bip::managed_mapped_file::segment_manager;
+using PointAllocator = bip::allocator<VecXYZ, SegmentManager>;
+using PointVector = bip::vector<VecXYZ, PointAllocator>;
+using Mutex = bip::interprocess_sharable_mutex;
+
+constexpr const char *state_name = "vecxyz.point_store";
+// Room for the segment manager's own bookkeeping when growing.
+constexpr std::size_t grow_slack = std::size_t{1} << 16U;
+} // namespace
+
+struct PointStore::State {
+    Mutex mutex;
+    // Size of the segment as last grown; only changes under the exclusive
+    // lock.
+    std::uint64_t segment_size;
+    PointVector points;
+
+    State(const PointAllocator &allocator, std::uint64_t size)
+        : segment_size(size), points(allocator) {}
+};
+
+PointStore::PointStore(const std::string &path, std::size_t initial_bytes)
+    : path_(path) {
+    try {
+        segment_ = std::make_unique<bip::managed_mapped_file>(
+            bip::open_or_create, path.c_str(), initial_bytes);
+        state_ = segment_->find_or_construct<State>(state_name)(
+            PointAllocator(segment_->get_segment_manager()),
+            segment_->get_size());
+    } catch (const bip::interprocess_exception &e) {
+        throw PointStoreError(fmt::format("{}: {}", path, e.what()));
+    }
+}
+
+PointStore::~PointStore() = default;
+
+void PointStore::remap() const {
+    segment_.reset();
+    try {
+        segment_ = std::make_unique<bip::managed_mapped_file>(bip::open_only,
+                                                               path_.c_str());
+    } catch (const bip::interprocess_exception &e) {
+        throw PointStoreError(fmt::format("{}: {}", path_, e.what()));
+    }
+    mapped_size_ = segment_->get_size();
+    state_ = segment_->find<State>(state_name).first;
+    if (state_ == nullptr) {
+        throw PointStoreError(fmt::format("{}: not a point store", path_));
+    }
+}
+
+template <class Fn> void PointStore::shared_access(const Fn &fn) const {
+    {
+        std::shared_lock<std::shared_mutex> local(local_);
+        bip::sharable_lock<Mutex> lock(state_->mutex);
+        if (state_->segment_size == mapped_size_) {
+            fn(*state_);
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> local(local_);
+    bip::sharable_lock<Mutex> lock(state_->mutex);
+    if (state_->segment_size != mapped_size_) {
+        // The file mutex lives in the file, not in this mapping, so it
+        // stays held across the remap and no writer can grow the file
+        // before its size is read.
+        lock.release();
+        remap();
+        lock = bip::sharable_lock<Mutex>(state_->mutex, bip::accept_ownership);
+    }
+    fn(*state_);
+}
+
+std::size_t PointStore::size() const {
+    std::size_t n = 0;
+    shared_access([&](const State &state) { n = state.points.size(); });
+    return n;
+}
+
+void PointStore::read(
+    const std::function<void(const VecXYZ *, std::size_t)> &fn) const {
+    shared_access([&](const State &state) {
+        fn(state.points.data(), state.points.size());
+    });
+}
+
+std::size_t PointStore::copy(std::size_t first, std::size_t count,
+                             VecXYZ *out) const {
+    std::size_t copied = 0;
+    shared_access([&](const State &state) {
+        if (first < state.points.size()) {
+            copied = std::min(count, state.points.size() - first);
+            std::memcpy(out, state.points.data() + first,
+                        copied * sizeof(VecXYZ));
+        }
+    });
+    return copied;
+}
+
+std::size_t PointStore::mapped_bytes() const {
+    std::size_t n = 0;
+    shared_access([&](const State &) { n = mapped_size_; });
+    return n;
+}
+
+std::size_t PointStore::free_bytes() const {
+    std::size_t n = 0;
+    shared_access([&](const State &) { n = segment_->get_free_memory(); });
+    return n;
+}
+
+void PointStore::append(const VecXYZ *points, std::size_t count) {
+    if (count == 0) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> local(local_);
+    bip::scoped_lock<Mutex> lock(state_->mutex);
+    if (state_->segment_size != mapped_size_) {
+        lock.release();
+        remap();
+        lock = bip::scoped_lock<Mutex>(state_->mutex, bip::accept_ownership);
+    }
+
+    const std::size_t needed = state_->points.size() + count;
+    if (needed > state_->points.capacity()) {
+        const std::size_t target =
+            std::max(needed, 2 * state_->points.capacity());
+        for (;;) {
+            try {
+                state_->points.reserve(target);
+                break;
+            } catch (const bip::bad_alloc &) {
+            }
+            // The old and new blocks coexist during the move, so grow by
+            // at least the new block, and at least double the file.
+            const std::size_t extra = std::max<std::size_t>(
+                mapped_size_, target * sizeof(VecXYZ) + grow_slack);
+            lock.release();
+            segment_.reset();
+            bool grown = false;
+            try {
+                grown = bip::managed_mapped_file::grow(path_.c_str(), extra);
+            } catch (const bip::interprocess_exception &) {
+            }
+            remap();
+            lock = bip::scoped_lock<Mutex>(state_->mutex,
+                                           bip::accept_ownership);
+            if (!grown) {
+                throw PointStoreError(
+                    fmt::format("{}: cannot grow by {} bytes", path_, extra));
+            }
+            state_->segment_size = mapped_size_;
+        }
+    }
+    state_->points.insert(state_->points.end(), points, points + count);
+}
+
+void PointStore::clear() {
+    std::unique_lock<std::shared_mutex> local(local_);
+    bip::scoped_lock<Mutex> lock(state_->mutex);
+    state_->points.clear();
+}
+
+void PointStore::flush() {
+    std::shared_lock<std::shared_mutex> local(local_);
+    if (!segment_->flush()) {
+        throw PointStoreError(fmt::format("{}: flush failed", path_));
+    }
+}
+
+} // namespace vecxyz
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <boost/interprocess/managed_mapped_file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vecxyz {
+
+class PointStoreError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Persistent VecXYZ collection in a boost::interprocess managed mapped
+// file. The points live in an offset_ptr based vector inside the mapping,
+// so every process that opens the file reads the same page-cache pages
+// without deserializing anything.
+//
+// Access is guarded by a sharable mutex stored in the file: any number of
+// readers, in any process, or one writer. When an append does not fit,
+// the writer grows the file while holding the lock and records the new
+// segment size; a handle whose mapping is smaller remaps before it touches
+// the points. A process that dies while holding the lock leaves it held.
+//
+// One PointStore may be shared by the threads of a process.
+class PointStore {
+  public:
+    static constexpr std::size_t default_initial_bytes = 64 * 1024 * 1024;
+
+    // Opens `path`, creating it with `initial_bytes` if it does not exist.
+    explicit PointStore(const std::string &path,
+                        std::size_t initial_bytes = default_initial_bytes);
+    ~PointStore();
+    PointStore(const PointStore &) = delete;
+    PointStore &operator=(const PointStore &) = delete;
+
+    std::size_t size() const;
+
+    // Appends under the exclusive lock, growing the file when needed.
+    void append(const VecXYZ *points, std::size_t count);
+    void append(const std::vector<VecXYZ> &points) {
+        append(points.data(), points.size());
+    }
+    void clear();
+
+    // Calls fn(points, count) on the whole collection under the shared
+    // lock. The pointer is only valid during the call.
+    void read(
+        const std::function<void(const VecXYZ *, std::size_t)> &fn) const;
+    // Copies up to `count` points starting at `first`; returns how many.
+    std::size_t copy(std::size_t first, std::size_t count,
+                     VecXYZ *out) const;
+
+    // Writes dirty pages back to the file and waits for the write.
+    void flush();
+
+    // Bytes of the mapping, and how many of them are still free.
+    std::size_t mapped_bytes() const;
+    std::size_t free_bytes() const;
+
+  private:
+    struct State;
+
+    // Runs fn(state) under both shared locks, remapping first if another
+    // handle grew the file.
+    template <class Fn> void shared_access(const Fn &fn) const;
+    // Maps the file again. Callers hold local_ exclusively and the file
+    // mutex, released from its lock object since the remap moves it, so
+    // the file cannot grow between mapping it and reading its size.
+    void remap() const;
+
+    std::string path_;
+    // Guards segment_ and state_ against remapping by another thread.
+    mutable std::shared_mutex local_;
+    mutable std::unique_ptr<boost::interprocess::managed_mapped_file>
+        segment_;
+    mutable State *state_{};
+    // Length of this handle's mapping, or 0 until the first remap. The
+    // segment manager reports the size recorded in the file, which only
+    // matches the mapping if no one grew the file in between, so this is
+    // only taken while the file mutex is held.
+    mutable std::size_t mapped_size_{};
+};
+
+} // namespace vecxyz
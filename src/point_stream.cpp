@@ -0,0 +1,280 @@
+#include "point_stream.hpp"
+#include <algorithm>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/write.hpp>
+#include <deque>
+#include <fmt/core.h>
+
+namespace vecxyz {
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+class PointStreamServer::Connection
+    : public std::enable_shared_from_this<Connection> {
+  public:
+    Connection(PointStreamServer &server, tcp::socket socket)
+        : server_(server), socket_(std::move(socket)),
+          timer_(socket_.get_executor()) {}
+
+    void start() {
+        boost::system::error_code ignored;
+        socket_.set_option(tcp::no_delay(true), ignored);
+        watch();
+    }
+
+    void enqueue(const Batch &batch) {
+        const PointStreamOptions &options = server_.options_;
+        const std::size_t n = batch->size();
+        if (closed_ || n == 0) {
+            return;
+        }
+        if (n > options.max_queued_points) {
+            // It could never be queued; the backlog stays as it is.
+            server_.points_dropped_ += n;
+            return;
+        }
+        if (queued_points_ + n > options.max_queued_points) {
+            if (options.slow_consumer == SlowConsumer::disconnect) {
+                close();
+                return;
+            }
+            while (!queue_.empty() &&
+                   queued_points_ + n > options.max_queued_points) {
+                drop(queue_.front().batch->size() - queue_.front().offset);
+                queue_.pop_front();
+            }
+        }
+        queue_.push_back({batch, 0});
+        queued_points_ += n;
+        schedule();
+    }
+
+    void close() {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        boost::system::error_code ignored;
+        socket_.shutdown(tcp::socket::shutdown_both, ignored);
+        socket_.close(ignored);
+        timer_.cancel();
+        drop(queued_points_);
+        queue_.clear();
+        server_.remove(shared_from_this());
+    }
+
+  private:
+    struct Pending {
+        Batch batch;
+        std::size_t offset; // points already handed to a write
+    };
+
+    void drop(std::size_t points) {
+        queued_points_ -= points;
+        server_.points_dropped_ += points;
+    }
+
+    // The client never sends anything; a completed read means it left.
+    void watch() {
+        socket_.async_read_some(
+            asio::buffer(&probe_, 1),
+            [self = shared_from_this()](boost::system::error_code ec,
+                                        std::size_t) {
+                if (ec) {
+                    self->close();
+                } else {
+                    self->watch();
+                }
+            });
+    }
+
+    void schedule() {
+        if (writing_ || queue_.empty()) {
+            return;
+        }
+        const PointStreamOptions &options = server_.options_;
+        if (options.coalesce_delay.count() == 0 ||
+            queued_points_ >= options.max_frame_points) {
+            write();
+            return;
+        }
+        if (!timer_armed_) {
+            timer_armed_ = true;
+            timer_.expires_after(options.coalesce_delay);
+            timer_.async_wait([self = shared_from_this()](
+                                  boost::system::error_code) {
+                self->timer_armed_ = false;
+                if (!self->closed_ && !self->writing_ &&
+                    !self->queue_.empty()) {
+                    self->write();
+                }
+            });
+        }
+    }
+
+    // Sends one frame gathered from the front of the queue.
+    void write() {
+        const std::size_t limit = server_.options_.max_frame_points;
+        writing_ = true;
+        buffers_.clear();
+        in_flight_.clear();
+        buffers_.emplace_back(header_, sizeof(header_));
+        std::size_t count = 0;
+        while (!queue_.empty() && count < limit) {
+            Pending &front = queue_.front();
+            const std::size_t take =
+                std::min(front.batch->size() - front.offset, limit - count);
+            buffers_.emplace_back(front.batch->data() + front.offset,
+                                  take * sizeof(VecXYZ));
+            in_flight_.push_back(front.batch);
+            front.offset += take;
+            count += take;
+            if (front.offset == front.batch->size()) {
+                queue_.pop_front();
+            }
+        }
+        queued_points_ -= count;
+        header_[0] = static_cast<std::uint32_t>(sizeof(std::uint32_t) +
+                                                count * sizeof(VecXYZ));
+        header_[1] = static_cast<std::uint32_t>(count);
+
+        asio::async_write(
+            socket_, buffers_,
+            [self = shared_from_this(), count](boost::system::error_code ec,
+                                               std::size_t) {
+                self->writing_ = false;
+                self->in_flight_.clear();
+                if (ec) {
+                    self->close();
+                    return;
+                }
+                ++self->server_.frames_sent_;
+                self->server_.points_sent_ += count;
+                // Whatever queued up during the write has already waited
+                // long enough.
+                if (!self->queue_.empty()) {
+                    self->write();
+                }
+            });
+    }
+
+    PointStreamServer &server_;
+    tcp::socket socket_;
+    asio::steady_timer timer_;
+    std::deque<Pending> queue_;
+    std::size_t queued_points_{};
+    bool writing_{};
+    bool timer_armed_{};
+    bool closed_{};
+    // The frame being written: its header, its buffers and the batches
+    // they point into.
+    std::uint32_t header_[2]{};
+    std::vector<asio::const_buffer> buffers_;
+    std::vector<Batch> in_flight_;
+    char probe_{};
+};
+
+PointStreamServer::PointStreamServer(asio::io_context &io,
+                                     const tcp::endpoint &endpoint,
+                                     PointStreamOptions options)
+    : strand_(asio::make_strand(io)), acceptor_(strand_, endpoint),
+      options_(options) {
+    options_.max_frame_points = std::clamp<std::size_t>(
+        options_.max_frame_points, 1, max_stream_frame_points);
+    accept();
+}
+
+PointStreamServer::~PointStreamServer() = default;
+
+tcp::endpoint PointStreamServer::local_endpoint() const {
+    return acceptor_.local_endpoint();
+}
+
+void PointStreamServer::accept() {
+    acceptor_.async_accept(
+        strand_, [this](boost::system::error_code ec, tcp::socket socket) {
+            if (ec == asio::error::operation_aborted || !acceptor_.is_open()) {
+                return;
+            }
+            if (!ec) {
+                auto connection =
+                    std::make_shared<Connection>(*this, std::move(socket));
+                connections_.insert(connection);
+                connection_count_ = connections_.size();
+                connection->start();
+            }
+            accept();
+        });
+}
+
+void PointStreamServer::remove(const std::shared_ptr<Connection> &connection) {
+    connections_.erase(connection);
+    connection_count_ = connections_.size();
+}
+
+void PointStreamServer::publish(Batch batch) {
+    if (!batch || batch->empty()) {
+        return;
+    }
+    asio::post(strand_, [this, batch = std::move(batch)] {
+        // enqueue() may close, and so erase, the connection it is given.
+        for (auto it = connections_.begin(); it != connections_.end();) {
+            const auto connection = *it++;
+            connection->enqueue(batch);
+        }
+    });
+}
+
+void PointStreamServer::publish(const VecXYZ *points, std::size_t count) {
+    publish(std::make_shared<const std::vector<VecXYZ>>(points,
+                                                        points + count));
+}
+
+void PointStreamServer::close() {
+    asio::post(strand_, [this] {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+        const auto connections = connections_;
+        for (const auto &connection : connections) {
+            connection->close();
+        }
+    });
+}
+
+PointStreamStats PointStreamServer::stats() const {
+    return {connection_count_.load(), frames_sent_.load(),
+            points_sent_.load(), points_dropped_.load()};
+}
+
+PointStreamClient::PointStreamClient(asio::io_context &io,
+                                     const tcp::endpoint &server)
+    : socket_(io) {
+    socket_.connect(server);
+    socket_.set_option(tcp::no_delay(true));
+}
+
+bool PointStreamClient::read(std::vector<VecXYZ> &points) {
+    std::uint32_t header[2];
+    boost::system::error_code ec;
+    const std::size_t got = asio::read(socket_, asio::buffer(header), ec);
+    if (ec == asio::error::eof && got == 0) {
+        return false;
+    }
+    if (ec) {
+        throw boost::system::system_error(ec);
+    }
+    const std::size_t count = header[1];
+    if (count > max_stream_frame_points ||
+        header[0] != sizeof(std::uint32_t) + count * sizeof(VecXYZ)) {
+        throw PointStreamError(fmt::format(
+            "malformed frame: {} bytes for {} points", header[0], count));
+    }
+    points.resize(count);
+    asio::read(socket_, asio::buffer(points.data(), count * sizeof(VecXYZ)));
+    return true;
+}
+
+} // namespace vecxyz
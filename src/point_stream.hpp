@@ -0,0 +1,120 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace vecxyz {
+
+// Stream framing: std::uint32_t body bytes, then the body, which is a
+// MessageEncoder message: std::uint32_t point count and the points as
+// packed floats. All little-endian.
+constexpr std::size_t stream_frame_header_bytes = 2 * sizeof(std::uint32_t);
+constexpr std::size_t max_stream_frame_points = std::size_t{1} << 24U;
+
+class PointStreamError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// What happens to a connection whose unsent backlog would exceed
+// max_queued_points.
+enum class SlowConsumer {
+    drop_oldest, // discard its oldest queued batches
+    disconnect,
+};
+
+struct PointStreamOptions {
+    // Points per frame; larger backlogs are sent as several frames.
+    std::size_t max_frame_points = std::size_t{1} << 16U;
+    // How long the first batch queued on an idle connection waits for
+    // others to share its frame. With 0 it is written at once, and only
+    // batches published while a write is in flight are coalesced.
+    std::chrono::microseconds coalesce_delay{0};
+    // Unsent points a connection may hold before slow_consumer applies.
+    // A larger batch is dropped for every connection and counted in
+    // points_dropped.
+    std::size_t max_queued_points = std::size_t{1} << 22U;
+    SlowConsumer slow_consumer = SlowConsumer::drop_oldest;
+};
+
+struct PointStreamStats {
+    std::size_t connections;
+    std::uint64_t frames_sent;
+    std::uint64_t points_sent;
+    std::uint64_t points_dropped;
+};
+
+// Streams published batches to every connected client. A batch is shared by
+// all connections and written straight from its vector: each frame goes out
+// as one gathered async_write of its header and the point ranges of the
+// batches it coalesces. Every connection has its own queue and limit, so a
+// slow client loses data or its connection without holding up the others.
+// Sockets use TCP_NODELAY.
+//
+// All connection state lives on one strand; io.run() may be called from
+// any number of threads. Destroy the server only after close() has run and
+// the io_context has no more of its handlers.
+class PointStreamServer {
+  public:
+    using Batch = std::shared_ptr<const std::vector<VecXYZ>>;
+
+    PointStreamServer(boost::asio::io_context &io,
+                      const boost::asio::ip::tcp::endpoint &endpoint,
+                      PointStreamOptions options = {});
+    ~PointStreamServer();
+    PointStreamServer(const PointStreamServer &) = delete;
+    PointStreamServer &operator=(const PointStreamServer &) = delete;
+
+    boost::asio::ip::tcp::endpoint local_endpoint() const;
+
+    // Queues a batch for every current connection. Thread-safe.
+    void publish(Batch batch);
+    void publish(const VecXYZ *points, std::size_t count);
+
+    // Stops accepting and closes every connection. Thread-safe.
+    void close();
+
+    PointStreamStats stats() const;
+
+  private:
+    class Connection;
+
+    void accept();
+    void remove(const std::shared_ptr<Connection> &connection);
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    PointStreamOptions options_;
+    std::set<std::shared_ptr<Connection>> connections_; // on strand_
+    std::atomic<std::size_t> connection_count_{0};
+    std::atomic<std::uint64_t> frames_sent_{0};
+    std::atomic<std::uint64_t> points_sent_{0};
+    std::atomic<std::uint64_t> points_dropped_{0};
+};
+
+// Blocking reader for a PointStreamServer.
+class PointStreamClient {
+  public:
+    PointStreamClient(boost::asio::io_context &io,
+                      const boost::asio::ip::tcp::endpoint &server);
+
+    // Replaces `points` with the next frame. Returns false once the server
+    // closed the stream; throws PointStreamError on a malformed frame and
+    // boost::system::system_error on socket errors.
+    bool read(std::vector<VecXYZ> &points);
+
+  private:
+    boost::asio::ip::tcp::socket socket_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,111 @@
+#include "point_validation.hpp"
+#include <cmath>
+#include <cstring>
+#include <fmt/core.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VECXYZ_VALIDATION_SSE2 1
+#endif
+
+namespace vecxyz {
+namespace {
+bool finite(const VecXYZ &p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+float clamp_component(float value, float limit) {
+    if (std::isnan(value)) {
+        return 0.0F;
+    }
+    if (std::isinf(value)) {
+        return value > 0 ? limit : -limit;
+    }
+    return value;
+}
+
+// Handles one point; returns the number of points written (0 or 1).
+std::size_t decode_one(const VecXYZ &p, VecXYZ *dst, std::uint64_t index,
+                       const ValidationOptions &options,
+                       ValidationReport &report) {
+    if (finite(p)) {
+        *dst = p;
+        return 1;
+    }
+    report.bad_indices.push_back(index);
+    switch (options.policy) {
+    case NonFinitePolicy::clamp:
+        *dst = {clamp_component(p.x, options.clamp_limit),
+                clamp_component(p.y, options.clamp_limit),
+                clamp_component(p.z, options.clamp_limit)};
+        return 1;
+    case NonFinitePolicy::drop:
+        return 0;
+    case NonFinitePolicy::reject:
+        break;
+    }
+    *dst = p;
+    return 1;
+}
+} // namespace
+
+std::size_t decode_points_checked(const void *src, std::size_t count,
+                                  VecXYZ *dst, std::uint64_t first_index,
+                                  const ValidationOptions &options,
+                                  ValidationReport &report) {
+    const auto *bytes = static_cast<const unsigned char *>(src);
+    const std::size_t bad_before = report.bad_indices.size();
+    std::size_t written = 0;
+    std::size_t i = 0;
+
+#ifdef VECXYZ_VALIDATION_SSE2
+    // A float is NaN or Inf exactly when its exponent bits are all set.
+    const __m128i exponent = _mm_set1_epi32(0x7f800000);
+    for (; i + 4 <= count; i += 4) {
+        const auto *block = bytes + i * sizeof(VecXYZ);
+        const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16));
+        const __m128i c =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 32));
+        const __m128i bad = _mm_or_si128(
+            _mm_or_si128(
+                _mm_cmpeq_epi32(_mm_and_si128(a, exponent), exponent),
+                _mm_cmpeq_epi32(_mm_and_si128(b, exponent), exponent)),
+            _mm_cmpeq_epi32(_mm_and_si128(c, exponent), exponent));
+
+        if (_mm_movemask_epi8(bad) == 0) {
+            auto *out = reinterpret_cast<unsigned char *>(dst + written);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out), a);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), b);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 32), c);
+            written += 4;
+            continue;
+        }
+        for (std::size_t k = 0; k < 4; ++k) {
+            VecXYZ p;
+            std::memcpy(&p, block + k * sizeof(VecXYZ), sizeof(p));
+            written += decode_one(p, dst + written, first_index + i + k,
+                                  options, report);
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        VecXYZ p;
+        std::memcpy(&p, bytes + i * sizeof(VecXYZ), sizeof(p));
+        written +=
+            decode_one(p, dst + written, first_index + i, options, report);
+    }
+
+    report.checked += count;
+    const std::size_t bad = report.bad_indices.size() - bad_before;
+    if (bad > 0 && options.policy == NonFinitePolicy::reject) {
+        throw NonFiniteError(
+            fmt::format("{} non-finite point(s), first at index {}", bad,
+                        report.bad_indices[bad_before]));
+    }
+    return written;
+}
+
+} // namespace vecxyz
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace vecxyz {
+
+enum class NonFinitePolicy {
+    reject, // fail once the range being decoded has been fully reported
+    clamp,  // NaN becomes 0, +/-Inf becomes +/-clamp_limit
+    drop,   // leave the point out
+};
+
+struct ValidationOptions {
+    NonFinitePolicy policy = NonFinitePolicy::reject;
+    float clamp_limit = std::numeric_limits<float>::max();
+};
+
+struct ValidationReport {
+    std::uint64_t checked{};
+    // Indices, in the whole input, of points with a NaN or Inf component.
+    std::vector<std::uint64_t> bad_indices;
+
+    bool ok() const { return bad_indices.empty(); }
+};
+
+class NonFiniteError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Copies `count` packed points from `src` to `dst` and checks every
+// component on the way, four points per SSE step, so validation costs no
+// extra pass over the data. `first_index` is the position of src[0] in the
+// whole input and is only used for the report. Returns the number of
+// points written, which is below `count` only under the drop policy.
+// Under reject, throws NonFiniteError after the whole range is reported.
+std::size_t decode_points_checked(const void *src, std::size_t count,
+                                  VecXYZ *dst, std::uint64_t first_index,
+                                  const ValidationOptions &options,
+                                  ValidationReport &report);
+
+} // namespace vecxyz
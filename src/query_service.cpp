@@ -0,0 +1,474 @@
+#include "query_service.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <cmath>
+#include <cstring>
+#include <fmt/core.h>
+#include <future>
+#include <memory>
+
+namespace vecxyz {
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+namespace {
+constexpr std::size_t range_grain = 16;
+// Requests a connection may have in the engine or its write queue before
+// it stops reading more, and the response bytes they may add up to.
+constexpr std::size_t max_session_queries = 4096;
+constexpr std::size_t max_session_bytes = std::size_t{64} << 20U;
+
+bool finite(const VecXYZ &p) {
+    return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z);
+}
+
+bool valid(const QueryRequest &request) {
+    switch (request.kind) {
+    case QueryKind::knn:
+        return request.k >= 1 && request.k <= max_query_k &&
+               finite(request.a);
+    case QueryKind::radius:
+        return std::isfinite(request.radius) && request.radius >= 0.0F &&
+               finite(request.a);
+    case QueryKind::box:
+        return finite(request.a) && finite(request.b);
+    }
+    return false;
+}
+
+std::size_t row_bytes(QueryKind kind) {
+    return kind == QueryKind::knn ? sizeof(Neighbor) : sizeof(std::uint32_t);
+}
+
+// Body bytes of the largest response a request can get.
+std::size_t response_bound(const QueryRequest &request) {
+    const std::size_t rows = request.kind == QueryKind::knn
+                                 ? std::min(request.k, max_query_k)
+                                 : max_query_results;
+    return sizeof(QueryResponse) + rows * row_bytes(request.kind);
+}
+} // namespace
+
+QueryEngine::QueryEngine(const VecXYZ *points, std::size_t count,
+                         QueryBatchPolicy policy)
+    : tree_(points, count), policy_(policy) {
+    policy_.max_batch = std::max<std::size_t>(policy_.max_batch, 1);
+    dispatcher_ = std::thread([this] { dispatch(); });
+}
+
+QueryEngine::~QueryEngine() {
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    dispatcher_.join();
+}
+
+void QueryEngine::submit(const QueryRequest &request, Completion done) {
+    std::size_t queued;
+    {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back({request, std::move(done),
+                          std::chrono::steady_clock::now()});
+        queued = queue_.size();
+    }
+    // The dispatcher only needs to hear about the request that starts its
+    // wait and the one that fills a batch.
+    if (queued == 1 || queued == policy_.max_batch) {
+        wake_.notify_one();
+    }
+}
+
+QueryResult QueryEngine::query(const QueryRequest &request) {
+    std::promise<QueryResult> promise;
+    std::future<QueryResult> result = promise.get_future();
+    submit(request, [&promise](QueryResult &&done) {
+        promise.set_value(std::move(done));
+    });
+    return result.get();
+}
+
+QueryEngineStats QueryEngine::stats() const {
+    return {batches_.load(), queries_.load()};
+}
+
+void QueryEngine::dispatch() {
+    std::vector<Pending> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        // Requests that queued up behind the previous batch have usually
+        // waited long enough already.
+        wake_.wait_until(lock, queue_.front().arrived + policy_.max_wait,
+                         [this] {
+                             return stopping_ ||
+                                    queue_.size() >= policy_.max_batch;
+                         });
+        const std::size_t take = std::min(queue_.size(), policy_.max_batch);
+        for (std::size_t i = 0; i < take; ++i) {
+            batch.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+        }
+        lock.unlock();
+        run_batch(batch);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void QueryEngine::run_batch(std::vector<Pending> &batch) {
+    std::vector<QueryResult> results(batch.size());
+    std::vector<std::size_t> knn;
+    std::vector<std::size_t> ranges;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        const QueryRequest &request = batch[i].request;
+        results[i].id = request.id;
+        results[i].kind = request.kind;
+        if (!valid(request)) {
+            results[i].status = QueryStatus::bad_request;
+        } else if (request.kind == QueryKind::knn) {
+            knn.push_back(i);
+        } else {
+            ranges.push_back(i);
+        }
+    }
+
+    // One kernel call per distinct k.
+    std::stable_sort(knn.begin(), knn.end(), [&](std::size_t a, std::size_t b) {
+        return batch[a].request.k < batch[b].request.k;
+    });
+    std::vector<VecXYZ> queries;
+    std::vector<Neighbor> neighbors;
+    for (std::size_t begin = 0; begin < knn.size();) {
+        const std::uint32_t k = batch[knn[begin]].request.k;
+        std::size_t end = begin;
+        queries.clear();
+        while (end < knn.size() && batch[knn[end]].request.k == k) {
+            queries.push_back(batch[knn[end]].request.a);
+            ++end;
+        }
+        neighbors.resize(queries.size() * k);
+        tree_.knn(queries.data(), queries.size(), k, neighbors.data());
+        for (std::size_t q = 0; q < queries.size(); ++q) {
+            const Neighbor *first = neighbors.data() + q * k;
+            // Padding sorts last, so the real neighbors are a prefix.
+            const Neighbor *last = std::find_if(
+                first, first + k,
+                [](const Neighbor &n) { return n.index == no_neighbor; });
+            results[knn[begin + q]].neighbors.assign(first, last);
+        }
+        begin = end;
+    }
+
+    parallel_for(ranges.size(), range_grain,
+                 [&](std::size_t begin, std::size_t end) {
+                     for (std::size_t i = begin; i < end; ++i) {
+                         const QueryRequest &request =
+                             batch[ranges[i]].request;
+                         std::vector<std::uint32_t> &out =
+                             results[ranges[i]].indices;
+                         const bool fits =
+                             request.kind == QueryKind::radius
+                                 ? tree_.radius(request.a, request.radius,
+                                                out, max_query_results)
+                                 : tree_.box({request.a, request.b}, out,
+                                             max_query_results);
+                         if (!fits) {
+                             results[ranges[i]].status =
+                                 QueryStatus::too_many_results;
+                         }
+                     }
+                 });
+
+    ++batches_;
+    queries_ += batch.size();
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        batch[i].done(std::move(results[i]));
+    }
+}
+
+class QueryServer::Session : public std::enable_shared_from_this<Session> {
+  public:
+    Session(tcp::socket socket, QueryEngine &engine)
+        : socket_(std::move(socket)), engine_(engine) {}
+
+    void start() {
+        boost::system::error_code ignored;
+        socket_.set_option(tcp::no_delay(true), ignored);
+        read_request();
+    }
+
+  private:
+    struct Outgoing {
+        std::uint32_t size;
+        QueryResponse header;
+        QueryResult result;
+    };
+
+    // A write in flight still owns the front of queue_; it fails once the
+    // socket is closed and drops the rest.
+    void stop() {
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+
+    // Requests have a fixed size, so the size prefix and the body are read
+    // together.
+    void read_request() {
+        reading_ = true;
+        asio::async_read(
+            socket_, asio::buffer(incoming_),
+            [self = shared_from_this()](boost::system::error_code ec,
+                                        std::size_t) {
+                self->reading_ = false;
+                std::uint32_t size;
+                std::memcpy(&size, self->incoming_.data(), sizeof(size));
+                if (ec || size != sizeof(QueryRequest)) {
+                    // Without a sane size there is no next request to
+                    // resynchronize on.
+                    self->stop();
+                    return;
+                }
+                QueryRequest request;
+                std::memcpy(&request, self->incoming_.data() + sizeof(size),
+                            sizeof(request));
+                self->submit(request);
+                if (self->may_read()) {
+                    self->read_request();
+                }
+            });
+    }
+
+    bool may_read() const {
+        return socket_.is_open() && outstanding_ < max_session_queries &&
+               budget_ < max_session_bytes;
+    }
+
+    void submit(const QueryRequest &request) {
+        const std::size_t bound = response_bound(request);
+        ++outstanding_;
+        budget_ += bound;
+        // Completions run on the engine's dispatcher; hand them back to
+        // this connection's strand.
+        engine_.submit(request, [self = shared_from_this(),
+                                 bound](QueryResult &&result) {
+            asio::post(self->socket_.get_executor(),
+                       [self, bound, result = std::move(result)]() mutable {
+                           self->respond(std::move(result), bound);
+                       });
+        });
+    }
+
+    // `bound` is what the request was charged against budget_.
+    void respond(QueryResult &&result, std::size_t bound) {
+        if (!socket_.is_open()) {
+            return;
+        }
+        const std::size_t count = result.kind == QueryKind::knn
+                                      ? result.neighbors.size()
+                                      : result.indices.size();
+        Outgoing outgoing{};
+        outgoing.size = static_cast<std::uint32_t>(
+            sizeof(QueryResponse) + count * row_bytes(result.kind));
+        outgoing.header = {result.id, result.kind, result.status,
+                           static_cast<std::uint32_t>(count), 0};
+        outgoing.result = std::move(result);
+        budget_ = budget_ - bound + outgoing.size;
+        queue_.push_back(std::move(outgoing));
+        if (!writing_) {
+            write();
+        }
+    }
+
+    void write() {
+        writing_ = true;
+        const Outgoing &front = queue_.front();
+        const QueryResult &result = front.result;
+        const std::array<asio::const_buffer, 3> buffers{
+            asio::buffer(&front.size, sizeof(front.size)),
+            asio::buffer(&front.header, sizeof(front.header)),
+            result.kind == QueryKind::knn
+                ? asio::buffer(result.neighbors.data(),
+                               result.neighbors.size() * sizeof(Neighbor))
+                : asio::buffer(result.indices.data(),
+                               result.indices.size() *
+                                   sizeof(std::uint32_t))};
+        asio::async_write(
+            socket_, buffers,
+            [self = shared_from_this()](boost::system::error_code ec,
+                                        std::size_t) {
+                self->writing_ = false;
+                if (ec) {
+                    self->stop();
+                    self->queue_.clear();
+                    return;
+                }
+                self->budget_ -= self->queue_.front().size;
+                self->queue_.pop_front();
+                --self->outstanding_;
+                if (!self->reading_ && self->may_read()) {
+                    self->read_request();
+                }
+                if (!self->queue_.empty()) {
+                    self->write();
+                }
+            });
+    }
+
+    tcp::socket socket_;
+    QueryEngine &engine_;
+    std::array<char, sizeof(std::uint32_t) + sizeof(QueryRequest)>
+        incoming_{};
+    bool reading_{};
+    bool writing_{};
+    // Submitted requests whose responses are not written yet, and their
+    // response bytes: the bound while in the engine, the size once queued.
+    std::size_t outstanding_{};
+    std::size_t budget_{};
+    std::deque<Outgoing> queue_;
+};
+
+QueryServer::QueryServer(asio::io_context &io, const tcp::endpoint &endpoint,
+                         QueryEngine &engine)
+    : io_(io), strand_(asio::make_strand(io)), acceptor_(strand_, endpoint),
+      engine_(engine) {
+    accept();
+}
+
+tcp::endpoint QueryServer::local_endpoint() const {
+    return acceptor_.local_endpoint();
+}
+
+void QueryServer::accept() {
+    acceptor_.async_accept(
+        asio::make_strand(io_),
+        [this](boost::system::error_code ec, tcp::socket socket) {
+            if (ec == asio::error::operation_aborted || !acceptor_.is_open()) {
+                return;
+            }
+            if (!ec) {
+                std::make_shared<Session>(std::move(socket), engine_)
+                    ->start();
+            }
+            accept();
+        });
+}
+
+void QueryServer::close() {
+    asio::post(strand_, [this] {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+    });
+}
+
+QueryClient::QueryClient(asio::io_context &io, const tcp::endpoint &server)
+    : socket_(io) {
+    socket_.connect(server);
+    socket_.set_option(tcp::no_delay(true));
+}
+
+std::uint64_t QueryClient::send(QueryRequest request) {
+    request.id = next_id_++;
+    const auto size = static_cast<std::uint32_t>(sizeof(request));
+    const std::array<asio::const_buffer, 2> buffers{
+        asio::buffer(&size, sizeof(size)),
+        asio::buffer(&request, sizeof(request))};
+    asio::write(socket_, buffers);
+    return request.id;
+}
+
+QueryResult QueryClient::receive() {
+    std::uint32_t size;
+    QueryResponse header;
+    const std::array<asio::mutable_buffer, 2> buffers{
+        asio::buffer(&size, sizeof(size)),
+        asio::buffer(&header, sizeof(header))};
+    asio::read(socket_, buffers);
+    if (header.kind != QueryKind::knn && header.kind != QueryKind::radius &&
+        header.kind != QueryKind::box) {
+        socket_.close();
+        throw QueryError(fmt::format("response {}: unknown query kind {}",
+                                     header.id,
+                                     static_cast<std::uint32_t>(header.kind)));
+    }
+    const std::uint32_t most =
+        header.kind == QueryKind::knn ? max_query_k : max_query_results;
+    if (header.count > most ||
+        size != sizeof(header) + std::size_t{header.count} *
+                                     row_bytes(header.kind)) {
+        socket_.close();
+        throw QueryError(fmt::format("response {}: {} bytes for {} results",
+                                     header.id, size, header.count));
+    }
+    QueryResult result;
+    result.id = header.id;
+    result.kind = header.kind;
+    result.status = header.status;
+    if (header.kind == QueryKind::knn) {
+        result.neighbors.resize(header.count);
+        asio::read(socket_,
+                   asio::buffer(result.neighbors.data(),
+                                result.neighbors.size() * sizeof(Neighbor)));
+    } else {
+        result.indices.resize(header.count);
+        asio::read(socket_, asio::buffer(result.indices.data(),
+                                         result.indices.size() *
+                                             sizeof(std::uint32_t)));
+    }
+    return result;
+}
+
+QueryResult QueryClient::call(const QueryRequest &request) {
+    const std::uint64_t id = send(request);
+    QueryResult result = receive();
+    if (result.id != id) {
+        throw QueryError(fmt::format(
+            "response {} while waiting for {}; pipelined requests must be "
+            "read with receive()",
+            result.id, id));
+    }
+    if (result.status == QueryStatus::too_many_results) {
+        throw QueryError(fmt::format("request {}: more than {} results", id,
+                                     max_query_results));
+    }
+    if (result.status != QueryStatus::ok) {
+        throw QueryError(fmt::format("request {}: rejected by the server", id));
+    }
+    return result;
+}
+
+std::vector<Neighbor> QueryClient::knn(const VecXYZ &query, std::uint32_t k) {
+    QueryRequest request{};
+    request.kind = QueryKind::knn;
+    request.k = k;
+    request.a = query;
+    return call(request).neighbors;
+}
+
+std::vector<std::uint32_t> QueryClient::radius(const VecXYZ &center,
+                                               float radius) {
+    QueryRequest request{};
+    request.kind = QueryKind::radius;
+    request.radius = radius;
+    request.a = center;
+    return call(request).indices;
+}
+
+std::vector<std::uint32_t> QueryClient::box(const Aabb &box) {
+    QueryRequest request{};
+    request.kind = QueryKind::box;
+    request.a = box.min;
+    request.b = box.max;
+    return call(request).indices;
+}
+
+} // namespace vecxyz
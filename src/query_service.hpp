@@ -0,0 +1,213 @@
+#pragma once
+
+#include "kdtree.hpp"
+#include "knn.hpp"
+#include "point_stats.hpp"
+#include "vecxyz.hpp"
+#include <atomic>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/strand.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace vecxyz {
+
+// Query protocol. A request is a std::uint32_t body size and a QueryRequest
+// body; requests may be pipelined. Each gets one response: a std::uint32_t
+// body size, a QueryResponse and `count` results, which are Neighbor rows
+// for knn and std::uint32_t input indices otherwise. Responses come back
+// in completion order and are matched to requests by id. All integers and
+// floats are little-endian.
+enum class QueryKind : std::uint32_t {
+    knn = 0,    // the k points nearest `a`, nearest first
+    radius = 1, // points within `radius` of `a`, by index
+    box = 2,    // points inside the box [a, b], by index
+};
+
+enum class QueryStatus : std::uint32_t {
+    ok = 0,
+    bad_request = 1,
+    too_many_results = 2, // more than max_query_results points matched
+};
+
+struct QueryRequest {
+    std::uint64_t id;
+    QueryKind kind;
+    std::uint32_t k;
+    float radius;
+    VecXYZ a;
+    VecXYZ b;
+    std::uint32_t reserved;
+};
+static_assert(sizeof(QueryRequest) == 48, "request layout is on the wire");
+
+struct QueryResponse {
+    std::uint64_t id;
+    QueryKind kind;
+    QueryStatus status;
+    std::uint32_t count;
+    std::uint32_t reserved;
+};
+static_assert(sizeof(QueryResponse) == 24, "response layout is on the wire");
+
+constexpr std::uint32_t max_query_k = 4096;
+// Most points a radius or box query may return; a response is framed by
+// a 32-bit size, and one client must not make the server hold gigabytes.
+constexpr std::uint32_t max_query_results = 1U << 20U;
+static_assert(sizeof(QueryResponse) + std::uint64_t{max_query_results} *
+                      sizeof(std::uint32_t) <=
+                  std::numeric_limits<std::uint32_t>::max(),
+              "results must fit a response frame");
+
+class QueryError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// When the engine stops collecting requests and runs a batch: once
+// `max_batch` are pending, or once the oldest has waited `max_wait`.
+// max_wait trades single-query latency for throughput under load; 0 runs
+// whatever is pending as soon as the engine is free.
+struct QueryBatchPolicy {
+    std::size_t max_batch = 1024;
+    std::chrono::microseconds max_wait{200};
+};
+
+struct QueryEngineStats {
+    std::uint64_t batches;
+    std::uint64_t queries;
+};
+
+// The results of one query. Only the vector matching `kind` is filled.
+struct QueryResult {
+    std::uint64_t id{};
+    QueryKind kind{};
+    QueryStatus status{};
+    std::vector<Neighbor> neighbors;
+    std::vector<std::uint32_t> indices;
+};
+
+// Answers queries over a fixed point set from a KdTree, in batches.
+// Requests submitted from any thread are queued; a dispatcher thread
+// collects them according to the policy and runs each batch on the
+// parallel kernels: knn queries sharing a k go through one KdTree::knn
+// call, range queries are spread with parallel_for. Completions are called
+// on the dispatcher thread, after the whole batch; they must not throw and
+// should hand their result off rather than block.
+class QueryEngine {
+  public:
+    using Completion = std::function<void(QueryResult &&)>;
+
+    QueryEngine(const VecXYZ *points, std::size_t count,
+                QueryBatchPolicy policy = {});
+    // Answers what is still queued, then stops.
+    ~QueryEngine();
+    QueryEngine(const QueryEngine &) = delete;
+    QueryEngine &operator=(const QueryEngine &) = delete;
+
+    std::size_t size() const { return tree_.size(); }
+    const QueryBatchPolicy &policy() const { return policy_; }
+
+    // Thread-safe. Malformed requests complete with bad_request.
+    void submit(const QueryRequest &request, Completion done);
+
+    // Blocking single query; fine for tests, wasteful under load.
+    QueryResult query(const QueryRequest &request);
+
+    QueryEngineStats stats() const;
+
+  private:
+    struct Pending {
+        QueryRequest request;
+        Completion done;
+        std::chrono::steady_clock::time_point arrived;
+    };
+
+    void dispatch();
+    void run_batch(std::vector<Pending> &batch);
+
+    KdTree tree_;
+    QueryBatchPolicy policy_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Pending> queue_;
+    bool stopping_{};
+    std::atomic<std::uint64_t> batches_{0};
+    std::atomic<std::uint64_t> queries_{0};
+    std::thread dispatcher_;
+};
+
+// Serves a QueryEngine over TCP. Every connection reads requests as they
+// come and submits each to the engine, so concurrent clients and pipelined
+// requests share batches. Responses are written from the connection's
+// strand, each as one gathered write of its header and result rows.
+// A connection stops reading while its requests could produce more than
+// a fixed budget of response bytes: each counts as its largest possible
+// response until it completes, then as its actual one until written.
+// Sockets use TCP_NODELAY.
+//
+// Completions queued in the engine hold on to their connections, so tear
+// down in this order: stop the io_context, destroy the engine, then the
+// io_context.
+class QueryServer {
+  public:
+    QueryServer(boost::asio::io_context &io,
+                const boost::asio::ip::tcp::endpoint &endpoint,
+                QueryEngine &engine);
+    QueryServer(const QueryServer &) = delete;
+    QueryServer &operator=(const QueryServer &) = delete;
+
+    boost::asio::ip::tcp::endpoint local_endpoint() const;
+
+    // Stops accepting; open connections finish when their clients leave.
+    // Thread-safe.
+    void close();
+
+  private:
+    class Session;
+
+    void accept();
+
+    boost::asio::io_context &io_;
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    QueryEngine &engine_;
+};
+
+// Blocking client for a QueryServer. send() and receive() pipeline
+// requests; the convenience calls send one and wait for its response, so
+// they need every earlier response to have been received.
+// Socket errors are thrown as boost::system::system_error, malformed
+// responses as QueryError.
+class QueryClient {
+  public:
+    QueryClient(boost::asio::io_context &io,
+                const boost::asio::ip::tcp::endpoint &server);
+
+    // Sends the request with a fresh id, which is returned.
+    std::uint64_t send(QueryRequest request);
+    // The next response, whichever request it answers.
+    QueryResult receive();
+
+    std::vector<Neighbor> knn(const VecXYZ &query, std::uint32_t k);
+    std::vector<std::uint32_t> radius(const VecXYZ &center, float radius);
+    std::vector<std::uint32_t> box(const Aabb &box);
+
+  private:
+    QueryResult call(const QueryRequest &request);
+
+    boost::asio::ip::tcp::socket socket_;
+    std::uint64_t next_id_{1};
+};
+
+} // namespace vecxyz
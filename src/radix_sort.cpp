@@ -0,0 +1,75 @@
+#include "radix_sort.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <array>
+
+namespace vecxyz {
+namespace {
+constexpr std::size_t points_per_block = std::size_t{1} << 16U;
+
+using Histogram = std::array<std::size_t, 256>;
+} // namespace
+
+void radix_sort(std::vector<KeyIndex> &items, unsigned key_bits) {
+    const std::size_t count = items.size();
+    if (count < 2) {
+        return;
+    }
+    const std::size_t blocks = std::clamp<std::size_t>(
+        count / points_per_block, 1, parallel_concurrency() * 2);
+    auto block_begin = [&](std::size_t b) { return b * count / blocks; };
+
+    std::vector<KeyIndex> scratch(count);
+    KeyIndex *src = items.data();
+    KeyIndex *dst = scratch.data();
+    std::vector<Histogram> counts(blocks);
+
+    const unsigned passes = (std::min(key_bits, 64U) + 7) / 8;
+    for (unsigned pass = 0; pass < passes; ++pass) {
+        const unsigned shift = pass * 8;
+        parallel_for(blocks, 1, [&](std::size_t first, std::size_t last) {
+            for (std::size_t b = first; b < last; ++b) {
+                Histogram &h = counts[b];
+                h.fill(0);
+                for (std::size_t i = block_begin(b); i < block_begin(b + 1);
+                     ++i) {
+                    ++h[(src[i].key >> shift) & 0xFFU];
+                }
+            }
+        });
+
+        // Exclusive prefix over (digit, block), which keeps the sort stable.
+        std::size_t running = 0;
+        bool single_digit = false;
+        for (std::size_t digit = 0; digit < 256; ++digit) {
+            std::size_t digit_total = 0;
+            for (auto &h : counts) {
+                const std::size_t n = h[digit];
+                h[digit] = running;
+                running += n;
+                digit_total += n;
+            }
+            single_digit = single_digit || digit_total == count;
+        }
+        if (single_digit) {
+            continue;
+        }
+
+        parallel_for(blocks, 1, [&](std::size_t first, std::size_t last) {
+            for (std::size_t b = first; b < last; ++b) {
+                Histogram &offset = counts[b];
+                for (std::size_t i = block_begin(b); i < block_begin(b + 1);
+                     ++i) {
+                    dst[offset[(src[i].key >> shift) & 0xFFU]++] = src[i];
+                }
+            }
+        });
+        std::swap(src, dst);
+    }
+
+    if (src != items.data()) {
+        items.swap(scratch);
+    }
+}
+
+} // namespace vecxyz
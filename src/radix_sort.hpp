@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vecxyz {
+
+// Sort record for grouping points by a computed key (voxel, Morton code).
+struct KeyIndex {
+    std::uint64_t key;
+    std::uint32_t index;
+};
+
+// Stable LSD radix sort on the low `key_bits` bits of the key, one byte per
+// pass. Large inputs histogram and scatter in parallel blocks; passes where
+// every key has the same digit are skipped.
+void radix_sort(std::vector<KeyIndex> &items, unsigned key_bits = 64);
+
+} // namespace vecxyz
@@ -0,0 +1,330 @@
+#include "shm_ring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <fmt/core.h>
+#include <new>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#endif
+
+namespace vecxyz {
+namespace bip = boost::interprocess;
+
+namespace {
+constexpr char ring_magic[8] = {'V', 'X', 'Y', 'Z', 'R', 'N', 'G', '1'};
+constexpr std::uint32_t ring_version = 1;
+// Set in `reserved` by close(), so no reservation can slip in after it.
+constexpr std::uint64_t closed_bit = std::uint64_t{1} << 63U;
+
+using Word = std::atomic<std::uint32_t>;
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                  Word::is_always_lock_free,
+              "ring indices are shared between processes");
+static_assert(sizeof(Word) == sizeof(std::uint32_t), "futex word");
+
+void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Shared memory futexes: no FUTEX_PRIVATE_FLAG, since the waiters live in
+// other processes.
+#ifdef __linux__
+void futex_wait(Word &word, std::uint32_t expected) {
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT,
+            expected, nullptr, nullptr, 0);
+}
+
+void futex_wake_all(Word &word) {
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE,
+            INT_MAX, nullptr, nullptr, 0);
+}
+#else
+void futex_wait(Word &word, std::uint32_t expected) {
+    if (word.load() == expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+void futex_wake_all(Word &) {}
+#endif
+
+// A futex sequence word plus the number of threads sleeping on it.
+struct Event {
+    Word sequence{0};
+    Word sleepers{0};
+
+    // Spins on ready() up to spin_limit times, then sleeps until notify().
+    // Registering as a sleeper before the final ready() check, and
+    // notify() bumping the sequence before it looks for sleepers, means a
+    // notification is either seen by that check or ends the futex wait.
+    template <class Ready> void wait(unsigned spin_limit, const Ready &ready) {
+        for (unsigned i = 0; i < spin_limit; ++i) {
+            if (ready()) {
+                return;
+            }
+            cpu_relax();
+        }
+        for (;;) {
+            const std::uint32_t sequence_seen = sequence.load();
+            if (ready()) {
+                return;
+            }
+            sleepers.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            struct Leave {
+                Word &sleepers;
+                ~Leave() { sleepers.fetch_sub(1); }
+            } leave{sleepers};
+            if (ready()) {
+                return;
+            }
+            futex_wait(sequence, sequence_seen);
+        }
+    }
+
+    void notify() {
+        sequence.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load() != 0) {
+            futex_wake_all(sequence);
+        }
+    }
+};
+} // namespace
+
+struct ShmRing::Shared {
+    // Written once by the creator; `ready` is set last.
+    alignas(64) char magic[8];
+    std::uint32_t version;
+    std::uint64_t capacity;
+    Word ready{0};
+
+    // Producers: the end of the reserved slots, and the end of the slots
+    // committed for the consumer. `data` is notified on commit and close.
+    alignas(64) std::atomic<std::uint64_t> reserved{0};
+    std::atomic<std::uint64_t> committed{0};
+    Event data;
+
+    // Consumer: the first unreleased slot. `space` is notified on release.
+    alignas(64) std::atomic<std::uint64_t> head{0};
+    Event space;
+};
+
+ShmRing::ShmRing(bip::create_only_t, const std::string &name,
+                 std::size_t capacity, unsigned spin_limit)
+    : spin_limit_(spin_limit) {
+    capacity_ = 1;
+    while (capacity_ < capacity) {
+        capacity_ *= 2;
+    }
+    try {
+        memory_ = bip::shared_memory_object(bip::create_only, name.c_str(),
+                                            bip::read_write);
+        memory_.truncate(static_cast<bip::offset_t>(
+            sizeof(Shared) + capacity_ * sizeof(VecXYZ)));
+        region_ = bip::mapped_region(memory_, bip::read_write);
+    } catch (const bip::interprocess_exception &e) {
+        throw ShmRingError(fmt::format("{}: {}", name, e.what()));
+    }
+    auto *shared = new (region_.get_address()) Shared;
+    std::memcpy(shared->magic, ring_magic, sizeof(ring_magic));
+    shared->version = ring_version;
+    shared->capacity = capacity_;
+    shared->ready.store(1, std::memory_order_release);
+    attach();
+}
+
+ShmRing::ShmRing(bip::open_only_t, const std::string &name,
+                 unsigned spin_limit)
+    : spin_limit_(spin_limit) {
+    try {
+        memory_ = bip::shared_memory_object(bip::open_only, name.c_str(),
+                                            bip::read_write);
+        region_ = bip::mapped_region(memory_, bip::read_write);
+    } catch (const bip::interprocess_exception &e) {
+        throw ShmRingError(fmt::format("{}: {}", name, e.what()));
+    }
+    const auto *shared = static_cast<const Shared *>(region_.get_address());
+    if (region_.get_size() < sizeof(Shared) ||
+        shared->ready.load(std::memory_order_acquire) == 0) {
+        throw ShmRingError(fmt::format("{}: ring not initialized", name));
+    }
+    if (std::memcmp(shared->magic, ring_magic, sizeof(ring_magic)) != 0 ||
+        shared->version != ring_version) {
+        throw ShmRingError(fmt::format("{}: not a point ring", name));
+    }
+    capacity_ = shared->capacity;
+    if (capacity_ == 0 || (capacity_ & (capacity_ - 1)) != 0 ||
+        capacity_ > (region_.get_size() - sizeof(Shared)) / sizeof(VecXYZ)) {
+        throw ShmRingError(
+            fmt::format("{}: bad ring capacity {}", name, capacity_));
+    }
+    attach();
+}
+
+void ShmRing::attach() {
+    static_assert(sizeof(Shared) % 64 == 0, "slots start on a cache line");
+    auto *base = static_cast<char *>(region_.get_address());
+    shared_ = reinterpret_cast<Shared *>(base);
+    slots_ = reinterpret_cast<VecXYZ *>(base + sizeof(Shared));
+}
+
+bool ShmRing::remove(const std::string &name) {
+    return bip::shared_memory_object::remove(name.c_str());
+}
+
+RingBatch ShmRing::slots(std::uint64_t start, std::size_t count) const {
+    const std::size_t first = start & (capacity_ - 1);
+    const std::size_t n = std::min(count, capacity_ - first);
+    RingBatch batch;
+    batch.parts[0] = {slots_ + first, n};
+    batch.parts[1] = {slots_, count - n};
+    batch.start = start;
+    return batch;
+}
+
+std::size_t ShmRing::available() const {
+    return shared_->committed.load(std::memory_order_acquire) -
+           shared_->head.load(std::memory_order_relaxed);
+}
+
+std::size_t ShmRing::size() const {
+    const std::uint64_t head = shared_->head.load(std::memory_order_acquire);
+    return shared_->committed.load(std::memory_order_acquire) - head;
+}
+
+bool ShmRing::closed() const {
+    return (shared_->reserved.load() & closed_bit) != 0;
+}
+
+bool ShmRing::claim(std::size_t count, std::uint64_t &start) {
+    std::uint64_t tail = shared_->reserved.load(std::memory_order_relaxed);
+    for (;;) {
+        if ((tail & closed_bit) != 0) {
+            throw ShmRingError("reserve on a closed ring");
+        }
+        const std::uint64_t head =
+            shared_->head.load(std::memory_order_acquire);
+        if (tail + count - head > capacity_) {
+            return false;
+        }
+        if (shared_->reserved.compare_exchange_weak(
+                tail, tail + count, std::memory_order_acq_rel,
+                std::memory_order_relaxed)) {
+            start = tail;
+            return true;
+        }
+    }
+}
+
+RingBatch ShmRing::try_reserve(std::size_t count) {
+    if (count > capacity_) {
+        throw std::length_error("ring reservation larger than the ring");
+    }
+    std::uint64_t start = 0;
+    if (count == 0 || !claim(count, start)) {
+        return {};
+    }
+    return slots(start, count);
+}
+
+RingBatch ShmRing::reserve(std::size_t count) {
+    if (count > capacity_) {
+        throw std::length_error("ring reservation larger than the ring");
+    }
+    if (count == 0) {
+        return {};
+    }
+    std::uint64_t start = 0;
+    shared_->space.wait(spin_limit_, [&] { return claim(count, start); });
+    return slots(start, count);
+}
+
+void ShmRing::commit(const RingBatch &batch) {
+    if (batch.empty()) {
+        return;
+    }
+    // Earlier reservations are published first; their producers are
+    // filling them right now, so this rarely has to sleep.
+    shared_->data.wait(spin_limit_, [&] {
+        return shared_->committed.load(std::memory_order_acquire) ==
+               batch.start;
+    });
+    shared_->committed.store(batch.start + batch.size());
+    shared_->data.notify();
+}
+
+void ShmRing::push(const VecXYZ *points, std::size_t count) {
+    while (count != 0) {
+        const std::size_t n = std::min(count, capacity_);
+        const RingBatch batch = reserve(n);
+        std::copy_n(points, batch.parts[0].size, batch.parts[0].data);
+        std::copy_n(points + batch.parts[0].size, batch.parts[1].size,
+                    batch.parts[1].data);
+        commit(batch);
+        points += n;
+        count -= n;
+    }
+}
+
+RingBatch ShmRing::try_acquire(std::size_t max_count) {
+    const std::size_t n = std::min(available(), max_count);
+    if (n == 0) {
+        return {};
+    }
+    return slots(shared_->head.load(std::memory_order_relaxed), n);
+}
+
+RingBatch ShmRing::acquire(std::size_t max_count) {
+    if (max_count == 0) {
+        return {};
+    }
+    // Drained means closed with every reservation committed and read.
+    shared_->data.wait(spin_limit_, [&] {
+        if (available() != 0) {
+            return true;
+        }
+        const std::uint64_t reserved = shared_->reserved.load();
+        return (reserved & closed_bit) != 0 &&
+               (reserved & ~closed_bit) == shared_->committed.load();
+    });
+    return try_acquire(max_count);
+}
+
+void ShmRing::release(const RingBatch &batch) {
+    if (batch.empty()) {
+        return;
+    }
+    if (batch.start != shared_->head.load(std::memory_order_relaxed)) {
+        throw ShmRingError("ring batches released out of order");
+    }
+    shared_->head.store(batch.start + batch.size());
+    shared_->space.notify();
+}
+
+std::size_t ShmRing::pop(VecXYZ *out, std::size_t max_count) {
+    const RingBatch batch = acquire(max_count);
+    std::copy_n(batch.parts[0].data, batch.parts[0].size, out);
+    std::copy_n(batch.parts[1].data, batch.parts[1].size,
+                out + batch.parts[0].size);
+    release(batch);
+    return batch.size();
+}
+
+void ShmRing::close() {
+    shared_->reserved.fetch_or(closed_bit);
+    shared_->data.notify();
+    shared_->space.notify();
+}
+
+} // namespace vecxyz
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <boost/interprocess/creation_tags.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace vecxyz {
+
+class ShmRingError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// A run of ring slots. A batch wraps around the end of the ring at most
+// once, so it is made of up to two slices.
+struct RingSlice {
+    VecXYZ *data{};
+    std::size_t size{};
+};
+
+struct RingBatch {
+    std::array<RingSlice, 2> parts{};
+    std::uint64_t start{}; // ring position of parts[0].data
+
+    std::size_t size() const { return parts[0].size + parts[1].size; }
+    bool empty() const { return size() == 0; }
+};
+
+// Bounded ring of VecXYZ in a named shared memory object, for streaming
+// points from producer processes to one consumer process without copying
+// through a file or socket.
+//
+// Producers reserve a batch of slots, fill it in place and commit it.
+// Reservations are claimed with a CAS, so any number of producer threads
+// and processes may share the ring (a lone producer never retries), and
+// are published in reservation order. The single consumer acquires
+// whatever has been committed, reads it in place and releases it. The
+// producer and consumer indices sit on separate cache lines. Blocking
+// calls spin for a while and then sleep on a futex in the shared memory
+// (Linux; elsewhere they poll), and each side only makes the wake-up
+// system call when the other side is actually asleep.
+class ShmRing {
+  public:
+    static constexpr unsigned default_spin_limit = 2048;
+
+    // Creates the shared memory object `name` with room for at least
+    // `capacity` points (rounded up to a power of two). Throws ShmRingError
+    // if it already exists.
+    ShmRing(boost::interprocess::create_only_t, const std::string &name,
+            std::size_t capacity, unsigned spin_limit = default_spin_limit);
+    // Opens a ring created by another handle.
+    ShmRing(boost::interprocess::open_only_t, const std::string &name,
+            unsigned spin_limit = default_spin_limit);
+
+    // Removes the name; existing mappings stay valid.
+    static bool remove(const std::string &name);
+
+    std::size_t capacity() const { return capacity_; }
+    // Committed points not yet released by the consumer.
+    std::size_t size() const;
+
+    // Producer side. reserve() blocks until `count` slots are free and
+    // throws ShmRingError once the ring is closed; try_reserve() returns an
+    // empty batch instead of blocking. Throws std::length_error above
+    // capacity(). Every reservation must be committed.
+    RingBatch reserve(std::size_t count);
+    RingBatch try_reserve(std::size_t count);
+    void commit(const RingBatch &batch);
+    // Copies `count` points in, in batches of at most capacity().
+    void push(const VecXYZ *points, std::size_t count);
+
+    // Consumer side. acquire() blocks until something is committed and
+    // returns up to `max_count` points; it returns an empty batch once the
+    // ring is closed and drained. Batches must be released in order.
+    RingBatch acquire(std::size_t max_count);
+    RingBatch try_acquire(std::size_t max_count);
+    void release(const RingBatch &batch);
+    // Copies up to `max_count` points out; returns 0 once closed and
+    // drained.
+    std::size_t pop(VecXYZ *out, std::size_t max_count);
+
+    // No more reservations; the consumer drains what was committed.
+    void close();
+    bool closed() const;
+
+  private:
+    struct Shared;
+
+    void attach();
+    RingBatch slots(std::uint64_t start, std::size_t count) const;
+    bool claim(std::size_t count, std::uint64_t &start);
+    std::size_t available() const;
+
+    boost::interprocess::shared_memory_object memory_;
+    boost::interprocess::mapped_region region_;
+    Shared *shared_{};
+    VecXYZ *slots_{};
+    std::size_t capacity_{};
+    unsigned spin_limit_;
+};
+
+} // namespace vecxyz
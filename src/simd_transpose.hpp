@@ -0,0 +1,52 @@
+#pragma once
+
+#include "vecxyz.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define VECXYZ_HAS_SSE 1
+#endif
+
+namespace vecxyz {
+
+#ifdef VECXYZ_HAS_SSE
+// Four packed points (x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3) to one
+// register per component.
+inline void load_transpose4(const VecXYZ *points, __m128 &x, __m128 &y,
+                            __m128 &z) {
+    const auto *f = reinterpret_cast<const float *>(points);
+    const __m128 a = _mm_loadu_ps(f);
+    const __m128 b = _mm_loadu_ps(f + 4);
+    const __m128 c = _mm_loadu_ps(f + 8);
+
+    const __m128 b2c1 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+    x = _mm_shuffle_ps(a, b2c1, _MM_SHUFFLE(2, 0, 3, 0));
+
+    const __m128 a1b0 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+    const __m128 b3c2 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+    y = _mm_shuffle_ps(a1b0, b3c2, _MM_SHUFFLE(2, 0, 2, 0));
+
+    const __m128 a2b1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+    const __m128 c0c3 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+    z = _mm_shuffle_ps(a2b1, c0c3, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+// Inverse of load_transpose4.
+inline void transpose_store4(__m128 x, __m128 y, __m128 z, VecXYZ *points) {
+    auto *f = reinterpret_cast<float *>(points);
+
+    const __m128 x0y0 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 0, 0, 0));
+    const __m128 z0x1 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+    _mm_storeu_ps(f, _mm_shuffle_ps(x0y0, z0x1, _MM_SHUFFLE(2, 0, 2, 0)));
+
+    const __m128 y1z1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128 x2y2 = _mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2));
+    _mm_storeu_ps(f + 4, _mm_shuffle_ps(y1z1, x2y2, _MM_SHUFFLE(2, 0, 2, 0)));
+
+    const __m128 z2x3 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+    const __m128 y3z3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(f + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+#endif
+
+} // namespace vecxyz
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "aligned_allocator.hpp"
+#include <boost/pfr.hpp>
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/collection_size_type.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace vecxyz {
+
+// Struct-of-arrays container for an aggregate T. Boost.PFR gives the
+// fields of T at compile time and each one gets its own aligned column, so
+// SoA<VecXYZ> holds x, y and z in three separate float arrays without a
+// handwritten layout. Elements are read and written through proxy
+// references, and the archive form streams whole columns.
+template <class T, std::size_t Alignment = 64> class SoA {
+    static_assert(std::is_aggregate_v<T>, "SoA needs an aggregate type");
+
+  public:
+    using value_type = T;
+    static constexpr std::size_t field_count = boost::pfr::tuple_size_v<T>;
+
+    template <std::size_t I>
+    using field_type = boost::pfr::tuple_element_t<I, T>;
+
+    template <class F>
+    using column_type = std::vector<F, AlignedAllocator<F, Alignment>>;
+
+  private:
+    template <std::size_t... I>
+    static auto make_columns(std::index_sequence<I...>)
+        -> std::tuple<column_type<field_type<I>>...>;
+
+    using columns_type =
+        decltype(make_columns(std::make_index_sequence<field_count>{}));
+
+    template <class Fn> static void for_each_field(Fn &&fn) {
+        for_each_field(std::forward<Fn>(fn),
+                       std::make_index_sequence<field_count>{});
+    }
+
+    template <class Fn, std::size_t... I>
+    static void for_each_field(Fn &&fn, std::index_sequence<I...>) {
+        (fn(std::integral_constant<std::size_t, I>{}), ...);
+    }
+
+  public:
+    // Stands in for T& (or const T& when Owner is const).
+    template <class Owner> class basic_reference {
+      public:
+        basic_reference(Owner &owner, std::size_t index)
+            : owner_(&owner), index_(index) {}
+
+        template <std::size_t I> decltype(auto) get() const {
+            return owner_->template column<I>()[index_];
+        }
+
+        operator T() const { return owner_->load(index_); }
+
+        template <class O = Owner,
+                  std::enable_if_t<!std::is_const_v<O>, int> = 0>
+        basic_reference &operator=(const T &value) {
+            owner_->store(index_, value);
+            return *this;
+        }
+
+        // Assigns the element, like T& would; it never rebinds the proxy.
+        basic_reference &operator=(const basic_reference &other) {
+            static_assert(!std::is_const_v<Owner>,
+                          "cannot assign through a const reference");
+            owner_->store(index_, static_cast<T>(other));
+            return *this;
+        }
+        basic_reference(const basic_reference &) = default;
+
+      private:
+        Owner *owner_;
+        std::size_t index_;
+    };
+
+    using reference = basic_reference<SoA>;
+    using const_reference = basic_reference<const SoA>;
+
+    SoA() = default;
+    explicit SoA(std::size_t count) { resize(count); }
+    template <class InputIt> SoA(InputIt first, InputIt last) {
+        for (; first != last; ++first) {
+            push_back(*first);
+        }
+    }
+
+    std::size_t size() const { return std::get<0>(columns_).size(); }
+    bool empty() const { return size() == 0; }
+
+    void reserve(std::size_t count) {
+        for_each_field([&](auto i) { std::get<i>(columns_).reserve(count); });
+    }
+    void resize(std::size_t count) {
+        for_each_field([&](auto i) { std::get<i>(columns_).resize(count); });
+    }
+    void clear() {
+        for_each_field([&](auto i) { std::get<i>(columns_).clear(); });
+    }
+
+    void push_back(const T &value) {
+        for_each_field([&](auto i) {
+            std::get<i>(columns_).push_back(boost::pfr::get<i>(value));
+        });
+    }
+
+    reference operator[](std::size_t index) { return {*this, index}; }
+    const_reference operator[](std::size_t index) const {
+        return {*this, index};
+    }
+
+    T load(std::size_t index) const {
+        T value{};
+        for_each_field([&](auto i) {
+            boost::pfr::get<i>(value) = std::get<i>(columns_)[index];
+        });
+        return value;
+    }
+
+    void store(std::size_t index, const T &value) {
+        for_each_field([&](auto i) {
+            std::get<i>(columns_)[index] = boost::pfr::get<i>(value);
+        });
+    }
+
+    template <std::size_t I> column_type<field_type<I>> &column() {
+        return std::get<I>(columns_);
+    }
+    template <std::size_t I> const column_type<field_type<I>> &column() const {
+        return std::get<I>(columns_);
+    }
+
+  private:
+    friend class boost::serialization::access;
+
+    template <class Archive> void save(Archive &ar, const unsigned int) const {
+        const boost::serialization::collection_size_type count(size());
+        ar << count;
+        for_each_field([&](auto i) {
+            ar << boost::serialization::make_array(
+                std::get<i>(columns_).data(), size());
+        });
+    }
+
+    template <class Archive> void load(Archive &ar, const unsigned int) {
+        boost::serialization::collection_size_type count;
+        ar >> count;
+        resize(count);
+        for_each_field([&](auto i) {
+            ar >> boost::serialization::make_array(
+                std::get<i>(columns_).data(), size());
+        });
+    }
+
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    columns_type columns_;
+};
+
+} // namespace vecxyz
@@ -0,0 +1,277 @@
+#include "task_scheduler.hpp"
+#include "chase_lev_deque.hpp"
+#include <algorithm>
+#include <cassert>
+#include <exception>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace vecxyz {
+namespace {
+// Failed searches before an idle worker goes to sleep, and before a
+// joining worker starts yielding its time slice.
+constexpr unsigned idle_spins = 256;
+
+void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+void pin_to_cpu(std::size_t index) {
+#ifdef __linux__
+    const std::size_t cpus =
+        std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<int>(index % cpus), &set);
+    // Best effort: a restricted affinity mask just leaves the thread free.
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    static_cast<void>(index);
+#endif
+}
+} // namespace
+
+struct TaskScheduler::Task {
+    explicit Task(TaskFn f) : fn(f) {}
+
+    TaskFn fn;
+    std::atomic<bool> done{false};
+    std::exception_ptr error;
+    // Set for jobs from outside threads, which sleep instead of helping.
+    std::mutex *waiter_mutex{};
+    std::condition_variable *waiter_cv{};
+};
+
+struct TaskScheduler::Worker {
+    explicit Worker(TaskScheduler *o, std::uint64_t seed)
+        : owner(o), random(seed) {}
+
+    // xorshift64, for picking victims.
+    std::size_t next_victim(std::size_t count) {
+        random ^= random << 13U;
+        random ^= random >> 7U;
+        random ^= random << 17U;
+        return static_cast<std::size_t>(random % count);
+    }
+
+    TaskScheduler *owner;
+    ChaseLevDeque<Task *> deque;
+    std::uint64_t random;
+};
+
+thread_local TaskScheduler::Worker *TaskScheduler::current_ = nullptr;
+
+TaskScheduler::TaskScheduler(const SchedulerOptions &options) {
+    const std::size_t count =
+        options.threads != 0
+            ? options.threads
+            : std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+    for (std::size_t i = 0; i < count; ++i) {
+        workers_.push_back(
+            std::make_unique<Worker>(this, 0x9e3779b97f4a7c15ULL * (i + 1)));
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        threads_.emplace_back([this, i, pin = options.pin_threads] {
+            work(*workers_[i], i, pin);
+        });
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    stop_.store(true);
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        ++wake_epoch_;
+    }
+    park_cv_.notify_all();
+    for (auto &t : threads_) {
+        t.join();
+    }
+}
+
+bool TaskScheduler::on_worker() const {
+    return current_ != nullptr && current_->owner == this;
+}
+
+void TaskScheduler::work(Worker &self, std::size_t index, bool pin) {
+    current_ = &self;
+    if (pin) {
+        pin_to_cpu(index);
+    }
+    unsigned idle = 0;
+    while (!stop_.load(std::memory_order_acquire)) {
+        if (Task *task = find_task(self)) {
+            execute(*task);
+            idle = 0;
+        } else if (++idle < idle_spins) {
+            cpu_relax();
+        } else {
+            park();
+            idle = 0;
+        }
+    }
+    current_ = nullptr;
+}
+
+TaskScheduler::Task *TaskScheduler::find_task(Worker &self) {
+    Task *task = nullptr;
+    if (self.deque.pop(task)) {
+        return task;
+    }
+    const std::size_t count = workers_.size();
+    const std::size_t first = self.next_victim(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        Worker &victim = *workers_[(first + i) % count];
+        if (&victim != &self && victim.deque.steal(task)) {
+            return task;
+        }
+    }
+    if (injected_count_.load(std::memory_order_relaxed) != 0) {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        if (!injected_.empty()) {
+            task = injected_.front();
+            injected_.pop_front();
+            injected_count_.fetch_sub(1, std::memory_order_relaxed);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void TaskScheduler::execute(Task &task) {
+    try {
+        task.fn();
+    } catch (...) {
+        task.error = std::current_exception();
+    }
+    if (task.waiter_mutex != nullptr) {
+        // Notify under the lock: the waiter owns the task and may destroy
+        // it as soon as it can see `done`.
+        std::lock_guard<std::mutex> lock(*task.waiter_mutex);
+        task.done.store(true, std::memory_order_release);
+        task.waiter_cv->notify_one();
+    } else {
+        task.done.store(true, std::memory_order_release);
+    }
+}
+
+void TaskScheduler::help_until(Worker &self, const Task &task) {
+    unsigned idle = 0;
+    while (!task.done.load(std::memory_order_acquire)) {
+        if (Task *other = find_task(self)) {
+            execute(*other);
+            idle = 0;
+        } else if (++idle < idle_spins) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void TaskScheduler::park() {
+    std::unique_lock<std::mutex> lock(park_mutex_);
+    const std::uint64_t epoch = wake_epoch_;
+    // Pairs with the fence in wake_one(): either a pusher sees this
+    // sleeper, or the check below sees its work.
+    sleepers_.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!stop_.load() && !has_visible_work()) {
+        park_cv_.wait(lock, [&] { return wake_epoch_ != epoch || stop_; });
+    }
+    sleepers_.fetch_sub(1);
+}
+
+void TaskScheduler::wake_one() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        ++wake_epoch_;
+    }
+    park_cv_.notify_one();
+}
+
+bool TaskScheduler::has_visible_work() const {
+    if (injected_count_.load() != 0) {
+        return true;
+    }
+    return std::any_of(workers_.begin(), workers_.end(),
+                       [](const auto &w) { return !w->deque.empty(); });
+}
+
+void TaskScheduler::run(TaskFn fn) {
+    if (on_worker()) {
+        fn();
+        return;
+    }
+    Task task(fn);
+    std::mutex mutex;
+    std::condition_variable finished;
+    task.waiter_mutex = &mutex;
+    task.waiter_cv = &finished;
+    {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        injected_.push_back(&task);
+        injected_count_.fetch_add(1);
+    }
+    wake_one();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return task.done.load(); });
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+void TaskScheduler::fork_join(TaskFn a, TaskFn b) {
+    Worker *self = current_;
+    if (self == nullptr || self->owner != this) {
+        struct Fork {
+            TaskScheduler *scheduler;
+            TaskFn a;
+            TaskFn b;
+        } fork{this, a, b};
+        run({[](void *context) {
+                 auto *f = static_cast<Fork *>(context);
+                 f->scheduler->fork_join(f->a, f->b);
+             },
+             &fork});
+        return;
+    }
+
+    Task task(b);
+    self->deque.push(&task);
+    wake_one();
+    std::exception_ptr error;
+    try {
+        a();
+    } catch (...) {
+        error = std::current_exception();
+    }
+    // Whatever a forked has been joined, so b is at the bottom unless a
+    // thief took it (and with it everything older).
+    Task *popped = nullptr;
+    if (self->deque.pop(popped)) {
+        assert(popped == &task);
+        execute(task);
+    } else {
+        help_until(*self, task);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+} // namespace vecxyz
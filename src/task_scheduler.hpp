@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vecxyz {
+
+struct SchedulerOptions {
+    // Worker threads; 0 means one per hardware thread.
+    std::size_t threads = 0;
+    // Bind worker i to CPU i (modulo the CPU count). Linux only; ignored
+    // elsewhere.
+    bool pin_threads = false;
+};
+
+// A type-erased call that does not own its context, so forking a task
+// never allocates.
+struct TaskFn {
+    void (*call)(void *);
+    void *context;
+
+    void operator()() const { call(context); }
+};
+
+// Fork-join scheduler with one Chase-Lev deque per worker. A worker pushes
+// the tasks it forks onto its own deque and pops them back newest first,
+// so recursive work stays depth first and cache warm; idle workers steal
+// the oldest task of a random victim, which is the largest piece of work
+// left there. Threads outside the pool hand their job to a worker through
+// a shared injection queue and block until it is done. Idle workers spin
+// briefly and then sleep until new work is pushed.
+class TaskScheduler {
+  public:
+    explicit TaskScheduler(const SchedulerOptions &options = {});
+    // Waits for the workers to exit; no work may be in flight.
+    ~TaskScheduler();
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    std::size_t concurrency() const { return workers_.size(); }
+    // Whether the calling thread is one of this scheduler's workers.
+    bool on_worker() const;
+
+    // Runs fn on a worker and returns once it finished, rethrowing what it
+    // threw. Called from a worker, runs fn inline.
+    void run(TaskFn fn);
+    // Runs a here and b wherever a worker is free; returns once both are
+    // done. If both throw, a's exception wins.
+    void fork_join(TaskFn a, TaskFn b);
+
+  private:
+    struct Task;
+    struct Worker;
+
+    void work(Worker &self, std::size_t index, bool pin);
+    Task *find_task(Worker &self);
+    void execute(Task &task);
+    void help_until(Worker &self, const Task &task);
+    void park();
+    void wake_one();
+    bool has_visible_work() const;
+
+    static thread_local Worker *current_;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex inject_mutex_;
+    std::deque<Task *> injected_;
+    std::atomic<std::size_t> injected_count_{0};
+
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+    std::uint64_t wake_epoch_{0}; // guarded by park_mutex_
+    std::atomic<std::size_t> sleepers_{0};
+    std::atomic<bool> stop_{false};
+};
+
+} // namespace vecxyz
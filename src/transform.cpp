@@ -0,0 +1,191 @@
+#include "transform.hpp"
+#include "parallel.hpp"
+#include "simd_transpose.hpp"
+
+namespace vecxyz {
+namespace {
+constexpr std::size_t parallel_threshold = std::size_t{1} << 15U;
+constexpr std::size_t parallel_grain = std::size_t{1} << 13U;
+
+template <class Kernel>
+void run_blocks(std::size_t count, const Kernel &kernel) {
+    if (count < parallel_threshold) {
+        kernel(0, count);
+        return;
+    }
+    parallel_for(count, parallel_grain, kernel);
+}
+
+VecXYZ apply(const Mat4 &m, const VecXYZ &p) {
+    return {m.m[0][0] * p.x + m.m[0][1] * p.y + m.m[0][2] * p.z + m.m[0][3],
+            m.m[1][0] * p.x + m.m[1][1] * p.y + m.m[1][2] * p.z + m.m[1][3],
+            m.m[2][0] * p.x + m.m[2][1] * p.y + m.m[2][2] * p.z + m.m[2][3]};
+}
+
+#ifdef VECXYZ_HAS_SSE
+struct MatLanes {
+    __m128 c[3][4];
+
+    explicit MatLanes(const Mat4 &m) {
+        for (int r = 0; r < 3; ++r) {
+            for (int k = 0; k < 4; ++k) {
+                c[r][k] = _mm_set1_ps(m.m[r][k]);
+            }
+        }
+    }
+
+    __m128 row(int r, __m128 x, __m128 y, __m128 z) const {
+        return _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(c[r][0], x), _mm_mul_ps(c[r][1], y)),
+            _mm_add_ps(_mm_mul_ps(c[r][2], z), c[r][3]));
+    }
+};
+#endif
+
+void transform_aos(const Mat4 &m, const VecXYZ *in, VecXYZ *out,
+                   std::size_t begin, std::size_t end) {
+    std::size_t i = begin;
+#ifdef VECXYZ_HAS_SSE
+    const MatLanes lanes(m);
+    for (; i + 4 <= end; i += 4) {
+        __m128 x;
+        __m128 y;
+        __m128 z;
+        load_transpose4(in + i, x, y, z);
+        transpose_store4(lanes.row(0, x, y, z), lanes.row(1, x, y, z),
+                         lanes.row(2, x, y, z), out + i);
+    }
+#endif
+    for (; i < end; ++i) {
+        out[i] = apply(m, in[i]);
+    }
+}
+
+void transform_soa(const Mat4 &m, ConstPointColumns in, PointColumns out,
+                   std::size_t begin, std::size_t end) {
+    std::size_t i = begin;
+#ifdef VECXYZ_HAS_SSE
+    const MatLanes lanes(m);
+    for (; i + 4 <= end; i += 4) {
+        const __m128 x = _mm_loadu_ps(in.x + i);
+        const __m128 y = _mm_loadu_ps(in.y + i);
+        const __m128 z = _mm_loadu_ps(in.z + i);
+        _mm_storeu_ps(out.x + i, lanes.row(0, x, y, z));
+        _mm_storeu_ps(out.y + i, lanes.row(1, x, y, z));
+        _mm_storeu_ps(out.z + i, lanes.row(2, x, y, z));
+    }
+#endif
+    for (; i < end; ++i) {
+        const VecXYZ p = apply(m, {in.x[i], in.y[i], in.z[i]});
+        out.x[i] = p.x;
+        out.y[i] = p.y;
+        out.z[i] = p.z;
+    }
+}
+
+VecXYZ cross(const VecXYZ &a, const VecXYZ &b) {
+    return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+            a.x * b.y - a.y * b.x};
+}
+} // namespace
+
+Mat4 Mat4::translation(const VecXYZ &offset) {
+    Mat4 r;
+    r.m[0][3] = offset.x;
+    r.m[1][3] = offset.y;
+    r.m[2][3] = offset.z;
+    return r;
+}
+
+Mat4 Mat4::rotation(const Quat &q) {
+    const float xx = q.x * q.x;
+    const float yy = q.y * q.y;
+    const float zz = q.z * q.z;
+    const float xy = q.x * q.y;
+    const float xz = q.x * q.z;
+    const float yz = q.y * q.z;
+    const float wx = q.w * q.x;
+    const float wy = q.w * q.y;
+    const float wz = q.w * q.z;
+
+    Mat4 r;
+    r.m[0][0] = 1 - 2 * (yy + zz);
+    r.m[0][1] = 2 * (xy - wz);
+    r.m[0][2] = 2 * (xz + wy);
+    r.m[1][0] = 2 * (xy + wz);
+    r.m[1][1] = 1 - 2 * (xx + zz);
+    r.m[1][2] = 2 * (yz - wx);
+    r.m[2][0] = 2 * (xz - wy);
+    r.m[2][1] = 2 * (yz + wx);
+    r.m[2][2] = 1 - 2 * (xx + yy);
+    return r;
+}
+
+Mat4 Mat4::rigid(const Quat &q, const VecXYZ &offset) {
+    Mat4 r = rotation(q);
+    r.m[0][3] = offset.x;
+    r.m[1][3] = offset.y;
+    r.m[2][3] = offset.z;
+    return r;
+}
+
+Mat4 operator*(const Mat4 &a, const Mat4 &b) {
+    Mat4 r;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            float sum = 0;
+            for (int k = 0; k < 4; ++k) {
+                sum += a.m[i][k] * b.m[k][j];
+            }
+            r.m[i][j] = sum;
+        }
+    }
+    return r;
+}
+
+void transform_points(const Mat4 &m, const VecXYZ *in, VecXYZ *out,
+                      std::size_t count) {
+    run_blocks(count, [&](std::size_t begin, std::size_t end) {
+        transform_aos(m, in, out, begin, end);
+    });
+}
+
+void transform_points(const Mat4 &m, ConstPointColumns in, PointColumns out,
+                      std::size_t count) {
+    run_blocks(count, [&](std::size_t begin, std::size_t end) {
+        transform_soa(m, in, out, begin, end);
+    });
+}
+
+// For a batch the 3x3 rotation matrix is cheaper than the quaternion
+// sandwich product: nine multiplies per point instead of about eighteen.
+void rotate_points(const Quat &q, const VecXYZ *in, VecXYZ *out,
+                   std::size_t count) {
+    transform_points(Mat4::rotation(q), in, out, count);
+}
+
+void rotate_points(const Quat &q, ConstPointColumns in, PointColumns out,
+                   std::size_t count) {
+    transform_points(Mat4::rotation(q), in, out, count);
+}
+
+void transform_points_reference(const Mat4 &m, const VecXYZ *in,
+                                VecXYZ *out, std::size_t count) {
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = apply(m, in[i]);
+    }
+}
+
+void rotate_points_reference(const Quat &q, const VecXYZ *in, VecXYZ *out,
+                             std::size_t count) {
+    const VecXYZ u{q.x, q.y, q.z};
+    for (std::size_t i = 0; i < count; ++i) {
+        const VecXYZ v = in[i];
+        const VecXYZ t = cross(u, v);
+        const VecXYZ tt = cross(u, t);
+        out[i] = {v.x + 2 * (q.w * t.x + tt.x), v.y + 2 * (q.w * t.y + tt.y),
+                  v.z + 2 * (q.w * t.z + tt.z)};
+    }
+}
+
+} // namespace vecxyz
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "soa.hpp"
+#include "vecxyz.hpp"
+#include <cstddef>
+
+namespace vecxyz {
+
+// Unit quaternion w + xi + yj + zk.
+struct Quat {
+    float w{1.0F}, x{}, y{}, z{};
+};
+
+// Row-major 4x4 matrix applied to points as column vectors. The kernels
+// treat it as affine and ignore the bottom row.
+struct Mat4 {
+    float m[4][4]{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+
+    static Mat4 identity() { return {}; }
+    static Mat4 translation(const VecXYZ &offset);
+    static Mat4 rotation(const Quat &q);
+    // rotation(q) followed by translation(offset).
+    static Mat4 rigid(const Quat &q, const VecXYZ &offset);
+};
+
+Mat4 operator*(const Mat4 &a, const Mat4 &b);
+
+// Columns of a struct-of-arrays point set.
+struct PointColumns {
+    float *x;
+    float *y;
+    float *z;
+};
+
+struct ConstPointColumns {
+    const float *x;
+    const float *y;
+    const float *z;
+
+    ConstPointColumns(const float *x, const float *y, const float *z)
+        : x(x), y(y), z(z) {}
+    ConstPointColumns(const PointColumns &c) : x(c.x), y(c.y), z(c.z) {}
+};
+
+// Batched kernels. `in` and `out` are either the same points (in place) or
+// do not overlap at all. SSE runs four points per step and large inputs
+// are split across the worker threads.
+void transform_points(const Mat4 &m, const VecXYZ *in, VecXYZ *out,
+                      std::size_t count);
+void transform_points(const Mat4 &m, ConstPointColumns in, PointColumns out,
+                      std::size_t count);
+void rotate_points(const Quat &q, const VecXYZ *in, VecXYZ *out,
+                   std::size_t count);
+void rotate_points(const Quat &q, ConstPointColumns in, PointColumns out,
+                   std::size_t count);
+
+// One point at a time, straight from the definitions (the quaternion path
+// uses v' = v + 2w(u x v) + 2u x (u x v)), for validating the batched
+// kernels.
+void transform_points_reference(const Mat4 &m, const VecXYZ *in,
+                                VecXYZ *out, std::size_t count);
+void rotate_points_reference(const Quat &q, const VecXYZ *in, VecXYZ *out,
+                             std::size_t count);
+
+inline PointColumns columns(SoA<VecXYZ> &points) {
+    return {points.column<0>().data(), points.column<1>().data(),
+            points.column<2>().data()};
+}
+
+inline ConstPointColumns columns(const SoA<VecXYZ> &points) {
+    return {points.column<0>().data(), points.column<1>().data(),
+            points.column<2>().data()};
+}
+
+// Resizes `out` to match `in`; `out` may be `in`.
+inline void transform_points(const Mat4 &m, const SoA<VecXYZ> &in,
+                             SoA<VecXYZ> &out) {
+    out.resize(in.size());
+    transform_points(m, columns(in), columns(out), in.size());
+}
+
+inline void rotate_points(const Quat &q, const SoA<VecXYZ> &in,
+                          SoA<VecXYZ> &out) {
+    out.resize(in.size());
+    rotate_points(q, columns(in), columns(out), in.size());
+}
+
+} // namespace vecxyz
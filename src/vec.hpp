@@ -0,0 +1,256 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <boost/serialization/array_wrapper.hpp>
+#include <boost/serialization/is_bitwise_serializable.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VECXYZ_VEC_SSE2 1
+#endif
+
+namespace vecxyz {
+
+// Storage chosen per instantiation. A 3-vector of 4-byte scalars is padded
+// to 16 bytes so it is one aligned SSE register; every other combination is
+// packed, aligned to 16 when it happens to be exactly 16 bytes.
+template <class T, std::size_t N> struct VecLayout {
+    static constexpr bool padded = N == 3 && sizeof(T) == 4;
+    static constexpr std::size_t lanes = padded ? 4 : N;
+    static constexpr std::size_t alignment =
+        sizeof(T) * lanes == 16 ? 16 : alignof(T);
+};
+
+// Fixed-size vector of float, double or std::int32_t with 2 to 4
+// components. Aggregate like VecXYZ: Vec<double, 3> p{{1.0, 2.0, 3.0}}.
+template <class T, std::size_t N> struct Vec {
+    static_assert(std::is_same_v<T, float> || std::is_same_v<T, double> ||
+                      std::is_same_v<T, std::int32_t>,
+                  "Vec supports float, double and std::int32_t");
+    static_assert(N >= 2 && N <= 4, "Vec supports 2 to 4 components");
+
+    using value_type = T;
+    using layout = VecLayout<T, N>;
+    static constexpr std::size_t size = N;
+
+    // The padding lane, if any, is kept at zero.
+    alignas(layout::alignment) T v[layout::lanes]{};
+
+    constexpr T &operator[](std::size_t i) { return v[i]; }
+    constexpr const T &operator[](std::size_t i) const { return v[i]; }
+
+    constexpr T &x() { return v[0]; }
+    constexpr T &y() { return v[1]; }
+    constexpr T x() const { return v[0]; }
+    constexpr T y() const { return v[1]; }
+    template <std::size_t M = N, std::enable_if_t<(M > 2), int> = 0>
+    constexpr T &z() {
+        return v[2];
+    }
+    template <std::size_t M = N, std::enable_if_t<(M > 2), int> = 0>
+    constexpr T z() const {
+        return v[2];
+    }
+    template <std::size_t M = N, std::enable_if_t<(M > 3), int> = 0>
+    constexpr T &w() {
+        return v[3];
+    }
+    template <std::size_t M = N, std::enable_if_t<(M > 3), int> = 0>
+    constexpr T w() const {
+        return v[3];
+    }
+
+    friend class boost::serialization::access;
+
+    // Only the N real components go to the archive, so the padded and
+    // packed forms of a vector share one archive format.
+    template <class Archive>
+    void serialize(Archive &ar, const unsigned int version) {
+        ar &boost::serialization::make_array(v, N);
+    }
+};
+
+using Vec2f = Vec<float, 2>;
+using Vec3f = Vec<float, 3>;
+using Vec4f = Vec<float, 4>;
+using Vec2d = Vec<double, 2>;
+using Vec3d = Vec<double, 3>;
+using Vec4d = Vec<double, 4>;
+using Vec2i = Vec<std::int32_t, 2>;
+using Vec3i = Vec<std::int32_t, 3>;
+using Vec4i = Vec<std::int32_t, 4>;
+
+namespace detail {
+// Picks the register kernel for a layout at compile time; the generic loop
+// covers the rest.
+template <class T, std::size_t N> struct VecKernel {
+    static constexpr bool sse_float =
+        std::is_same_v<T, float> && VecLayout<T, N>::lanes == 4;
+    static constexpr bool sse_double = std::is_same_v<T, double> && N == 2;
+    static constexpr bool sse_int =
+        std::is_same_v<T, std::int32_t> && VecLayout<T, N>::lanes == 4;
+};
+} // namespace detail
+
+template <class T, std::size_t N>
+inline Vec<T, N> operator+(const Vec<T, N> &a, const Vec<T, N> &b) {
+    Vec<T, N> r;
+#ifdef VECXYZ_VEC_SSE2
+    using kernel = detail::VecKernel<T, N>;
+    if constexpr (kernel::sse_float) {
+        _mm_store_ps(r.v, _mm_add_ps(_mm_load_ps(a.v), _mm_load_ps(b.v)));
+        return r;
+    } else if constexpr (kernel::sse_double) {
+        _mm_store_pd(r.v, _mm_add_pd(_mm_load_pd(a.v), _mm_load_pd(b.v)));
+        return r;
+    } else if constexpr (kernel::sse_int) {
+        const auto *pa = reinterpret_cast<const __m128i *>(a.v);
+        const auto *pb = reinterpret_cast<const __m128i *>(b.v);
+        _mm_store_si128(reinterpret_cast<__m128i *>(r.v),
+                        _mm_add_epi32(_mm_load_si128(pa), _mm_load_si128(pb)));
+        return r;
+    }
+#endif
+    for (std::size_t i = 0; i < N; ++i) {
+        r.v[i] = a.v[i] + b.v[i];
+    }
+    return r;
+}
+
+template <class T, std::size_t N>
+inline Vec<T, N> operator-(const Vec<T, N> &a, const Vec<T, N> &b) {
+    Vec<T, N> r;
+#ifdef VECXYZ_VEC_SSE2
+    using kernel = detail::VecKernel<T, N>;
+    if constexpr (kernel::sse_float) {
+        _mm_store_ps(r.v, _mm_sub_ps(_mm_load_ps(a.v), _mm_load_ps(b.v)));
+        return r;
+    } else if constexpr (kernel::sse_double) {
+        _mm_store_pd(r.v, _mm_sub_pd(_mm_load_pd(a.v), _mm_load_pd(b.v)));
+        return r;
+    } else if constexpr (kernel::sse_int) {
+        const auto *pa = reinterpret_cast<const __m128i *>(a.v);
+        const auto *pb = reinterpret_cast<const __m128i *>(b.v);
+        _mm_store_si128(reinterpret_cast<__m128i *>(r.v),
+                        _mm_sub_epi32(_mm_load_si128(pa), _mm_load_si128(pb)));
+        return r;
+    }
+#endif
+    for (std::size_t i = 0; i < N; ++i) {
+        r.v[i] = a.v[i] - b.v[i];
+    }
+    return r;
+}
+
+template <class T, std::size_t N>
+inline Vec<T, N> operator*(const Vec<T, N> &a, T s) {
+    Vec<T, N> r;
+#ifdef VECXYZ_VEC_SSE2
+    using kernel = detail::VecKernel<T, N>;
+    if constexpr (kernel::sse_float) {
+        // 0 * inf is NaN, so the padding lane is cleared explicitly.
+        _mm_store_ps(r.v, _mm_mul_ps(_mm_load_ps(a.v), _mm_set1_ps(s)));
+        if constexpr (N == 3) {
+            r.v[3] = 0;
+        }
+        return r;
+    } else if constexpr (kernel::sse_double) {
+        _mm_store_pd(r.v, _mm_mul_pd(_mm_load_pd(a.v), _mm_set1_pd(s)));
+        return r;
+    }
+#endif
+    for (std::size_t i = 0; i < N; ++i) {
+        r.v[i] = a.v[i] * s;
+    }
+    return r;
+}
+
+template <class T, std::size_t N>
+inline Vec<T, N> operator*(T s, const Vec<T, N> &a) {
+    return a * s;
+}
+
+template <class T, std::size_t N>
+inline bool operator==(const Vec<T, N> &a, const Vec<T, N> &b) {
+    for (std::size_t i = 0; i < N; ++i) {
+        if (a.v[i] != b.v[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class T, std::size_t N>
+inline bool operator!=(const Vec<T, N> &a, const Vec<T, N> &b) {
+    return !(a == b);
+}
+
+template <class T, std::size_t N>
+inline T dot(const Vec<T, N> &a, const Vec<T, N> &b) {
+#ifdef VECXYZ_VEC_SSE2
+    if constexpr (detail::VecKernel<T, N>::sse_float) {
+        // Relies on the zero padding lane for N == 3.
+        const __m128 m = _mm_mul_ps(_mm_load_ps(a.v), _mm_load_ps(b.v));
+        const __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+#endif
+    T sum = 0;
+    for (std::size_t i = 0; i < N; ++i) {
+        sum += a.v[i] * b.v[i];
+    }
+    return sum;
+}
+
+template <class T, std::size_t N> inline T squared_length(const Vec<T, N> &a) {
+    return dot(a, a);
+}
+
+// Component-wise conversion, e.g. vec_cast<double>(Vec3f).
+template <class U, class T, std::size_t N>
+inline Vec<U, N> vec_cast(const Vec<T, N> &a) {
+    Vec<U, N> r;
+    for (std::size_t i = 0; i < N; ++i) {
+        r.v[i] = static_cast<U>(a.v[i]);
+    }
+    return r;
+}
+
+inline Vec3f to_vec(const VecXYZ &p) { return Vec3f{{p.x, p.y, p.z, 0.0F}}; }
+inline VecXYZ to_vecxyz(const Vec3f &p) { return {p.v[0], p.v[1], p.v[2]}; }
+
+static_assert(sizeof(Vec3f) == 16 && alignof(Vec3f) == 16);
+static_assert(sizeof(Vec3d) == 24);
+static_assert(sizeof(Vec2d) == 16 && alignof(Vec2d) == 16);
+
+} // namespace vecxyz
+
+// Vectors are values: no class information and no object tracking in the
+// archive. Packed layouts are also bitwise serializable, so arrays and
+// vectors of them go through the binary archives' array fast path.
+namespace boost {
+namespace serialization {
+template <class T, std::size_t N>
+struct implementation_level_impl<const vecxyz::Vec<T, N>> {
+    typedef mpl::integral_c_tag tag;
+    typedef mpl::int_<object_serializable> type;
+    BOOST_STATIC_CONSTANT(int, value = type::value);
+};
+
+template <class T, std::size_t N>
+struct tracking_level<vecxyz::Vec<T, N>> {
+    typedef mpl::integral_c_tag tag;
+    typedef mpl::int_<track_never> type;
+    BOOST_STATIC_CONSTANT(int, value = type::value);
+};
+
+template <class T, std::size_t N>
+struct is_bitwise_serializable<vecxyz::Vec<T, N>>
+    : mpl::bool_<!vecxyz::VecLayout<T, N>::padded> {};
+} // namespace serialization
+} // namespace boost
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "parallel.hpp"
+#include "vecxyz.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace vecxyz {
+
+// Expression templates over std::vector<VecXYZ>. An expression such as
+//
+//     assign(out, a * 2.0F + b - c);
+//
+// builds a tree of lightweight nodes and evaluates it in one loop with no
+// temporary arrays. Every operation is component-wise, so the loop runs
+// over the 3 * n floats of the packed points and vectorizes like a plain
+// float loop. The operators are found through ADL on std::vector<VecXYZ>
+// and on the node types.
+
+// CRTP base of every expression node.
+template <class E> struct VecExpr {
+    const E &self() const { return static_cast<const E &>(*this); }
+};
+
+enum class Execution { sequential, parallel, automatic };
+
+// Point count above which Execution::automatic spreads the loop over the
+// worker threads.
+constexpr std::size_t parallel_expr_threshold = std::size_t{1} << 16U;
+
+namespace expr {
+// Size reported by operands that broadcast, such as scalars.
+constexpr std::size_t broadcast = std::numeric_limits<std::size_t>::max();
+
+struct Array : VecExpr<Array> {
+    const float *data;
+    std::size_t count;
+
+    explicit Array(const std::vector<VecXYZ> &points)
+        : data(reinterpret_cast<const float *>(points.data())),
+          count(points.size()) {}
+    float at(std::size_t j) const { return data[j]; }
+    std::size_t size() const { return count; }
+};
+
+struct Scalar : VecExpr<Scalar> {
+    float value;
+
+    explicit Scalar(float value) : value(value) {}
+    float at(std::size_t) const { return value; }
+    std::size_t size() const { return broadcast; }
+};
+
+struct Add {
+    static float apply(float a, float b) { return a + b; }
+};
+struct Sub {
+    static float apply(float a, float b) { return a - b; }
+};
+struct Mul {
+    static float apply(float a, float b) { return a * b; }
+};
+struct Div {
+    static float apply(float a, float b) { return a / b; }
+};
+
+template <class Op, class L, class R>
+struct Binary : VecExpr<Binary<Op, L, R>> {
+    L lhs;
+    R rhs;
+
+    Binary(const L &lhs, const R &rhs) : lhs(lhs), rhs(rhs) {
+        if (lhs.size() != broadcast && rhs.size() != broadcast &&
+            lhs.size() != rhs.size()) {
+            throw std::invalid_argument("VecXYZ expression size mismatch");
+        }
+    }
+    float at(std::size_t j) const { return Op::apply(lhs.at(j), rhs.at(j)); }
+    std::size_t size() const { return std::min(lhs.size(), rhs.size()); }
+};
+
+template <class A> struct Negate : VecExpr<Negate<A>> {
+    A arg;
+
+    explicit Negate(const A &arg) : arg(arg) {}
+    float at(std::size_t j) const { return -arg.at(j); }
+    std::size_t size() const { return arg.size(); }
+};
+
+// Turns an operand into a node: nodes are kept, containers become Array
+// and numbers become Scalar.
+template <class E> const E &lift(const VecExpr<E> &e) { return e.self(); }
+inline Array lift(const std::vector<VecXYZ> &points) { return Array(points); }
+template <class T, std::enable_if_t<std::is_arithmetic_v<T>, int> = 0>
+Scalar lift(T value) {
+    return Scalar(static_cast<float>(value));
+}
+
+template <class T>
+using lifted_t = std::decay_t<decltype(lift(std::declval<const T &>()))>;
+
+template <class T>
+constexpr bool is_operand_v =
+    std::is_base_of_v<VecExpr<T>, T> ||
+    std::is_same_v<T, std::vector<VecXYZ>>;
+
+// Operators need at least one array-like side; scalar op scalar stays
+// ordinary arithmetic.
+template <class L, class R>
+constexpr bool enable_binary_v =
+    (is_operand_v<L> && (is_operand_v<R> || std::is_arithmetic_v<R>)) ||
+    (std::is_arithmetic_v<L> && is_operand_v<R>);
+
+template <class Op, class L, class R>
+using binary_t = Binary<Op, lifted_t<L>, lifted_t<R>>;
+} // namespace expr
+
+template <class L, class R,
+          std::enable_if_t<expr::enable_binary_v<L, R>, int> = 0>
+expr::binary_t<expr::Add, L, R> operator+(const L &lhs, const R &rhs) {
+    return {expr::lift(lhs), expr::lift(rhs)};
+}
+
+template <class L, class R,
+          std::enable_if_t<expr::enable_binary_v<L, R>, int> = 0>
+expr::binary_t<expr::Sub, L, R> operator-(const L &lhs, const R &rhs) {
+    return {expr::lift(lhs), expr::lift(rhs)};
+}
+
+// Component-wise product; with a scalar on either side, a scale.
+template <class L, class R,
+          std::enable_if_t<expr::enable_binary_v<L, R>, int> = 0>
+expr::binary_t<expr::Mul, L, R> operator*(const L &lhs, const R &rhs) {
+    return {expr::lift(lhs), expr::lift(rhs)};
+}
+
+template <class L, class R,
+          std::enable_if_t<expr::enable_binary_v<L, R>, int> = 0>
+expr::binary_t<expr::Div, L, R> operator/(const L &lhs, const R &rhs) {
+    return {expr::lift(lhs), expr::lift(rhs)};
+}
+
+template <class A, std::enable_if_t<expr::is_operand_v<A>, int> = 0>
+expr::Negate<expr::lifted_t<A>> operator-(const A &arg) {
+    return expr::Negate<expr::lifted_t<A>>(expr::lift(arg));
+}
+
+// Evaluates `e` into out[0, e.size()).
+template <class E>
+void evaluate(const VecExpr<E> &e, VecXYZ *out,
+              Execution execution = Execution::automatic) {
+    const E &node = e.self();
+    const std::size_t count = node.size();
+    if (count == expr::broadcast) {
+        throw std::invalid_argument("VecXYZ expression has no array operand");
+    }
+    auto *dst = reinterpret_cast<float *>(out);
+    auto kernel = [&node, dst](std::size_t begin, std::size_t end) {
+        for (std::size_t j = 3 * begin; j < 3 * end; ++j) {
+            dst[j] = node.at(j);
+        }
+    };
+
+    const bool parallel =
+        execution == Execution::parallel ||
+        (execution == Execution::automatic && count >= parallel_expr_threshold);
+    if (parallel) {
+        parallel_for(count, parallel_expr_threshold / 4, kernel);
+    } else {
+        kernel(0, count);
+    }
+}
+
+// out = e. `out` may also appear in `e` as long as it already has the
+// expression's size.
+template <class E>
+void assign(std::vector<VecXYZ> &out, const VecExpr<E> &e,
+            Execution execution = Execution::automatic) {
+    const std::size_t count = e.self().size();
+    if (out.size() == count) {
+        evaluate(e, out.data(), execution);
+        return;
+    }
+    std::vector<VecXYZ> result(count);
+    evaluate(e, result.data(), execution);
+    out.swap(result);
+}
+
+template <class E>
+std::vector<VecXYZ> materialize(const VecExpr<E> &e,
+                                Execution execution = Execution::automatic) {
+    std::vector<VecXYZ> result;
+    assign(result, e, execution);
+    return result;
+}
+
+} // namespace vecxyz
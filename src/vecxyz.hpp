@@ -0,0 +1,27 @@
+#pragma once
+
+#include <boost/serialization/access.hpp>
+#include <type_traits>
+
+namespace vecxyz {
+
+struct VecXYZ {
+    float x{}, y{}, z{};
+    friend class boost::serialization::access;
+
+    template <class Archive>
+    void serialize(Archive &ar, const unsigned int version) {
+        ar & x;
+        ar & y;
+        ar & z;
+    }
+};
+
+// The binary formats (chunk files, shared memory, wire framing) store points
+// as three packed little-endian floats and copy them with memcpy.
+static_assert(sizeof(VecXYZ) == 3 * sizeof(float),
+              "VecXYZ must stay packed");
+static_assert(std::is_trivially_copyable_v<VecXYZ>,
+              "VecXYZ must stay trivially copyable");
+
+} // namespace vecxyz
@@ -0,0 +1,141 @@
+#include "voxel_grid.hpp"
+#include "parallel.hpp"
+#include "point_stats.hpp"
+#include "radix_sort.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+namespace vecxyz {
+namespace {
+constexpr std::size_t key_grain = std::size_t{1} << 14U;
+constexpr std::size_t points_per_segment = std::size_t{1} << 16U;
+
+unsigned bit_width(std::uint64_t value) {
+    unsigned bits = 0;
+    while (value != 0) {
+        ++bits;
+        value >>= 1U;
+    }
+    return bits;
+}
+
+VecXYZ reduce_voxel(const VecXYZ *points, const KeyIndex *first,
+                    const KeyIndex *last, VoxelOutput output) {
+    if (output == VoxelOutput::first_point) {
+        // The radix sort is stable and keys start in input order.
+        return points[first->index];
+    }
+    double sx = 0;
+    double sy = 0;
+    double sz = 0;
+    for (const KeyIndex *it = first; it != last; ++it) {
+        const VecXYZ &p = points[it->index];
+        sx += p.x;
+        sy += p.y;
+        sz += p.z;
+    }
+    const double n = static_cast<double>(last - first);
+    return {static_cast<float>(sx / n), static_cast<float>(sy / n),
+            static_cast<float>(sz / n)};
+}
+} // namespace
+
+void voxel_downsample(const VecXYZ *points, std::size_t count,
+                      const VoxelGridOptions &options, const PointSink &sink) {
+    if (!(options.leaf_size > 0.0F)) {
+        throw std::invalid_argument("voxel leaf size must be positive");
+    }
+    if (count > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::invalid_argument("voxel_downsample takes < 2^32 points");
+    }
+    if (count == 0) {
+        return;
+    }
+
+    const Aabb box = compute_bounds(points, count);
+    const double inv_leaf = 1.0 / options.leaf_size;
+    const double origin[3] = {box.min.x, box.min.y, box.min.z};
+    const double extent[3] = {double{box.max.x} - box.min.x,
+                              double{box.max.y} - box.min.y,
+                              double{box.max.z} - box.min.z};
+    std::uint64_t dims[3];
+    double cells = 1;
+    for (int k = 0; k < 3; ++k) {
+        const double d = std::floor(extent[k] * inv_leaf) + 1;
+        cells *= d;
+        if (cells > 9.2e18) {
+            throw std::invalid_argument("voxel grid too fine for 64-bit keys");
+        }
+        dims[k] = static_cast<std::uint64_t>(d);
+    }
+
+    std::vector<KeyIndex> keys(count);
+    parallel_for(count, key_grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const VecXYZ &p = points[i];
+            const double c[3] = {p.x, p.y, p.z};
+            std::uint64_t cell[3];
+            for (int k = 0; k < 3; ++k) {
+                cell[k] = std::min(
+                    dims[k] - 1,
+                    static_cast<std::uint64_t>((c[k] - origin[k]) * inv_leaf));
+            }
+            keys[i] = {cell[0] + dims[0] * (cell[1] + dims[1] * cell[2]),
+                       static_cast<std::uint32_t>(i)};
+        }
+    });
+    radix_sort(keys, bit_width(static_cast<std::uint64_t>(cells) - 1));
+
+    // Segments start on voxel boundaries so each voxel is reduced once.
+    const std::size_t segments = std::clamp<std::size_t>(
+        count / points_per_segment, 1, parallel_concurrency() * 2);
+    std::vector<std::size_t> starts(segments + 1, count);
+    for (std::size_t s = 0; s < segments; ++s) {
+        std::size_t at = s * count / segments;
+        if (s > 0) {
+            at = std::max(at, starts[s - 1]);
+        }
+        while (at > 0 && at < count && keys[at].key == keys[at - 1].key) {
+            ++at;
+        }
+        starts[s] = at;
+    }
+
+    std::vector<std::vector<VecXYZ>> outputs(segments);
+    parallel_for(segments, 1, [&](std::size_t first, std::size_t last) {
+        for (std::size_t s = first; s < last; ++s) {
+            const KeyIndex *it = keys.data() + starts[s];
+            const KeyIndex *end = keys.data() + starts[s + 1];
+            while (it != end) {
+                const KeyIndex *run = it;
+                while (run != end && run->key == it->key) {
+                    ++run;
+                }
+                outputs[s].push_back(
+                    reduce_voxel(points, it, run, options.output));
+                it = run;
+            }
+        }
+    });
+
+    for (const auto &batch : outputs) {
+        if (!batch.empty()) {
+            sink(batch.data(), batch.size());
+        }
+    }
+}
+
+std::vector<VecXYZ> voxel_downsample(const std::vector<VecXYZ> &points,
+                                     const VoxelGridOptions &options) {
+    std::vector<VecXYZ> result;
+    voxel_downsample(points.data(), points.size(), options,
+                     [&result](const VecXYZ *batch, std::size_t count) {
+                         result.insert(result.end(), batch, batch + count);
+                     });
+    return result;
+}
+
+} // namespace vecxyz
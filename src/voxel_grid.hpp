@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vecxyz.hpp"
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace vecxyz {
+
+enum class VoxelOutput {
+    centroid,    // mean of the points in the voxel
+    first_point, // the voxel's point with the lowest input index
+};
+
+struct VoxelGridOptions {
+    float leaf_size = 0.1F;
+    VoxelOutput output = VoxelOutput::centroid;
+};
+
+// Receives the downsampled points in consecutive batches, ordered by voxel.
+// A ChunkFileWriter::append or an archive loop can consume them directly.
+using PointSink = std::function<void(const VecXYZ *points, std::size_t count)>;
+
+// One output point per occupied voxel of a grid with cubic cells of
+// options.leaf_size. Points are keyed by voxel and grouped with a parallel
+// radix sort instead of a map. Input points must be finite. Throws
+// std::invalid_argument when the grid has more than 2^63 cells.
+void voxel_downsample(const VecXYZ *points, std::size_t count,
+                      const VoxelGridOptions &options, const PointSink &sink);
+
+std::vector<VecXYZ> voxel_downsample(const std::vector<VecXYZ> &points,
+                                     const VoxelGridOptions &options);
+
+} // namespace vecxyz
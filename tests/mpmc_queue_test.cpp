@@ -0,0 +1,164 @@
+#include "mpmc_queue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using vecxyz::MpmcQueue;
+
+namespace {
+constexpr std::size_t items_per_producer = 200000;
+// Small enough that every run wraps the ring many thousand times.
+constexpr std::size_t queue_capacity = 64;
+
+struct Item {
+    std::uint32_t producer;
+    std::uint32_t sequence;
+};
+
+int failures = 0;
+
+void fail(const std::string &message) {
+    fmt::print(stderr, "FAIL: {}\n", message);
+    ++failures;
+}
+
+// Runs at the ring's edge in one thread, where the outcome is exact.
+void check_wrap() {
+    MpmcQueue<Item> queue(8);
+    std::vector<Item> in(12);
+    for (std::size_t i = 0; i < in.size(); ++i) {
+        in[i] = {0, static_cast<std::uint32_t>(i)};
+    }
+    std::vector<Item> out(12);
+    if (queue.try_enqueue_bulk(in.data(), 5) != 5 ||
+        queue.try_dequeue_bulk(out.data(), 5) != 5) {
+        fail("wrap: first lap");
+        return;
+    }
+    // Starts at cell 5 and continues at cell 0; the ninth item does not
+    // fit.
+    if (queue.try_enqueue_bulk(in.data() + 3, 9) != 8) {
+        fail("wrap: a full ring took more than its capacity");
+    }
+    if (queue.size_approx() != 8 || queue.try_enqueue(in[0])) {
+        fail("wrap: ring not reported full");
+    }
+    if (queue.try_dequeue_bulk(out.data(), 12) != 8) {
+        fail("wrap: bulk dequeue across the edge");
+    }
+    for (std::size_t i = 0; i < 8; ++i) {
+        if (out[i].sequence != i + 3) {
+            fail(fmt::format("wrap: item {} is {}", i, out[i].sequence));
+        }
+    }
+    Item item{};
+    if (queue.try_dequeue(item) || queue.size_approx() != 0) {
+        fail("wrap: ring not empty after draining");
+    }
+}
+
+// Every producer enqueues 0, 1, 2, ... tagged with its id; consumers keep
+// what they see. Each item must arrive exactly once and, within one
+// consumer, every producer's items must arrive in order. `bulk` > 1 moves
+// runs of varying length, so claimed runs straddle the ring's edge.
+void check_threads(std::size_t producers, std::size_t consumers,
+                   std::size_t bulk) {
+    const std::string name =
+        fmt::format("{}P {}C bulk {}", producers, consumers, bulk);
+    MpmcQueue<Item> queue(queue_capacity);
+    std::atomic<std::size_t> remaining{producers * items_per_producer};
+    std::vector<std::vector<std::uint32_t>> seen(
+        consumers, std::vector<std::uint32_t>(producers * items_per_producer));
+    std::vector<int> out_of_order(consumers);
+    std::vector<std::thread> threads;
+    for (std::size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            std::vector<Item> run(bulk);
+            std::size_t next = 0;
+            std::size_t length = 1;
+            while (next < items_per_producer) {
+                length = bulk == 1 ? 1 : length % bulk + 1;
+                const std::size_t n =
+                    std::min(length, items_per_producer - next);
+                for (std::size_t i = 0; i < n; ++i) {
+                    run[i] = {static_cast<std::uint32_t>(p),
+                              static_cast<std::uint32_t>(next + i)};
+                }
+                std::size_t sent = 0;
+                while (sent < n) {
+                    const std::size_t got =
+                        queue.try_enqueue_bulk(run.data() + sent, n - sent);
+                    if (got == 0) {
+                        std::this_thread::yield();
+                    }
+                    sent += got;
+                }
+                next += n;
+            }
+        });
+    }
+    for (std::size_t c = 0; c < consumers; ++c) {
+        threads.emplace_back([&, c] {
+            std::vector<Item> out(bulk);
+            std::vector<std::int64_t> last(producers, -1);
+            while (remaining.load(std::memory_order_relaxed) != 0) {
+                const std::size_t n = queue.try_dequeue_bulk(out.data(), bulk);
+                if (n == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (std::size_t i = 0; i < n; ++i) {
+                    const Item &item = out[i];
+                    if (item.sequence <= last[item.producer]) {
+                        ++out_of_order[c];
+                    }
+                    last[item.producer] = item.sequence;
+                    ++seen[c][item.producer * items_per_producer +
+                              item.sequence];
+                }
+                remaining.fetch_sub(n, std::memory_order_relaxed);
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (std::size_t c = 0; c < consumers; ++c) {
+        if (out_of_order[c] != 0) {
+            fail(fmt::format("{}: consumer {} saw {} items out of order",
+                             name, c, out_of_order[c]));
+        }
+    }
+    std::size_t wrong = 0;
+    for (std::size_t i = 0; i < producers * items_per_producer; ++i) {
+        std::uint32_t times = 0;
+        for (std::size_t c = 0; c < consumers; ++c) {
+            times += seen[c][i];
+        }
+        wrong += times != 1;
+    }
+    if (wrong != 0) {
+        fail(fmt::format("{}: {} items not delivered exactly once", name,
+                         wrong));
+    }
+    Item item{};
+    if (queue.try_dequeue(item)) {
+        fail(fmt::format("{}: items left over", name));
+    }
+}
+} // namespace
+
+int main() {
+    check_wrap();
+    check_threads(4, 3, 1);
+    check_threads(4, 3, 48);
+    check_threads(1, 4, 48);
+    check_threads(6, 1, 48);
+    return failures == 0 ? 0 : 1;
+}
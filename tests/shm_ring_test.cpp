@@ -0,0 +1,277 @@
+#include "shm_ring.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fmt/core.h>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using vecxyz::RingBatch;
+using vecxyz::ShmRing;
+using vecxyz::ShmRingError;
+using vecxyz::VecXYZ;
+namespace bip = boost::interprocess;
+
+namespace {
+constexpr std::size_t producers = 3;
+constexpr std::size_t items_per_producer = 100000;
+// Small enough that batches wrap constantly and both sides keep running
+// into a full or an empty ring.
+constexpr std::size_t ring_capacity = 16;
+// Parks on the futex almost at once instead of spinning.
+constexpr unsigned spin_limit = 1;
+
+int failures = 0;
+
+void fail(const std::string &message) {
+    fmt::print(stderr, "FAIL: {}\n", message);
+    ++failures;
+}
+
+std::string ring_name(const char *test) {
+    return fmt::format("vecxyz_test_{}_{}", test, ::getpid());
+}
+
+// Producer p's i-th point; exact in float for the counts used here.
+VecXYZ item(std::size_t p, std::size_t i) {
+    return {static_cast<float>(p), static_cast<float>(i),
+            static_cast<float>(i % 7)};
+}
+
+bool same(const VecXYZ &a, const VecXYZ &b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Committed points outlive close(): the consumer still drains them, and
+// only then sees the end.
+void check_close_drains() {
+    const std::string name = ring_name("drain");
+    ShmRing::remove(name);
+    ShmRing ring(bip::create_only, name, 8, spin_limit);
+    std::vector<VecXYZ> in{item(0, 0), item(0, 1), item(0, 2), item(0, 3),
+                           item(0, 4)};
+    ring.push(in.data(), in.size());
+    ring.close();
+    if (!ring.closed()) {
+        fail("drain: ring not closed");
+    }
+    try {
+        ring.reserve(1);
+        fail("drain: reserve on a closed ring");
+    } catch (const ShmRingError &) {
+    }
+    std::vector<VecXYZ> out(8);
+    const std::size_t n = ring.pop(out.data(), out.size());
+    if (n != in.size()) {
+        fail(fmt::format("drain: {} of {} points", n, in.size()));
+    }
+    for (std::size_t i = 0; i < std::min(n, in.size()); ++i) {
+        if (!same(out[i], in[i])) {
+            fail(fmt::format("drain: point {} differs", i));
+        }
+    }
+    if (ring.pop(out.data(), out.size()) != 0 || ring.size() != 0) {
+        fail("drain: points after the drain");
+    }
+    try {
+        ring.reserve(9);
+        fail("drain: reservation larger than the ring");
+    } catch (const std::length_error &) {
+    }
+    ShmRing::remove(name);
+}
+
+// A reservation past the end of the ring comes back as two slices.
+void check_wrap_slices() {
+    const std::string name = ring_name("wrap");
+    ShmRing::remove(name);
+    ShmRing ring(bip::create_only, name, 8, spin_limit);
+    ring.commit(ring.reserve(6));
+    ring.release(ring.acquire(6));
+    const RingBatch batch = ring.reserve(5);
+    if (batch.parts[0].size != 2 || batch.parts[1].size != 3) {
+        fail(fmt::format("wrap: slices of {} and {}", batch.parts[0].size,
+                         batch.parts[1].size));
+    }
+    std::size_t i = 0;
+    for (const auto &part : batch.parts) {
+        for (std::size_t k = 0; k < part.size; ++k) {
+            part.data[k] = item(1, i++);
+        }
+    }
+    ring.commit(batch);
+    std::vector<VecXYZ> out(8);
+    if (ring.pop(out.data(), out.size()) != 5) {
+        fail("wrap: short read across the edge");
+    }
+    for (i = 0; i < 5; ++i) {
+        if (!same(out[i], item(1, i))) {
+            fail(fmt::format("wrap: point {} differs", i));
+        }
+    }
+    ShmRing::remove(name);
+}
+
+// close() wakes a producer parked on a full ring and a consumer parked on
+// an empty one.
+void check_close_wakes() {
+    const std::string name = ring_name("wake");
+    ShmRing::remove(name);
+    ShmRing ring(bip::create_only, name, 4, spin_limit);
+    const std::vector<VecXYZ> fill(4, item(2, 0));
+    ring.push(fill.data(), fill.size());
+    bool thrown = false;
+    std::thread producer([&] {
+        try {
+            ring.reserve(1);
+        } catch (const ShmRingError &) {
+            thrown = true;
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ring.close();
+    producer.join();
+    if (!thrown) {
+        fail("wake: parked producer not told the ring closed");
+    }
+
+    const std::string empty_name = ring_name("wake_empty");
+    ShmRing::remove(empty_name);
+    ShmRing empty(bip::create_only, empty_name, 4, spin_limit);
+    std::size_t got = 1;
+    std::thread consumer([&] { got = empty.acquire(4).size(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    empty.close();
+    consumer.join();
+    if (got != 0) {
+        fail("wake: parked consumer got points from an empty ring");
+    }
+    ShmRing::remove(name);
+    ShmRing::remove(empty_name);
+}
+
+// Child process: sends its points in batches of 1 to ring_capacity,
+// alternating between reserve/commit in place and push.
+[[noreturn]] void produce(const std::string &name, std::size_t p) {
+    try {
+        ShmRing ring(bip::open_only, name, spin_limit);
+        std::size_t next = 0;
+        std::size_t length = 0;
+        std::vector<VecXYZ> staged(ring_capacity);
+        while (next < items_per_producer) {
+            length = length % ring_capacity + 1;
+            const std::size_t n =
+                std::min(length, items_per_producer - next);
+            if (length % 2 == 0) {
+                const RingBatch batch = ring.reserve(n);
+                // Holding a reservation open lets later ones finish
+                // first; they must still be published after it.
+                if (length % 8 == 0) {
+                    std::this_thread::yield();
+                }
+                std::size_t i = next;
+                for (const auto &part : batch.parts) {
+                    for (std::size_t k = 0; k < part.size; ++k) {
+                        part.data[k] = item(p, i++);
+                    }
+                }
+                ring.commit(batch);
+            } else {
+                for (std::size_t i = 0; i < n; ++i) {
+                    staged[i] = item(p, next + i);
+                }
+                ring.push(staged.data(), n);
+            }
+            next += n;
+        }
+    } catch (const std::exception &e) {
+        fmt::print(stderr, "producer {}: {}\n", p, e.what());
+        ::_exit(1);
+    }
+    ::_exit(0);
+}
+
+// Producer processes feed one consumer through a tiny ring. Every point
+// must arrive once, each producer's in order, and the ring must read as
+// drained only after the last producer's points.
+void check_processes() {
+    const std::string name = ring_name("procs");
+    ShmRing::remove(name);
+    ShmRing ring(bip::create_only, name, ring_capacity, spin_limit);
+    std::vector<pid_t> children;
+    for (std::size_t p = 0; p < producers; ++p) {
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            produce(name, p);
+        }
+        if (pid < 0) {
+            fail("processes: fork failed");
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    bool children_ok = true;
+    std::thread closer([&] {
+        for (const pid_t pid : children) {
+            int status = 0;
+            if (::waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+                WEXITSTATUS(status) != 0) {
+                children_ok = false;
+            }
+        }
+        ring.close();
+    });
+
+    std::vector<std::size_t> next(producers, 0);
+    std::size_t wrong = 0;
+    for (std::size_t round = 0;; ++round) {
+        const RingBatch batch = ring.acquire(round % ring_capacity + 1);
+        if (batch.empty()) {
+            break;
+        }
+        for (const auto &part : batch.parts) {
+            for (std::size_t k = 0; k < part.size; ++k) {
+                const VecXYZ &point = part.data[k];
+                const auto p = static_cast<std::size_t>(point.x);
+                if (p >= producers || !same(point, item(p, next[p]))) {
+                    ++wrong;
+                    continue;
+                }
+                ++next[p];
+            }
+        }
+        ring.release(batch);
+    }
+    closer.join();
+
+    if (!children_ok) {
+        fail("processes: a producer failed");
+    }
+    if (wrong != 0) {
+        fail(fmt::format("processes: {} points missing, repeated or out of "
+                         "order",
+                         wrong));
+    }
+    for (std::size_t p = 0; p < producers; ++p) {
+        if (next[p] != items_per_producer) {
+            fail(fmt::format("processes: producer {} delivered {} of {}", p,
+                             next[p], items_per_producer));
+        }
+    }
+    ShmRing::remove(name);
+}
+} // namespace
+
+int main() {
+    check_close_drains();
+    check_wrap_slices();
+    check_close_wakes();
+    check_processes();
+    return failures == 0 ? 0 : 1;
+}
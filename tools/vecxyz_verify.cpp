@@ -0,0 +1,33 @@
+#include "chunk_file.hpp"
+#include "crc32c.hpp"
+#include <fmt/core.h>
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fmt::print(stderr, "usage: {} <chunk file>...\n", argv[0]);
+        return 2;
+    }
+
+    fmt::print("crc32c: {}\n", vecxyz::crc32c_hardware_available()
+                                   ? "sse4.2"
+                                   : "table");
+    int status = 0;
+    for (int i = 1; i < argc; ++i) {
+        const auto report = vecxyz::verify_chunk_file(argv[i]);
+        if (!report.index_ok) {
+            fmt::print("{}: FAILED ({})\n", argv[i], report.error);
+            status = 1;
+            continue;
+        }
+        for (auto chunk : report.bad_chunks) {
+            fmt::print("{}: chunk {} checksum mismatch\n", argv[i], chunk);
+        }
+        fmt::print("{}: {} ({} points, {} chunks, {} bad)\n", argv[i],
+                   report.ok() ? "OK" : "FAILED", report.point_count,
+                   report.chunk_count, report.bad_chunks.size());
+        if (!report.ok()) {
+            status = 1;
+        }
+    }
+    return status;
+}